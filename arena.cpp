@@ -0,0 +1,413 @@
+/*
+ * Arena mode for Snake, see arena.h
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+#include "arena.h"
+
+
+/* Where a step in each direction leads, indexed by UP, DOWN, RIGHT, LEFT; d ^ 1 is the way back */
+static const int stepX[4] = { 0, 0, 1, -1 };
+static const int stepY[4] = { -1, 1, 0, 0 };
+
+/* The first ring of a snake, it doubles when the snake outgrows it */
+#define ARENA_RING_SLOTS 64
+
+/*
+ * Function to get the number of moves between two cells, the short way round the edges
+ */
+static int distanceBetween(int ax, int ay, int bx, int by) {
+	int dx = abs(ax - bx);
+	int dy = abs(ay - by);
+	return min(dx, BoardWidth - dx) + min(dy, BoardHeight - dy);
+}
+
+WorkerPool::WorkerPool(int numThreads) : job(NULL), jobCount(0), generation(0), pending(0), quitting(false) {
+	for (int i = 1; i < numThreads; i++) {
+		threads.push_back(thread(&WorkerPool::work, this, i));
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		lock_guard<mutex> guard(lock);
+		quitting = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void WorkerPool::run(int count, const function<void(int, int)> &body) {
+	if (threads.empty()) {
+		body(0, count);
+		return;
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		job = &body;
+		jobCount = count;
+		pending = threads.size();
+		generation++;
+	}
+	wake.notify_all();
+	body(0, count / getNumThreads());
+
+	unique_lock<mutex> guard(lock);
+	while (pending > 0) finished.wait(guard);
+}
+
+void WorkerPool::work(int self) {
+	unsigned long seen = 0;
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		while (!quitting && generation == seen) wake.wait(guard);
+		if (quitting) return;
+		seen = generation;
+
+		const function<void(int, int)> &body = *job;
+		int count = jobCount;
+		guard.unlock();
+		body((long)count * self / getNumThreads(), (long)count * (self + 1) / getNumThreads());
+		guard.lock();
+		if (--pending == 0) finished.notify_one();
+	}
+}
+
+Arena::Arena(int numAi, uint64_t seed, int numThreads) : seed(seed), rng(seed), workers(numThreads), snakes(numAi + 1) {
+	reset();
+}
+
+void Arena::reset() {
+	int numCells = BoardWidth * BoardHeight;
+	grid.assign(numCells, ARENA_EMPTY);
+	occupied.clear();
+	tiles.clear();
+	heads.clear();
+	fruitCells.clear();
+	fruitTiles.clear();
+	fruits.clear();
+	fruitSlots.clear();
+
+	obstacles.generateObstacles(rng);
+	for (int i = 0; i < obstacles.getNumOfObs(); i++) {
+		const Obstacle &ob = obstacles.getObs(i);
+		for (int y = ob.getY(); y < ob.getY() + ob.getYLength(); y++) {
+			for (int x = ob.getX(); x < ob.getX() + ob.getXLength(); x++) {
+				grid[cellIndex(x, y)] = ARENA_OBSTACLE;
+			}
+		}
+	}
+
+	tick = 0;
+	numOfLives = START_LIVES;
+	gameOver = false;
+	totalDeaths = 0;
+	headOnDeaths = 0;
+
+	int numSnakes = snakes.size();
+	moveTo.assign(numSnakes, -1);
+	dies.assign(numSnakes, 0);
+	claims.reserve(numSnakes);
+	for (int i = 0; i < numSnakes; i++) {
+		ArenaSnake &snake = snakes[i];
+		if (snake.ring.empty()) snake.ring.assign(ARENA_RING_SLOTS, 0);
+		snake.length = 0;
+		snake.alive = false;
+		snake.respawnTick = 0;
+		snake.score = 0;
+		snake.deaths = 0;
+		snake.target = -1;
+		snake.rng.reseed(seed ^ (0xd1b54a32d192ed03ULL * (i + 1)));
+		respawn(i);
+	}
+
+	missingFruits = numSnakes / ARENA_SNAKES_PER_FRUIT + 1;
+	fruitDraws.reserve(missingFruits);
+	fruitSlots.reserve(missingFruits);
+	spawnFruits();
+}
+
+void Arena::changeDirection(int direction) {
+	ArenaSnake &player = snakes[PLAYER_SNAKE];
+	if (direction == (player.direction ^ 1)) return; // back onto the neck
+	player.nextDirection = direction;
+}
+
+void Arena::revive() {
+	if (!gameOver) return;
+	numOfLives++;
+	gameOver = false;
+	snakes[PLAYER_SNAKE].respawnTick = tick; // back on the next tick
+}
+
+int Arena::stepCell(int cell, int direction) {
+	return cellIndex(wrapCell(cell % BoardWidth + stepX[direction], BoardWidth),
+					 wrapCell(cell / BoardWidth + stepY[direction], BoardHeight));
+}
+
+void Arena::putCell(int cell, int what) {
+	int x = cell % BoardWidth;
+	int y = cell / BoardWidth;
+	int old = grid[cell];
+	if (old < ARENA_OBSTACLE) {
+		occupied.reset(x, y);
+		tiles.remove(x, y);
+	} else if (old == ARENA_FRUIT) {
+		fruitCells.reset(x, y);
+		fruitTiles.remove(x, y);
+	}
+
+	if (what < ARENA_OBSTACLE) {
+		occupied.set(x, y);
+		tiles.add(x, y);
+	} else if (what == ARENA_FRUIT) {
+		fruitCells.set(x, y);
+		fruitTiles.add(x, y);
+	}
+	grid[cell] = what;
+}
+
+void Arena::pushHead(int i, int cell) {
+	ArenaSnake &snake = snakes[i];
+	if (snake.length == (int)snake.ring.size()) { // full, double it keeping the order from the tail
+		vector<uint32_t> grown(snake.ring.size() * 2);
+		for (int j = 0; j < snake.length; j++) {
+			grown[snake.length - 1 - j] = snake.getCell(j);
+		}
+		snake.ring.swap(grown);
+		snake.ringHead = snake.length - 1;
+	}
+	if (snake.length > 0) heads.reset(snake.head % BoardWidth, snake.head / BoardWidth);
+	snake.ringHead = (snake.ringHead + 1) & (snake.ring.size() - 1);
+	snake.ring[snake.ringHead] = cell;
+	snake.length++;
+	snake.head = cell;
+	heads.set(cell % BoardWidth, cell / BoardWidth);
+	putCell(cell, i);
+}
+
+void Arena::popTail(int i) {
+	ArenaSnake &snake = snakes[i];
+	putCell(snake.getCell(snake.length - 1), ARENA_EMPTY);
+	snake.length--;
+}
+
+void Arena::removeBody(int i) {
+	ArenaSnake &snake = snakes[i];
+	heads.reset(snake.head % BoardWidth, snake.head / BoardWidth);
+	for (int j = 0; j < snake.length; j++) {
+		putCell(snake.getCell(j), ARENA_EMPTY);
+	}
+	snake.length = 0;
+	snake.alive = false;
+}
+
+bool Arena::respawn(int i) {
+	ArenaSnake &snake = snakes[i];
+	for (int t = 0; t < ARENA_PLACE_TRIES; t++) {
+		int head = cellIndex(snake.rng.below(BoardWidth), snake.rng.below(BoardHeight));
+		int direction = snake.rng.below(4);
+
+		/* the body goes back from the head in a straight line, and the two cells ahead have to be clear too */
+		int cell = stepCell(stepCell(head, direction), direction);
+		bool clear = true;
+		for (int j = 0; j < START_LENGTH + 2 && clear; j++) {
+			clear = (grid[cell] == ARENA_EMPTY);
+			cell = stepCell(cell, direction ^ 1);
+		}
+		if (!clear) continue;
+
+		int tail = head;
+		for (int j = 1; j < START_LENGTH; j++) {
+			tail = stepCell(tail, direction ^ 1);
+		}
+		snake.ringHead = 0;
+		snake.length = 0;
+		for (cell = tail; snake.length < START_LENGTH; cell = stepCell(cell, direction)) {
+			pushHead(i, cell);
+		}
+		snake.direction = direction;
+		snake.nextDirection = direction;
+		snake.target = -1;
+		snake.alive = true;
+		return true;
+	}
+	return false;
+}
+
+void Arena::decide(ArenaSnake &snake) {
+	int headX = snake.head % BoardWidth;
+	int headY = snake.head / BoardWidth;
+
+	/* keep going for the fruit picked before while it is there, or pick the nearest of a few */
+	if (snake.target < 0 || grid[snake.target] != ARENA_FRUIT) {
+		snake.target = -1;
+		int nearest = INT_MAX;
+		for (int k = 0; k < ARENA_FRUIT_SAMPLES && !fruits.empty(); k++) {
+			int cell = fruits[snake.rng.below(fruits.size())];
+			int distance = distanceBetween(headX, headY, cell % BoardWidth, cell / BoardWidth);
+			if (distance < nearest) {
+				nearest = distance;
+				snake.target = cell;
+			}
+		}
+	}
+
+	/*
+	 * straight on first, so a tie keeps the snake going; a way onto a body or obstacle is never taken,
+	 *	and one next to another head only when there is nothing else, that head may go there too
+	 */
+	int targetX = snake.target % BoardWidth;
+	int targetY = snake.target / BoardWidth;
+	int turn = (snake.direction == UP || snake.direction == DOWN) ? RIGHT : UP;
+	int ways[3] = { snake.direction, turn, turn ^ 1 };
+	int best = INT_MAX;
+	for (int k = 0; k < 3; k++) {
+		int x = wrapCell(headX + stepX[ways[k]], BoardWidth);
+		int y = wrapCell(headY + stepY[ways[k]], BoardHeight);
+		int what = grid[cellIndex(x, y)];
+		if (what != ARENA_EMPTY && what != ARENA_FRUIT) continue;
+
+		int cost = (what == ARENA_FRUIT) ? -1 : ((snake.target >= 0) ? distanceBetween(x, y, targetX, targetY) : 0);
+		for (int d = 0; d < 4; d++) {
+			if (d == (ways[k] ^ 1)) continue; // back to this snake's own head
+			if (heads.test(wrapCell(x + stepX[d], BoardWidth), wrapCell(y + stepY[d], BoardHeight))) {
+				cost += BoardWidth + BoardHeight;
+			}
+		}
+		if (cost < best) {
+			best = cost;
+			snake.nextDirection = ways[k];
+		}
+	}
+}
+
+void Arena::spawnFruits() {
+	if (missingFruits == 0) return;
+
+	/* every missing fruit draws its cells from its own numbers, the same on any thread */
+	fruitDraws.assign(missingFruits, -1);
+	workers.run(missingFruits, [this](int begin, int end) {
+		for (int j = begin; j < end; j++) {
+			Rng draw(seed ^ (0x9e3779b97f4a7c15ULL * tick) ^ (0xbf58476d1ce4e5b9ULL * (j + 1)));
+			for (int t = 0; t < ARENA_PLACE_TRIES; t++) {
+				int cell = cellIndex(draw.below(BoardWidth), draw.below(BoardHeight));
+				if (grid[cell] == ARENA_EMPTY) {
+					fruitDraws[j] = cell;
+					break;
+				}
+			}
+		}
+	});
+
+	/* in order, a cell an earlier fruit took makes this one wait for the next tick */
+	for (size_t j = 0; j < fruitDraws.size(); j++) {
+		int cell = fruitDraws[j];
+		if (cell < 0 || grid[cell] != ARENA_EMPTY) continue;
+		putCell(cell, ARENA_FRUIT);
+		fruitSlots[cell] = fruits.size();
+		fruits.push_back(cell);
+		missingFruits--;
+	}
+}
+
+void Arena::removeFruit(int cell) {
+	unordered_map<int, int>::iterator it = fruitSlots.find(cell);
+	int slot = it->second;
+	fruitSlots.erase(it);
+	int last = fruits.back();
+	fruits.pop_back();
+	if (last != cell) {
+		fruits[slot] = last;
+		fruitSlots[last] = slot;
+	}
+}
+
+int Arena::step() {
+	int numSnakes = snakes.size();
+	tick++;
+
+	/* the AI snakes decide in parallel, they only read the board */
+	workers.run(numSnakes, [this](int begin, int end) {
+		for (int i = max(begin, PLAYER_SNAKE + 1); i < end; i++) {
+			if (snakes[i].alive) decide(snakes[i]);
+		}
+	});
+
+	/* where every head goes, and the tails of the snakes that are not eating leave first */
+	claims.clear();
+	for (int i = 0; i < numSnakes; i++) {
+		ArenaSnake &snake = snakes[i];
+		dies[i] = 0;
+		moveTo[i] = -1;
+		if (!snake.alive) continue;
+		snake.direction = snake.nextDirection;
+		moveTo[i] = stepCell(snake.head, snake.direction);
+		claims.push_back(((uint64_t)moveTo[i] << 32) | i);
+	}
+	for (int i = 0; i < numSnakes; i++) {
+		if (moveTo[i] >= 0 && grid[moveTo[i]] != ARENA_FRUIT) popTail(i);
+	}
+
+	/* heads that meet on a cell all die */
+	sort(claims.begin(), claims.end());
+	for (size_t k = 0; k < claims.size(); k++) {
+		uint32_t cell = claims[k] >> 32;
+		if ((k > 0 && (claims[k - 1] >> 32) == cell) || (k + 1 < claims.size() && (claims[k + 1] >> 32) == cell)) {
+			dies[(uint32_t)claims[k]] = 1;
+			headOnDeaths++;
+		}
+	}
+
+	/* and so do heads that go onto a body or an obstacle */
+	for (int i = 0; i < numSnakes; i++) {
+		if (moveTo[i] < 0) continue;
+		int what = grid[moveTo[i]];
+		if (what != ARENA_EMPTY && what != ARENA_FRUIT) dies[i] = 1;
+	}
+
+	int events = EV_NONE;
+	if (dies[PLAYER_SNAKE]) {
+		events = ((grid[moveTo[PLAYER_SNAKE]] == ARENA_OBSTACLE) ? EV_HIT_OBSTACLE : EV_HIT_BODY) | EV_LOST_LIFE;
+		numOfLives--;
+		if (numOfLives == 0) {
+			gameOver = true;
+			events |= EV_GAMEOVER;
+		}
+	}
+
+	/* every move is decided, now the board changes */
+	for (int i = 0; i < numSnakes; i++) {
+		if (!dies[i]) continue;
+		removeBody(i);
+		snakes[i].deaths++;
+		snakes[i].respawnTick = tick + ARENA_RESPAWN_TICKS;
+		totalDeaths++;
+	}
+	for (int i = 0; i < numSnakes; i++) {
+		if (moveTo[i] < 0 || dies[i]) continue;
+		if (grid[moveTo[i]] == ARENA_FRUIT) {
+			snakes[i].score++;
+			removeFruit(moveTo[i]);
+			missingFruits++;
+			if (i == PLAYER_SNAKE) events |= EV_ATE_NORMAL;
+		}
+		pushHead(i, moveTo[i]);
+	}
+
+	/* the snakes that waited long enough come back, the player's only while it has lives */
+	for (int i = 0; i < numSnakes; i++) {
+		ArenaSnake &snake = snakes[i];
+		if (snake.alive || tick < snake.respawnTick || (i == PLAYER_SNAKE && gameOver)) continue;
+		respawn(i);
+	}
+
+	spawnFruits();
+	return events;
+}
@@ -0,0 +1,273 @@
+/*
+ * Arena mode for Snake: the player's snake and hundreds of AI snakes on one big board.
+ *
+ * Every cell of the board is in one shared grid that says what is on it, nothing, a fruit, an obstacle
+ * or the number of the snake with a block there, so a move is one lookup whichever snake makes it. A
+ * tick runs in three phases: the AI snakes pick their directions (in parallel, each only reads the grid
+ * and writes its own fields), then every move is resolved in snake order: tails leave first, snakes whose
+ * heads go to the same cell all die, and a head going onto a body or an obstacle dies. Last the eaten
+ * fruits are spawned again, each from its own random numbers so the cells can be drawn in parallel, and
+ * put on the board in order. The same seed plays the same arena on any number of threads.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdint.h>
+
+#include "game.h"
+
+using namespace std;
+
+
+/*
+ * Macros for what the arena grid holds on a cell other than the number of a snake
+ */
+#define ARENA_EMPTY 0xFFFF
+#define ARENA_FRUIT 0xFFFE
+#define ARENA_OBSTACLE 0xFFFD
+#define MAX_ARENA_SNAKES 0xFFFD // the snake numbers stay below the marks
+
+/* The player's snake is snake 0, the AI snakes follow it */
+#define PLAYER_SNAKE 0
+
+/* Ticks a dead snake waits before it comes back */
+#define ARENA_RESPAWN_TICKS 20
+
+/* A fruit on the board for every this many snakes */
+#define ARENA_SNAKES_PER_FRUIT 2
+
+/* Random cells an AI snake looks at when it picks a fruit to go for, it takes the nearest */
+#define ARENA_FRUIT_SAMPLES 4
+
+/* Random cells tried for a new fruit or a snake coming back before trying again next tick */
+#define ARENA_PLACE_TRIES 16
+
+/*
+ * Class for a few threads that run the parallel phases of a tick, the calling thread is one of them
+ */
+class WorkerPool {
+public:
+	WorkerPool(int numThreads);
+	~WorkerPool();
+
+	/* Method to run body(begin, end) on every range of [0, count) split into one range a thread, returns when all are done */
+	void run(int count, const function<void(int, int)> &body);
+
+	int getNumThreads() const {
+		return threads.size() + 1;
+	}
+
+private:
+	void work(int self);
+
+	vector<thread> threads;
+	mutex lock;
+	condition_variable wake;     // a new job or quitting
+	condition_variable finished; // the last helper is done with the job
+	const function<void(int, int)> *job;
+	int jobCount;
+	unsigned long generation; // counts the jobs, the helpers wait for it to change
+	int pending;              // helpers still working on the job
+	bool quitting;
+};
+
+/*
+ * Class for one snake of the arena, the body is a circular buffer of cell indices like Snake's
+ */
+class ArenaSnake {
+public:
+	ArenaSnake() : ringHead(0), length(0), head(0), direction(RIGHT), nextDirection(RIGHT), alive(false),
+				   respawnTick(0), score(0), deaths(0), target(-1) { }
+
+	bool isAlive() const {
+		return alive;
+	}
+
+	int getLength() const {
+		return length;
+	}
+
+	/* Method to get the cell index of block j, 0 is the head */
+	int getCell(int j) const {
+		return ring[(ringHead - j) & (ring.size() - 1)];
+	}
+
+	int getHeadCell() const {
+		return head;
+	}
+
+	int getDirection() const {
+		return direction;
+	}
+
+	/* Method to get the fruits eaten */
+	unsigned int getScore() const {
+		return score;
+	}
+
+	unsigned int getDeaths() const {
+		return deaths;
+	}
+
+private:
+	friend class Arena;
+
+	vector<uint32_t> ring;
+	int ringHead;
+	int length;
+	int head;
+	int direction;     // of the last move
+	int nextDirection; // of the coming move
+	bool alive;
+	unsigned long respawnTick;
+	unsigned int score;
+	unsigned int deaths;
+	int target; // the fruit cell an AI snake goes for, -1 for none
+	Rng rng;    // an AI snake's own numbers, so the snakes can decide in parallel
+};
+
+/*
+ * Class for the whole arena, advanced one move of every snake at a time by step()
+ */
+class Arena {
+public:
+	/* Create an arena on the current board with the player's snake and numAi AI snakes, ticks run on numThreads threads */
+	Arena(int numAi, uint64_t seed, int numThreads = 1);
+
+	/* Method to start over: new obstacles, every snake placed again and a full set of fruits */
+	void reset();
+
+	/* Method to turn the player's snake for the next move, turning back onto its own neck is ignored */
+	void changeDirection(int direction);
+
+	/*
+	 * Method to move every live snake one cell, bring back the dead ones that waited long enough and
+	 *	replace the eaten fruits, returns the EV_* flags of what happened to the player's snake
+	 */
+	int step();
+
+	/* Method to give the player one more life after the game is over, the snake comes back like the others */
+	void revive();
+
+	int getNumSnakes() const {
+		return snakes.size();
+	}
+
+	const ArenaSnake &getSnake(int i) const {
+		return snakes[i];
+	}
+
+	/* Method to get what is on a cell: ARENA_EMPTY, ARENA_FRUIT, ARENA_OBSTACLE or the number of a snake */
+	int getCellContent(int x, int y) const {
+		return grid[cellIndex(x, y)];
+	}
+
+	/* Methods to get the cells with a snake block and with a fruit, and how many of them are in each tile */
+	const Bitboard &getOccupied() const {
+		return occupied;
+	}
+
+	const TileCounts &getTiles() const {
+		return tiles;
+	}
+
+	const Bitboard &getFruits() const {
+		return fruitCells;
+	}
+
+	const TileCounts &getFruitTiles() const {
+		return fruitTiles;
+	}
+
+	const Obstacles &getObstacles() const {
+		return obstacles;
+	}
+
+	int getNumFruits() const {
+		return fruits.size();
+	}
+
+	unsigned long getTick() const {
+		return tick;
+	}
+
+	/* The player's game is over when the player's snake has died with no lives left */
+	bool isGameOver() const {
+		return gameOver;
+	}
+
+	unsigned int getNumOfLives() const {
+		return numOfLives;
+	}
+
+	/* Method to get the deaths of every snake since the start, and how many were head to head */
+	unsigned long getDeaths() const {
+		return totalDeaths;
+	}
+
+	unsigned long getHeadOnDeaths() const {
+		return headOnDeaths;
+	}
+
+private:
+	/* Method to put something on a cell, keeping the Bitboards and tile counts up to date */
+	void putCell(int cell, int what);
+
+	/* Method for an AI snake to pick the direction of its next move, only reads the board */
+	void decide(ArenaSnake &snake);
+
+	/* Method to try to lay a dead snake out on random clear cells, false when none of the tries fit */
+	bool respawn(int i);
+
+	/* Method to remove a snake's blocks from the board */
+	void removeBody(int i);
+
+	/* Methods to grow snake i at the head and shrink it at the tail */
+	void pushHead(int i, int cell);
+	void popTail(int i);
+
+	/* Method to put the fruits that are missing on the board */
+	void spawnFruits();
+
+	/* Method to take the fruit on a cell off the fruit list, the last fruit fills its slot */
+	void removeFruit(int cell);
+
+	/* Method to get the cell next to a cell in a direction, through the edges */
+	static int stepCell(int cell, int direction);
+
+	uint64_t seed;
+	Rng rng; // the arena's own numbers, for the obstacles
+	WorkerPool workers;
+	vector<ArenaSnake> snakes;
+	vector<uint16_t> grid; // what is on every cell, see getCellContent()
+	Bitboard occupied;
+	TileCounts tiles;
+	Bitboard heads; // the head of every live snake, for the AI snakes to keep clear of
+	Bitboard fruitCells;
+	TileCounts fruitTiles;
+	vector<int> fruits; // the fruit cells in no particular order
+	unordered_map<int, int> fruitSlots; // the slot in fruits of every fruit cell
+	Obstacles obstacles;
+	int missingFruits;  // eaten or not placed yet
+
+	/* what a tick works on, kept to not allocate */
+	vector<int> moveTo;        // each snake's next head cell, -1 when it does not move
+	vector<uint64_t> claims;   // (cell, snake) of every move, sorted to find the heads that meet
+	vector<uint8_t> dies;
+	vector<int> fruitDraws;    // the cell drawn for each missing fruit, -1 when no try was clear
+
+	unsigned long tick;
+	unsigned int numOfLives;
+	bool gameOver;
+	unsigned long totalDeaths;
+	unsigned long headOnDeaths;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Autopilot for Snake, see autopilot.h
+ */
+
+#include "autopilot.h"
+
+
+/* The directions in the order ties are broken, and where each one leads */
+static const int directions[4] = { UP, DOWN, RIGHT, LEFT };
+static const int stepX[4] = { 0, 0, 1, -1 };
+static const int stepY[4] = { -1, 1, 0, 0 };
+
+int Autopilot::roomFrom(int x, int y) {
+	visited.clear();
+	visited.set(x, y);
+	frontier = visited;
+	while (frontier.any()) {
+		frontier.neighbours(next);
+		next.andNot(blocked).andNot(visited);
+		frontier.swap(next);
+		visited |= frontier;
+	}
+	return visited.count();
+}
+
+int Autopilot::decide(const GameState &game) {
+	const Snake &snake = game.getSnake();
+	blocked = game.getObstacles().getCovered();
+	blocked |= snake.getOccupied();
+	pathLength = 0;
+
+	/* evil fruit costs a life, steer around it like an obstacle and only look for room */
+	const Fruit &fruit = game.getFruit();
+	bool evil = fruit.getAttribute() == EVIL_FRT;
+	if (evil) blocked.set(fruit.getX(), fruit.getY());
+
+	/* the free cells next to the head, the current direction first so it wins ties */
+	int current = snake.getDirection();
+	int order[4] = { current, UP, DOWN, RIGHT };
+	for (int i = 1, k = 0; i < 4; k++) {
+		if (directions[k] != current) order[i++] = directions[k];
+	}
+	int candX[4], candY[4], candDir[4];
+	int numCands = 0;
+	for (int i = 0; i < 4; i++) {
+		int d = order[i];
+		int x = wrapCell(snake.getHeadX() + stepX[d], BoardWidth);
+		int y = wrapCell(snake.getHeadY() + stepY[d], BoardHeight);
+		if (blocked.test(x, y)) continue;
+		candX[numCands] = x;
+		candY[numCands] = y;
+		candDir[numCands++] = d;
+	}
+	if (numCands == 0) return NO_INPUT;
+
+	/* search outwards from the fruit, the first free head neighbour reached starts a shortest path */
+	frontier.clear();
+	if (!evil) frontier.set(fruit.getX(), fruit.getY());
+	visited = frontier;
+	for (int distance = 1; frontier.any(); distance++) {
+		for (int i = 0; i < numCands; i++) {
+			if (frontier.test(candX[i], candY[i])) {
+				pathLength = distance;
+				return candDir[i];
+			}
+		}
+		frontier.neighbours(next);
+		next.andNot(blocked).andNot(visited);
+		frontier.swap(next);
+		visited |= frontier;
+	}
+
+	/* no way to the fruit, or it is evil: go where there is the most room and wait for the body to move */
+	int best = 0;
+	int bestRoom = -1;
+	for (int i = 0; i < numCands; i++) {
+		int room = roomFrom(candX[i], candY[i]);
+		if (room > bestRoom) {
+			bestRoom = room;
+			best = i;
+		}
+	}
+	return candDir[best];
+}
@@ -0,0 +1,46 @@
+/*
+ * Autopilot for Snake: picks the direction of the next move from the current GameState.
+ *
+ * The search works on Bitboards (see game.h), so a breadth-first search step moves the whole frontier
+ * one cell in every direction and masks out the body, the obstacles and the cells already seen with a
+ * few operations per 64 bit word. All the boards are members, deciding a move never allocates. A search
+ * takes time in proportion to the board size, a few microseconds on the default board.
+ */
+
+#ifndef AUTOPILOT_H
+#define AUTOPILOT_H
+
+#include "game.h"
+
+
+/*
+ * Class for the autopilot, keep one around and call decide() before every move
+ */
+class Autopilot {
+public:
+	Autopilot() : pathLength(0) { }
+
+	/*
+	 * Method to pick the direction for the next move: the first step of a shortest path to the fruit that
+	 *	goes around the body and obstacles, or when there is no such path or the fruit is evil, the way with
+	 *	the most room, the evil fruit counted as blocked. Returns NO_INPUT when every way is blocked.
+	 */
+	int decide(const GameState &game);
+
+	/* Method to get the length of the path found by the last decide(), 0 when there was none */
+	int getPathLength() const {
+		return pathLength;
+	}
+
+private:
+	/* Method to count the cells that can be reached from a cell without crossing blocked */
+	int roomFrom(int x, int y);
+
+	Bitboard blocked;  // the body and obstacles, and the fruit when it is evil
+	Bitboard visited;
+	Bitboard frontier;
+	Bitboard next;
+	int pathLength;
+};
+
+#endif
@@ -0,0 +1,278 @@
+/*
+- - - - - - - - - - - - - - - - - - - - - -
+
+Batch self-play for the Snake game engine: many independent seeded games on every core.
+
+Commands to compile and run:
+
+    g++ -O2 -pthread -o snake-batch batch.cpp game.cpp replay.cpp autopilot.cpp -std=c++11
+    ./snake-batch [--policy=random|autopilot] [--threads=N] [--max-ticks=N] [--board=WxH] [games [seed]]
+
+Game i is seeded with seed + i, so a run gives the same results on any number of threads. Each
+worker starts with an equal share of the games and, once its share is done, steals half of what is
+left of another worker's share, so a few long games do not leave the other cores idle. The workers
+share nothing else until the end, which keeps the scaling linear in the number of cores.
+
+The tool prints the games per second, the score distribution, and what cost the lives and what
+ended the games. --board sets the board size in cells (default 40x28). To try other difficulty
+settings, build it with e.g. -DMAX_OBSTACLES=20 (see the difficulty macros in game.h).
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+#include "game.h"
+#include "autopilot.h"
+#include "stats.h"
+
+using namespace std;
+
+
+/*
+ * Macros for the policies
+ */
+#define RANDOM_POLICY 0
+#define AUTOPILOT_POLICY 1
+
+/*
+ * Macros for what ended a game or cost a life
+ */
+#define END_BODY 0
+#define END_OBSTACLE 1
+#define END_EVIL 2
+#define END_WON 3
+#define END_TICK_LIMIT 4
+#define NUM_ENDS 5
+
+const char *endNames[NUM_ENDS] = { "hit body", "hit obstacle", "evil fruit", "won", "tick limit" };
+
+int policyKind = RANDOM_POLICY;
+unsigned long maxTicks = 100000;
+unsigned long baseSeed = 1;
+
+/*
+ * Function for command line argument error handling
+ */
+void usage(char *argv[]) {
+	cerr << "Usage: " << argv[0] << " [--policy=random|autopilot] [--threads=N] [--max-ticks=N (default 100000)] "
+		 << "[--board=WxH (default 40x28)] [games (default 10000)] [seed (default 1)]" << endl;
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Class for one worker: its share of the games, and everything it counts, on cache lines of its own
+ */
+struct alignas(64) Worker {
+	mutex lock;            // guards next and end, taken once per game and by thieves
+	unsigned long next;    // the next game of this share
+	unsigned long end;     // one past the last game of this share
+
+	unsigned long games;
+	unsigned long ticks;
+	unsigned long steals;
+	unsigned long livesLost[NUM_ENDS];
+	unsigned long gamesEnded[NUM_ENDS];
+
+	/* Method to take the next game of the own share, returns false when it is empty */
+	bool take(unsigned long &game) {
+		lock_guard<mutex> guard(lock);
+		if (next >= end) return false;
+		game = next++;
+		return true;
+	}
+
+	/* Method to give away the back half of what is left, returns false when there is nothing to give */
+	bool giveHalf(unsigned long &from, unsigned long &to) {
+		lock_guard<mutex> guard(lock);
+		if (end - next < 2) return false; // leave the last one to the owner
+		from = next + (end - next) / 2;
+		to = end;
+		end = from;
+		return true;
+	}
+};
+
+/*
+ * Function to get what cost a life from the events of a step
+ */
+int causeOf(int events) {
+	if (events & EV_ATE_EVIL) return END_EVIL;
+	if (events & EV_HIT_OBSTACLE) return END_OBSTACLE;
+	return END_BODY;
+}
+
+/*
+ * Function to play game number index to the end or the tick limit, counting into the worker
+ */
+void playGame(Worker &worker, GameState &game, Autopilot &autopilot, unsigned long index, unsigned int scores[]) {
+	game.reset(baseSeed + index);
+	Rng policy((baseSeed + index) ^ 0x5deece66dULL); // the policy's own numbers
+
+	int end = END_TICK_LIMIT;
+	unsigned long tick;
+	for (tick = 0; tick < maxTicks; tick++) {
+		int input = NO_INPUT;
+		if (policyKind == AUTOPILOT_POLICY) {
+			input = autopilot.decide(game);
+		} else if (policy.below(8) == 0) { // turn now and then
+			input = policy.below(4);
+		}
+
+		int events = game.step(input);
+		if (events & EV_LOST_LIFE) worker.livesLost[causeOf(events)]++;
+		if (game.isGameOver()) {
+			end = game.isGameWon() ? END_WON : causeOf(events);
+			tick++;
+			break;
+		}
+	}
+
+	worker.games++;
+	worker.ticks += tick;
+	worker.gamesEnded[end]++;
+	scores[index] = game.getScore();
+}
+
+/*
+ * Function for the thread of worker self: play the own share, then steal from the others until none is left
+ */
+void runWorker(vector<Worker> &workers, int self, unsigned int scores[]) {
+	Worker &worker = workers[self];
+	GameState *game = new GameState(); // one per worker reused for every game
+	Autopilot autopilot;
+
+	unsigned long index;
+	while (true) {
+		while (worker.take(index)) {
+			playGame(worker, *game, autopilot, index, scores);
+		}
+
+		/* look for work, starting at the next worker so the thieves spread out */
+		bool stole = false;
+		for (size_t k = 1; k < workers.size() && !stole; k++) {
+			unsigned long from, to;
+			if (workers[(self + k) % workers.size()].giveHalf(from, to)) {
+				lock_guard<mutex> guard(worker.lock);
+				worker.next = from;
+				worker.end = to;
+				worker.steals++;
+				stole = true;
+			}
+		}
+		if (!stole) break; // every share is empty or down to one game its owner will play
+	}
+	delete game;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long numGames = 10000;
+	int numThreads = thread::hardware_concurrency();
+	if (numThreads <= 0) numThreads = 1;
+
+	/* Handle the --options first, the rest are the number of games and the seed */
+	int numArgs = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--policy=random") == 0) {
+			policyKind = RANDOM_POLICY;
+		} else if (strcmp(argv[i], "--policy=autopilot") == 0) {
+			policyKind = AUTOPILOT_POLICY;
+		} else if (strncmp(argv[i], "--threads=", 10) == 0) {
+			numThreads = atoi(argv[i] + 10);
+			if (numThreads <= 0) usage(argv);
+		} else if (strncmp(argv[i], "--max-ticks=", 12) == 0) {
+			maxTicks = strtoul(argv[i] + 12, NULL, 10);
+			if (maxTicks == 0) usage(argv);
+		} else if (strncmp(argv[i], "--board=", 8) == 0) {
+			if (!parseBoardSize(argv[i] + 8)) usage(argv);
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			usage(argv);
+		} else {
+			argv[numArgs++] = argv[i];
+		}
+	}
+	argc = numArgs;
+
+	switch (argc) {
+		case 3:
+			baseSeed = strtoul(argv[2], NULL, 10);
+			// FALL THROUGH
+		case 2:
+			numGames = strtoul(argv[1], NULL, 10);
+			if (numGames == 0) usage(argv);
+			// FALL THROUGH
+		case 1:
+			break;
+		default:
+			usage(argv);
+	}
+
+	vector<Worker> workers(numThreads);
+	for (int i = 0; i < numThreads; i++) {
+		Worker &worker = workers[i];
+		worker.next = numGames * i / numThreads;
+		worker.end = numGames * (i + 1) / numThreads;
+		worker.games = worker.ticks = worker.steals = 0;
+		memset(worker.livesLost, 0, sizeof(worker.livesLost));
+		memset(worker.gamesEnded, 0, sizeof(worker.gamesEnded));
+	}
+	vector<unsigned int> scores(numGames); // each game writes its own slot
+
+	unsigned long start = nowNs();
+	vector<thread> threads;
+	for (int i = 0; i < numThreads; i++) {
+		threads.push_back(thread(runWorker, ref(workers), i, scores.data()));
+	}
+	for (int i = 0; i < numThreads; i++) {
+		threads[i].join();
+	}
+	unsigned long elapsed = nowNs() - start;
+	if (elapsed == 0) elapsed = 1;
+
+	unsigned long games = 0, ticks = 0, steals = 0;
+	unsigned long livesLost[NUM_ENDS] = { 0 }, gamesEnded[NUM_ENDS] = { 0 };
+	for (int i = 0; i < numThreads; i++) {
+		games += workers[i].games;
+		ticks += workers[i].ticks;
+		steals += workers[i].steals;
+		for (int e = 0; e < NUM_ENDS; e++) {
+			livesLost[e] += workers[i].livesLost[e];
+			gamesEnded[e] += workers[i].gamesEnded[e];
+		}
+	}
+
+	sort(scores.begin(), scores.end());
+	double totalScore = 0;
+	for (unsigned long i = 0; i < numGames; i++) {
+		totalScore += scores[i];
+	}
+
+	cout << "policy: " << (policyKind == AUTOPILOT_POLICY ? "autopilot" : "random") << endl;
+	cout << "threads: " << numThreads << endl;
+	cout << "board: " << BoardWidth << "x" << BoardHeight << endl;
+	cout << "games: " << games << endl;
+	cout << "ticks: " << ticks << endl;
+	cout << "steals: " << steals << endl;
+	cout << "elapsed: " << elapsed / 1000000.0 << " ms" << endl;
+	cout << "games/s: " << (unsigned long)(games * 1000000000.0 / elapsed) << endl;
+	cout << "ticks/s: " << (unsigned long)(ticks * 1000000000.0 / elapsed) << endl;
+	cout << "score: mean " << totalScore / numGames << ", min " << scores[0] << ", p50 " << scores[numGames / 2]
+		 << ", p90 " << scores[numGames * 9 / 10] << ", p99 " << scores[numGames * 99 / 100] << ", max "
+		 << scores[numGames - 1] << endl;
+	cout << "lives lost by:";
+	for (int e = 0; e < NUM_ENDS; e++) {
+		if (e == END_WON || e == END_TICK_LIMIT) continue;
+		cout << (e ? ", " : " ") << endNames[e] << " " << livesLost[e];
+	}
+	cout << endl << "games ended by:";
+	for (int e = 0; e < NUM_ENDS; e++) {
+		cout << (e ? ", " : " ") << endNames[e] << " " << gamesEnded[e];
+	}
+	cout << endl;
+	return 0;
+}
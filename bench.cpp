@@ -0,0 +1,387 @@
+/*
+- - - - - - - - - - - - - - - - - - - - - -
+
+Benchmarks for the Snake game engine, no window and no outside services needed.
+
+Commands to compile and run:
+
+    g++ -O2 -pthread -o snake-bench bench.cpp env.cpp game.cpp replay.cpp autopilot.cpp lockstep.cpp arena.cpp camera.cpp raster.cpp -std=c++11
+    ./snake-bench > bench.json
+
+Every benchmark reports the nanoseconds per operation and, where perf_event_open is allowed, the CPU
+cycles and cache misses per operation (null otherwise), as one JSON object per line inside a JSON
+array, so runs from two builds can be compared line by line. The repaint benchmark needs an X server
+and lives in the game itself: ./snake --bench-frames=N.
+
+The last benchmarks run a step, a fruit placement and a visit of the snake cells in a window's view on
+boards from 40x28 to 4096x4096 cells; the time per operation stays flat because the first two touch no
+more than the cells that changed and the visit no more than the tiles in view. The fruit placement and
+step also run with the board 99% full, where the random tries mostly miss and the clear cell counts of
+the tile rows and rows lead to the fruit's row. The arena benchmarks
+run a tick of 100 to 2000 snakes on a 512x512 board, the time per tick grows with the snakes alone
+and stays well under a millisecond for 500. The raster frame benchmark draws a frame of the default
+board with a long snake the way ./snake --framebuffer does, without the put to the X server.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "game.h"
+#include "autopilot.h"
+#include "env.h"
+#include "lockstep.h"
+#include "arena.h"
+#include "camera.h"
+#include "raster.h"
+#include "stats.h"
+
+using namespace std;
+
+
+/* Keeps the compiler from throwing the benchmarked work away */
+volatile unsigned long sink;
+
+/*
+ * Class for a hardware counter of this process, unusable when the kernel or container does not allow it
+ */
+class PerfCounter {
+public:
+	PerfCounter(unsigned long config) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	~PerfCounter() {
+		if (fd >= 0) close(fd);
+	}
+
+	bool usable() {
+		return fd >= 0;
+	}
+
+	void start() {
+		if (fd < 0) return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	unsigned long stop() {
+		if (fd < 0) return 0;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		unsigned long value = 0;
+		if (read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+		return value;
+	}
+
+private:
+	int fd;
+};
+
+PerfCounter cycles(PERF_COUNT_HW_CPU_CYCLES);
+PerfCounter cacheMisses(PERF_COUNT_HW_CACHE_MISSES);
+bool firstResult = true;
+
+/*
+ * Function to time ops runs of body and print the result line
+ */
+template <class Body>
+void bench(const char *name, const string &param, unsigned long ops, Body body) {
+	body(ops / 100 + 1); // warm up
+
+	cycles.start();
+	cacheMisses.start();
+	unsigned long start = nowNs();
+	body(ops);
+	unsigned long elapsed = nowNs() - start;
+	unsigned long numCycles = cycles.stop();
+	unsigned long numMisses = cacheMisses.stop();
+
+	printf("%s  {\"name\": \"%s\", \"param\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.3f, ",
+		   (firstResult ? "" : ",\n"), name, param.c_str(), ops, (double)elapsed / ops);
+	if (cycles.usable()) {
+		printf("\"cycles_per_op\": %.3f, ", (double)numCycles / ops);
+	} else {
+		printf("\"cycles_per_op\": null, ");
+	}
+	if (cacheMisses.usable()) {
+		printf("\"cache_misses_per_op\": %.5f}", (double)numMisses / ops);
+	} else {
+		printf("\"cache_misses_per_op\": null}");
+	}
+	fflush(stdout);
+	firstResult = false;
+}
+
+string fillParam(double fill) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "fill=%.2f", fill);
+	return buf;
+}
+
+int main() {
+	const int numCells = BoardWidth * BoardHeight;
+	const double fills[] = { 0.1, 0.5, 0.9, 0.99 };
+	const int numFills = sizeof(fills) / sizeof(fills[0]);
+
+	Rng rng(1);
+	CyclePolicy policy;
+
+	/* random cells to query, the same for every run */
+	const int numQueries = 4096;
+	int queryX[numQueries], queryY[numQueries];
+	for (int i = 0; i < numQueries; i++) {
+		queryX[i] = rng.below(BoardWidth);
+		queryY[i] = rng.below(BoardHeight);
+	}
+
+	printf("[\n");
+
+	for (int f = 0; f < numFills - 1; f++) {
+		GameState game;
+		game.resetWithSnake(policy.snakeOnCycle(fills[f] * numCells));
+		const Snake &snake = game.getSnake();
+		bench("onSnakeBody", fillParam(fills[f]), 20000000, [&](unsigned long ops) {
+			unsigned long hits = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				int q = i & (numQueries - 1);
+				hits += snake.onSnakeBody(queryX[q], queryY[q]);
+			}
+			sink = hits;
+		});
+	}
+
+	{
+		GameState game;
+		const Obstacles &obstacles = game.getObstacles();
+		bench("onObstacles", "generated", 20000000, [&](unsigned long ops) {
+			unsigned long hits = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				int q = i & (numQueries - 1);
+				hits += obstacles.onObstacles(queryX[q], queryY[q]);
+			}
+			sink = hits;
+		});
+	}
+
+	for (int f = 0; f < numFills; f++) {
+		GameState game;
+		game.resetWithSnake(policy.snakeOnCycle(fills[f] * numCells));
+		bench("regenerateFruit", fillParam(fills[f]), 5000000, [&](unsigned long ops) {
+			unsigned long placed = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				placed += game.regenerateFruit();
+			}
+			sink = placed;
+		});
+	}
+
+	{
+		GameState game;
+		bench("step", "random policy", 10000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				int input = (rng.below(8) == 0) ? rng.below(4) : NO_INPUT;
+				game.step(input);
+				if (game.isGameOver()) game.reset();
+			}
+			sink = game.getScore();
+		});
+	}
+
+	for (int f = 0; f < numFills - 1; f++) {
+		GameState game;
+		int length = fills[f] * numCells;
+		game.resetWithSnake(policy.snakeOnCycle(length));
+		bench("step", "cycle " + fillParam(fills[f]), 10000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				game.step(policy.direction(game));
+				if (game.isGameOver()) game.resetWithSnake(policy.snakeOnCycle(length)); // board filled up
+			}
+			sink = game.getScore();
+		});
+	}
+
+	for (int f = 0; f < numFills - 1; f++) {
+		GameState game;
+		game.resetWithSnake(policy.snakeOnCycle(fills[f] * numCells));
+		Autopilot autopilot;
+		bench("autopilot decide", fillParam(fills[f]), 200000, [&](unsigned long ops) {
+			unsigned long sum = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				sum += autopilot.decide(game);
+			}
+			sink = sum;
+		});
+	}
+
+	{
+		const int numGames = 256;
+		LockstepGames games(numGames, 1);
+		vector<int> inputs(numGames), events(numGames);
+		bench("lockstep step", LockstepGames::usingAvx2() ? "256 games avx2, per game" : "256 games scalar, per game",
+			  10000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i += numGames) {
+				for (int k = 0; k < numGames; k++) {
+					inputs[k] = (rng.below(8) == 0) ? rng.below(4) : NO_INPUT;
+				}
+				games.step(inputs.data(), events.data());
+				for (int k = 0; k < numGames; k++) {
+					if (games.isGameOver(k)) games.reset(k);
+				}
+			}
+			sink = games.getScore(0);
+		});
+	}
+
+	{
+		const int numEnvs = 256;
+		const int planeSize = BoardWidth * BoardHeight;
+		vector<uint8_t> body(numEnvs * planeSize), obstacles(numEnvs * planeSize), dones(numEnvs);
+		vector<int32_t> headX(numEnvs), headY(numEnvs), fruitX(numEnvs), fruitY(numEnvs), fruitAttr(numEnvs);
+		vector<int32_t> lives(numEnvs), actions(numEnvs);
+		vector<float> rewards(numEnvs);
+		SnakeEnvBuffers buffers = { body.data(), obstacles.data(), headX.data(), headY.data(), fruitX.data(),
+									fruitY.data(), fruitAttr.data(), lives.data(), rewards.data(), dones.data() };
+		SnakeEnv *env = snake_env_create(numEnvs, 1, &buffers);
+		snake_env_reset(env);
+		bench("env step", "256 envs, per env", 10000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i += numEnvs) {
+				for (int k = 0; k < numEnvs; k++) {
+					actions[k] = (rng.below(8) == 0) ? rng.below(4) : SNAKE_ENV_NOOP;
+				}
+				snake_env_step(env, actions.data());
+			}
+			sink = dones[0];
+		});
+		snake_env_destroy(env);
+	}
+
+	/*
+	 * a whole frame of the default board drawn by the CPU for the framebuffer backend (raster.h): the background,
+	 *	a snake half the board long in 20 pixel cells and the fruit, what ./snake --framebuffer puts with one request
+	 */
+	{
+		GameState game;
+		int length = numCells / 2;
+		game.resetWithSnake(policy.snakeOnCycle(length));
+		Framebuffer frame(800, 600);
+		const int block = 20;
+		const int top = 2 * block;
+		bench("raster frame", Framebuffer::usingAvx2() ? "fill=0.50, 800x600 avx2" : "fill=0.50, 800x600", 20000,
+			  [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				game.step(policy.direction(game));
+				if (game.isGameOver()) game.resetWithSnake(policy.snakeOnCycle(length));
+				frame.fillRect(0, 0, 800, 600, 0x000000);
+				const Snake &snake = game.getSnake();
+				for (int k = 0; k < snake.getLength(); k++) {
+					const Block &b = snake.getBlock(k);
+					frame.fillRect(b.getX() * block, top + b.getY() * block, block - 2, block - 2, 0x008000);
+				}
+				const Fruit &fruit = game.getFruit();
+				frame.fillEllipse(fruit.getX() * block, top + fruit.getY() * block, block, block, 0x1E90FF);
+			}
+			sink = frame.getPixels()[top * frame.getStride()];
+		});
+	}
+
+	/* the same operations on ever bigger boards, the snake and fruit placement half way through the board */
+	const int sizes[] = { 40, 256, 1024, 4096 };
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+		if (sizes[s] == 40) {
+			setBoardSize(DEFAULT_BOARD_WIDTH, DEFAULT_BOARD_HEIGHT);
+		} else {
+			setBoardSize(sizes[s], sizes[s]);
+		}
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", BoardWidth, BoardHeight);
+
+		GameState *game = new GameState(); // big boards take megabytes
+		bench("step", string("random policy, board ") + size, 10000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				int input = (rng.below(8) == 0) ? rng.below(4) : NO_INPUT;
+				game->step(input);
+				if (game->isGameOver()) game->revive(); // a reset would clear the whole board
+			}
+			sink = game->getScore();
+		});
+
+		CyclePolicy cycle;
+		game->resetWithSnake(cycle.snakeOnCycle(BoardWidth * BoardHeight / 2));
+		bench("regenerateFruit", string("fill=0.50, board ") + size, 5000000, [&](unsigned long ops) {
+			unsigned long placed = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				placed += game->regenerateFruit();
+			}
+			sink = placed;
+		});
+
+		/* what the game paints of the snake at 4 pixels a cell, 200x140 cells, following the head around */
+		Camera camera;
+		camera.setView(200, 140);
+		bench("snake cells in view", string("fill=0.50, board ") + size, 20000, [&](unsigned long ops) {
+			unsigned long cells = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				game->step(cycle.direction(*game));
+				camera.follow(game->getSnake().getHeadX(), game->getSnake().getHeadY());
+				forEachCellInView(camera, game->getSnake().getOccupied(), game->getSnake().getTiles(), [&](int x, int y) {
+					cells += x + y;
+				});
+			}
+			sink = cells;
+		});
+
+		/* a nearly full board, where the random tries for a fruit cell mostly miss and the clear counts find it */
+		int fullLength = BoardWidth * BoardHeight * 0.99;
+		game->resetWithSnake(cycle.snakeOnCycle(fullLength));
+		bench("regenerateFruit", string("fill=0.99, board ") + size, 1000000, [&](unsigned long ops) {
+			unsigned long placed = 0;
+			for (unsigned long i = 0; i < ops; i++) {
+				placed += game->regenerateFruit();
+			}
+			sink = placed;
+		});
+
+		bench("step", string("cycle fill=0.99, board ") + size, 1000000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				game->step(cycle.direction(*game));
+				if (game->isGameOver()) game->resetWithSnake(cycle.snakeOnCycle(fullLength)); // board filled up
+			}
+			sink = game->getScore();
+		});
+		delete game;
+	}
+
+	/* a whole arena tick, the snakes spread over the board and a fruit for every two of them */
+	setBoardSize(512, 512);
+	const int arenaSnakes[] = { 100, 500, 2000 };
+	for (int a = 0; a < (int)(sizeof(arenaSnakes) / sizeof(arenaSnakes[0])); a++) {
+		Arena *arena = new Arena(arenaSnakes[a] - 1, 1);
+		char param[64];
+		snprintf(param, sizeof(param), "%d snakes, board 512x512", arenaSnakes[a]);
+		bench("arena tick", param, 5000, [&](unsigned long ops) {
+			for (unsigned long i = 0; i < ops; i++) {
+				arena->step();
+			}
+			sink = arena->getDeaths();
+		});
+		delete arena;
+	}
+
+	printf("\n]\n");
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * The camera over a board bigger than the window, see camera.h
+ */
+
+#include "camera.h"
+
+
+Camera::Camera() {
+	setView(BoardWidth, BoardHeight);
+}
+
+void Camera::setView(int cols, int rows) {
+	this->cols = min(cols, BoardWidth);
+	this->rows = min(rows, BoardHeight);
+	x = 0;
+	y = 0;
+}
+
+bool Camera::follow(int cellX, int cellY) {
+	bool movedX = followAxis(cellX, BoardWidth, cols, x);
+	bool movedY = followAxis(cellY, BoardHeight, rows, y);
+	return movedX || movedY;
+}
+
+bool Camera::followAxis(int cell, int size, int span, int &first) {
+	if (span >= size) return false; // all of it is in view
+
+	int v = cell - first;
+	if (v < 0) v += size;
+	int margin = span / 4;
+	if (v >= margin && v < span - margin) return false;
+
+	first = cell - span / 2;
+	if (first < 0) first += size;
+	return true;
+}
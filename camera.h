@@ -0,0 +1,119 @@
+/*
+ * The part of a board bigger than the window that is on screen.
+ *
+ * The camera shows cols x rows cells starting at one cell, wrapping through the edges like the snake, and
+ * follows the snake head. Painting asks it where a cell goes and visits the cells of a Bitboard in view
+ * with forEachCellInView(), which looks only at the tiles in view, so the cost of a frame depends on the
+ * size of the window and not on the size of the board or the length of the snake. There is no X11 in
+ * here, snake-bench measures the visiting too.
+ */
+
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <algorithm>
+
+#include "game.h"
+
+using namespace std;
+
+
+/*
+ * Class for the cells in view: cols x rows of them from the cell (x, y) on. A board that fits is in view
+ *	whole and the camera never moves. On a bigger one it stays put while the head is in the middle half of
+ *	the view and jumps to put the head in the middle when it leaves that, so most frames see the same
+ *	cells as the one before and can still be repainted cell by cell.
+ */
+class Camera {
+public:
+	Camera();
+
+	/* Method to set how many cells fit on the screen, the view is never bigger than the board; it starts at (0, 0) */
+	void setView(int cols, int rows);
+
+	/* Method to keep a cell (the head) in view, returns true when the view moved */
+	bool follow(int cellX, int cellY);
+
+	/* Methods to get where a board column or row is in the view, getCols() or getRows() and up when out of view */
+	int viewX(int cellX) const {
+		int v = cellX - x;
+		return (v < 0) ? (v + BoardWidth) : v;
+	}
+
+	int viewY(int cellY) const {
+		int v = cellY - y;
+		return (v < 0) ? (v + BoardHeight) : v;
+	}
+
+	bool inView(int cellX, int cellY) const {
+		return viewX(cellX) < cols && viewY(cellY) < rows;
+	}
+
+	int getX() const {
+		return x;
+	}
+
+	int getY() const {
+		return y;
+	}
+
+	int getCols() const {
+		return cols;
+	}
+
+	int getRows() const {
+		return rows;
+	}
+
+private:
+	/* Method to follow the cell along one side of the board, first is where the view starts on that side */
+	static bool followAxis(int cell, int size, int span, int &first);
+
+	int x;
+	int y;
+	int cols;
+	int rows;
+};
+
+/*
+ * Function to call visit(x, y) for every cell of set that is in view. It skips the tiles in view that
+ *	tiles counts no cells in and reads only the words of the rows in view of the others, at most two
+ *	spans of columns and two of rows when the view wraps through the edges.
+ */
+template <class Visitor>
+void forEachCellInView(const Camera &camera, const Bitboard &set, const TileCounts &tiles, Visitor visit) {
+	const uint64_t *words = set.getWords();
+	const int rowWords = boardRowWords();
+
+	int xStart[2] = { camera.getX(), 0 };
+	int xEnd[2] = { min(camera.getX() + camera.getCols(), BoardWidth), camera.getX() + camera.getCols() - BoardWidth };
+	int yStart[2] = { camera.getY(), 0 };
+	int yEnd[2] = { min(camera.getY() + camera.getRows(), BoardHeight), camera.getY() + camera.getRows() - BoardHeight };
+
+	for (int ys = 0; ys < 2; ys++) {
+		for (int ty = yStart[ys] >> TILE_SHIFT; ty << TILE_SHIFT < yEnd[ys]; ty++) {
+			int y0 = max(yStart[ys], ty << TILE_SHIFT);
+			int y1 = min(yEnd[ys], (ty + 1) << TILE_SHIFT);
+
+			for (int xs = 0; xs < 2; xs++) {
+				for (int tx = xStart[xs] >> TILE_SHIFT; tx << TILE_SHIFT < xEnd[xs]; tx++) {
+					if (tiles.get(tx, ty) == 0) continue;
+					int x0 = max(xStart[xs], tx << TILE_SHIFT);
+					int x1 = min(xEnd[xs], (tx + 1) << TILE_SHIFT);
+
+					/* a tile is half a word wide, so its columns in view are one run of bits in each row */
+					uint64_t mask = (1ULL << (x1 - x0)) - 1;
+					for (int cy = y0; cy < y1; cy++) {
+						uint64_t bits = (words[cy * rowWords + (x0 >> 6)] >> (x0 & 63)) & mask;
+						while (bits) {
+							visit(x0 + __builtin_ctzll(bits), cy);
+							bits &= bits - 1; // drop the lowest set bit
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+#endif
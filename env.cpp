@@ -0,0 +1,124 @@
+/*
+ * Vectorized Snake environments behind a C ABI, see env.h
+ */
+
+#include <new>
+#include <atomic>
+#include <cstddef>
+
+#include "env.h"
+#include "game.h"
+
+
+struct SnakeEnv {
+	int numEnvs;
+	SnakeEnvBuffers buffers;
+	GameState *games;
+	bool seeded; // the games are still the ones seeded by snake_env_create, nothing was observed yet
+};
+
+/* Environments created and not destroyed yet, the board size is fixed while there are any; threads that
+ *	each create and destroy their own environments count them at the same time */
+static std::atomic<int> numLiveEnvs(0);
+
+/*
+ * Function to write the observation of environment k, the planes only where cells changed since the last one
+ */
+static void writeObservation(SnakeEnv *env, int k) {
+	GameState &game = env->games[k];
+	const SnakeEnvBuffers &b = env->buffers;
+	const int planeSize = BoardWidth * BoardHeight;
+	uint8_t *body = b.body + (long)k * planeSize;
+	const Snake &snake = game.getSnake();
+
+	if (game.allCellsChanged()) {
+		const Obstacles &obstacles = game.getObstacles();
+		uint8_t *obstaclePlane = b.obstacles + (long)k * planeSize;
+		for (int y = 0; y < BoardHeight; y++) {
+			for (int x = 0; x < BoardWidth; x++) {
+				body[cellIndex(x, y)] = snake.onSnake(x, y);
+				obstaclePlane[cellIndex(x, y)] = obstacles.onObstacles(x, y);
+			}
+		}
+	} else {
+		for (int i = 0; i < game.getNumChangedCells(); i++) {
+			int cell = game.getChangedCell(i);
+			body[cell] = snake.onSnake(cell % BoardWidth, cell / BoardWidth);
+		}
+	}
+	game.clearChanges();
+
+	b.head_x[k] = snake.getHeadX();
+	b.head_y[k] = snake.getHeadY();
+	b.fruit_x[k] = game.getFruit().getX();
+	b.fruit_y[k] = game.getFruit().getY();
+	b.fruit_attr[k] = game.getFruit().getAttribute();
+	b.lives[k] = game.getNumOfLives();
+}
+
+int snake_env_width(void) {
+	return BoardWidth;
+}
+
+int snake_env_height(void) {
+	return BoardHeight;
+}
+
+int snake_env_set_board_size(int width, int height) {
+	if (numLiveEnvs > 0) return -1;
+	return setBoardSize(width, height) ? 0 : -1;
+}
+
+SnakeEnv *snake_env_create(int num_envs, uint64_t seed, const SnakeEnvBuffers *buffers) {
+	if (num_envs <= 0 || !buffers) return NULL;
+
+	SnakeEnv *env = new (std::nothrow) SnakeEnv;
+	if (!env) return NULL;
+	try { // the games size their grids for the board, which can throw
+		env->games = new GameState[num_envs];
+	} catch (const std::bad_alloc &) {
+		delete env;
+		return NULL;
+	}
+	env->numEnvs = num_envs;
+	env->buffers = *buffers;
+	for (int k = 0; k < num_envs; k++) {
+		env->games[k].reset(seed + k);
+	}
+	env->seeded = true;
+	numLiveEnvs++;
+	return env;
+}
+
+void snake_env_destroy(SnakeEnv *env) {
+	if (!env) return;
+	delete[] env->games;
+	delete env;
+	numLiveEnvs--;
+}
+
+void snake_env_reset(SnakeEnv *env) {
+	for (int k = 0; k < env->numEnvs; k++) {
+		if (!env->seeded) env->games[k].reset();
+		writeObservation(env, k);
+	}
+	env->seeded = false;
+}
+
+void snake_env_step(SnakeEnv *env, const int32_t *actions) {
+	const SnakeEnvBuffers &b = env->buffers;
+	env->seeded = false; // a reset from now on starts new games
+	for (int k = 0; k < env->numEnvs; k++) {
+		GameState &game = env->games[k];
+		int events = game.step(actions[k]);
+
+		float reward = 0.0f;
+		if (events & EV_ATE_NORMAL) reward += 1.0f;
+		if (events & EV_LOST_LIFE) reward -= 1.0f;
+		b.rewards[k] = reward;
+		b.dones[k] = game.isGameOver();
+
+		if (game.isGameOver()) game.reset();
+		writeObservation(env, k);
+	}
+}
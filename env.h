@@ -0,0 +1,88 @@
+/*
+ * Vectorized Snake environments behind a C ABI, for reinforcement learning loops in any language.
+ *
+ * One SnakeEnv holds K independent games. The caller owns every buffer: it hands them over once in
+ * SnakeEnvBuffers and snake_env_reset/snake_env_step write the observations, rewards and done flags
+ * straight into them, there are no copies and no allocations after snake_env_create. The occupancy
+ * planes are only touched where a cell changed, so the caller must not write to them.
+ *
+ * Every array is indexed by environment first: planes[k * height * width + y * width + x] and
+ * head_x[k]. The rules are those of GameState::step, the same as the game and snake-sim.
+ *
+ * Different environments can be created, stepped and destroyed on different threads at the same time, one
+ * environment is only used by one thread at a time. The board size is set before any of those threads start.
+ *
+ * Build: make libsnakeenv.so
+ */
+
+#ifndef SNAKE_ENV_H
+#define SNAKE_ENV_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Actions, the same values as the game's directions; SNAKE_ENV_NOOP keeps going the same way
+ */
+#define SNAKE_ENV_UP 0
+#define SNAKE_ENV_DOWN 1
+#define SNAKE_ENV_RIGHT 2
+#define SNAKE_ENV_LEFT 3
+#define SNAKE_ENV_NOOP -1
+
+typedef struct SnakeEnv SnakeEnv;
+
+/*
+ * The caller's buffers, struct of arrays over the K environments
+ */
+typedef struct {
+	uint8_t *body;       /* K * height * width, 1 where the snake (head included) is */
+	uint8_t *obstacles;  /* K * height * width, 1 where an obstacle is */
+	int32_t *head_x;     /* K each */
+	int32_t *head_y;
+	int32_t *fruit_x;
+	int32_t *fruit_y;
+	int32_t *fruit_attr; /* 0 normal, 1 heart (one more life), 2 evil (one life less) */
+	int32_t *lives;
+	float *rewards;      /* K, written by snake_env_step */
+	uint8_t *dones;      /* K, written by snake_env_step */
+} SnakeEnvBuffers;
+
+int snake_env_width(void);
+int snake_env_height(void);
+
+/*
+ * Function to set the board size in cells (40x28 until it is called), from 16x12 up to 4096x4096. It can only
+ *	be changed while no environment exists. Returns 0, or -1 when the size is out of range or it cannot change.
+ */
+int snake_env_set_board_size(int width, int height);
+
+/*
+ * Function to create num_envs environments writing into buffers, environment k is seeded with seed + k.
+ *	Returns NULL when num_envs is not positive or memory runs out.
+ */
+SnakeEnv *snake_env_create(int num_envs, uint64_t seed, const SnakeEnvBuffers *buffers);
+
+void snake_env_destroy(SnakeEnv *env);
+
+/*
+ * Function to start a new game in every environment and write the first observations; after
+ *	snake_env_create the first call keeps the games it seeded, so environment k starts on the game of seed + k
+ */
+void snake_env_reset(SnakeEnv *env);
+
+/*
+ * Function to apply actions[k] to environment k and move every snake one cell. The reward is +1 for a
+ *	normal fruit and -1 for each life lost, 0 otherwise. A finished game sets dones[k] and starts over
+ *	right away, so the observation is already the first one of the next game.
+ */
+void snake_env_step(SnakeEnv *env, const int32_t *actions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,537 @@
+/*
+ * Headless game engine for Snake, see game.h
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+
+#include "game.h"
+
+
+int BoardWidth = DEFAULT_BOARD_WIDTH;
+int BoardHeight = DEFAULT_BOARD_HEIGHT;
+
+bool setBoardSize(int width, int height) {
+	if (width < MIN_BOARD_WIDTH || width > MAX_BOARD_SIZE || height < MIN_BOARD_HEIGHT || height > MAX_BOARD_SIZE) {
+		return false;
+	}
+	BoardWidth = width;
+	BoardHeight = height;
+	return true;
+}
+
+bool parseBoardSize(const char *text) {
+	int width, height;
+	char end;
+	if (sscanf(text, "%dx%d%c", &width, &height, &end) != 2) return false;
+	return setBoardSize(width, height);
+}
+
+/*
+ * Create a single obstable with a random length in a random side of the board
+ */
+Obstacle::Obstacle(Rng &rng) {
+	int length = rng.below(MAX_OBSTACLES);
+	length = (length >= MIN_OBSTACLES) ? length : (length + MIN_OBSTACLES);
+
+	baseSide = rng.below(4);
+
+	switch (baseSide) {
+		case UP:
+			x = rng.below(BoardWidth);
+			y = 0;
+			xLength = 1;
+			yLength = length;
+			break;
+		case DOWN:
+			x = rng.below(BoardWidth);
+			y = BoardHeight - length;
+			xLength = 1;
+			yLength = length;
+			break;
+		case LEFT:
+			x = 0;
+			y = rng.below(BoardHeight);
+			xLength = length;
+			yLength = 1;
+			break;
+		case RIGHT:
+			x = BoardWidth - length;
+			y = rng.below(BoardHeight);
+			xLength = length;
+			yLength = 1;
+			break;
+	}
+}
+
+int directionBetween(int fromX, int fromY, int toX, int toY) {
+	if (toY == fromY && toX == wrapCell(fromX + 1, BoardWidth)) return RIGHT;
+	if (toY == fromY && toX == wrapCell(fromX - 1, BoardWidth)) return LEFT;
+	if (toX == fromX && toY == wrapCell(fromY + 1, BoardHeight)) return DOWN;
+	if (toX == fromX && toY == wrapCell(fromY - 1, BoardHeight)) return UP;
+	return NO_INPUT;
+}
+
+/*
+ * Function to move every cell of a row (rowWords words) one step left and one step right into out, the
+ *	end cells coming round to the other end
+ */
+static inline void sideways(const uint64_t *row, uint64_t *out, int rowWords) {
+	if (rowWords == 1) { // the default board, one word a row
+		uint64_t right = (row[0] << 1) | (row[0] >> (BoardWidth - 1));
+		uint64_t left = (row[0] >> 1) | (row[0] << (BoardWidth - 1));
+		out[0] = (right | left) & (~0ULL >> (64 - BoardWidth));
+		return;
+	}
+	for (int w = 0; w < rowWords; w++) {
+		uint64_t right = (row[w] << 1) | ((w > 0) ? (row[w - 1] >> 63) : 0);
+		uint64_t left = (row[w] >> 1) | ((w + 1 < rowWords) ? (row[w + 1] << 63) : 0);
+		out[w] = right | left;
+	}
+	int last = BoardWidth - 1;
+	uint64_t &lastWord = out[last >> 6];
+	if ((row[last >> 6] >> (last & 63)) & 1) out[0] |= 1;
+	if (row[0] & 1) lastWord |= 1ULL << (last & 63);
+	lastWord &= ~0ULL >> (63 - (last & 63)); // what went past the last cell
+}
+
+void Bitboard::neighbours(Bitboard &result) const {
+	if (result.words.size() != words.size()) result.clear();
+	const uint64_t *in = words.data();
+	uint64_t *out = result.words.data();
+	for (int y = 0; y < BoardHeight; y++) {
+		const uint64_t *above = in + ((y == 0) ? BoardHeight - 1 : y - 1) * rowWords;
+		const uint64_t *below = in + ((y == BoardHeight - 1) ? 0 : y + 1) * rowWords;
+		uint64_t *row = out + y * rowWords;
+		sideways(in + y * rowWords, row, rowWords);
+		for (int w = 0; w < rowWords; w++) {
+			row[w] |= above[w] | below[w];
+		}
+	}
+}
+
+void ClearCounts::count(const uint64_t *taken, const uint64_t *alsoTaken) {
+	int rowWords = boardRowWords();
+	rows.assign(BoardHeight, 0);
+	tileRows.assign(boardTileRows(), 0);
+	total = 0;
+	for (int y = 0; y < BoardHeight; y++) {
+		int numTaken = 0;
+		for (int w = y * rowWords; w < (y + 1) * rowWords; w++) {
+			numTaken += countBits(taken[w] | alsoTaken[w]);
+		}
+		rows[y] = BoardWidth - numTaken;
+		tileRows[y >> TILE_SHIFT] += rows[y];
+		total += rows[y];
+	}
+}
+
+int ClearCounts::findRow(int &k) const {
+	int tileRow = 0;
+	for (; k >= tileRows[tileRow]; tileRow++) k -= tileRows[tileRow];
+	int y = tileRow << TILE_SHIFT;
+	for (; k >= rows[y]; y++) k -= rows[y];
+	return y;
+}
+
+int randomClearCell(const uint64_t *taken, const uint64_t *alsoTaken, Rng &rng, const ClearCounts &clear) {
+	int rowWords = boardRowWords();
+	for (int tries = 0; tries < 8; tries++) {
+		int x = rng.below(BoardWidth);
+		int y = rng.below(BoardHeight);
+		int w = y * rowWords + (x >> 6);
+		if (!(((taken[w] | alsoTaken[w]) >> (x & 63)) & 1)) return cellIndex(x, y);
+	}
+
+	/* the board is nearly full, walk the counts down to the row */
+	if (clear.getTotal() == 0) return -1;
+	int k = rng.below(clear.getTotal());
+	int y = clear.findRow(k);
+	for (int w = y * rowWords;; w++) {
+		int x0 = (w % rowWords) * 64;
+		uint64_t bits = ~(taken[w] | alsoTaken[w]);
+		if (BoardWidth - x0 < 64) bits &= ~0ULL >> (64 - (BoardWidth - x0));
+		int n = countBits(bits);
+		if (k >= n) {
+			k -= n;
+			continue;
+		}
+		int shift = 0;
+		for (;; shift += 8) { // find the byte, then the bit in it
+			int inByte = countBits((bits >> shift) & 0xff);
+			if (k < inByte) break;
+			k -= inByte;
+		}
+		bits = (bits >> shift) & 0xff;
+		for (int i = 0; i < k; i++) {
+			bits &= bits - 1; // drop the lowest set bit
+		}
+		return cellIndex(x0 + shift + __builtin_ctzll(bits), w / rowWords);
+	}
+}
+
+Obstacles::Obstacles() {
+	generation = 0;
+}
+
+void Obstacles::generateObstacles(Rng &rng) {
+	int numOfObs = rng.below(MAX_OBSTACLES);
+	numOfObs = (numOfObs >= MIN_OBSTACLES) ? numOfObs : (numOfObs + MIN_OBSTACLES);
+
+	obs.clear();
+	covered.clear();
+	tiles.clear();
+	generation++;
+	for (int i = 0; i < numOfObs; i++) {
+		Obstacle ob(rng);
+		for (int y = ob.getY(); y < ob.getY() + ob.getYLength(); y++) {
+			for (int x = ob.getX(); x < ob.getX() + ob.getXLength(); x++) {
+				if (covered.test(x, y)) continue; // obstacles can cross
+				covered.set(x, y);
+				tiles.add(x, y);
+			}
+		}
+		obs.push_back(ob);
+	}
+}
+
+void Obstacles::clear() {
+	obs.clear();
+	covered.clear();
+	tiles.clear();
+	generation++;
+}
+
+void Fruit::generateNewFruit(int new_x, int new_y, Rng &rng) {
+	x = new_x;
+	y = new_y;
+
+	int chance = rng.below(10);
+	if (chance >= 10 - EVIL_FRUIT_TENTHS) { // 1/10 chance evil fruit by default
+		attribute = EVIL_FRT;
+	} else if (chance >= 10 - EVIL_FRUIT_TENTHS - HEART_FRUIT_TENTHS) { // 2/10 chance heart fruit
+		attribute = HEART_FRT;
+	} else { // 7/10 chance normal fruit
+		attribute = NORMAL_FRT;
+	}
+}
+
+Snake::Snake(int x, int y) {
+	reset(x, y);
+}
+
+Snake::Snake(const vector<Block> &body) {
+	reset(body);
+}
+
+void Snake::clearBody() {
+	/*
+	 * the ring starts with the board's cell count rounded up to a power of two, or RING_SLOTS on big boards,
+	 *	and is kept when the board shrinks
+	 */
+	size_t slots = 1;
+	while (slots < (size_t)BoardWidth * BoardHeight && slots < RING_SLOTS) slots *= 2;
+	if (ring.size() < slots) ring.assign(slots, 0);
+	bodyCount.assign(BoardWidth * BoardHeight, 0);
+	occupied.clear();
+	tiles.clear();
+	ringHead = 0;
+	length = 0;
+	stillInObstacles = false;
+}
+
+void Snake::reset(int x, int y) {
+	clearBody();
+	x_speed = 1;
+	y_speed = 0;
+
+	for (int i = START_LENGTH - 1; i >= 0; i--) {
+		pushHead(x-i, y);
+	}
+}
+
+void Snake::reset(const vector<Block> &body) {
+	clearBody();
+
+	for (int i = body.size() - 1; i >= 0; i--) {
+		pushHead(body[i].getX(), body[i].getY());
+	}
+
+	x_speed = 0;
+	y_speed = 0;
+	switch (directionBetween(body[1].getX(), body[1].getY(), body[0].getX(), body[0].getY())) {
+		case UP: y_speed = -1; break;
+		case DOWN: y_speed = 1; break;
+		case LEFT: x_speed = -1; break;
+		default: x_speed = 1; break;
+	}
+}
+
+void Snake::pushHead(int x, int y) {
+	if (length == (int)ring.size()) { // full, double it keeping the order from the tail
+		vector<uint32_t> grown(ring.size() * 2);
+		for (int j = 0; j < length; j++) {
+			grown[length - 1 - j] = getCell(j);
+		}
+		ring.swap(grown);
+		ringHead = length - 1;
+	}
+	headX = x;
+	headY = y;
+	headIndex = cellIndex(x, y);
+	ringHead = (ringHead + 1) & (ring.size() - 1);
+	ring[ringHead] = headIndex;
+	length++;
+	if (bodyCount[headIndex]++ == 0) {
+		occupied.set(x, y);
+		tiles.add(x, y);
+	}
+}
+
+void Snake::popTail() {
+	int tailIndex = getCell(length - 1);
+	if (--bodyCount[tailIndex] == 0) {
+		int x = tailIndex % BoardWidth;
+		int y = tailIndex / BoardWidth;
+		occupied.reset(x, y);
+		tiles.remove(x, y);
+	}
+	length--;
+}
+
+void Snake::changeDirection(int direction) {
+	// snake starts with length of 5, so safe to access first 2 block for direction verification
+	int blk1X = headX;
+	int blk2X = getCell(1) % BoardWidth;
+
+	/* if using original x_speed or y_speed to check if it's movable, would go down directly by pressing
+			LEFT and DOWN quickly from going up originally  */
+	bool movingAlongYcoord = (blk1X == blk2X); // if x coords are the same, so moving along y direction
+
+	switch (direction) { // only can change to directions that are perpendicular to the original direction
+		case UP:
+			if (!movingAlongYcoord) {
+				y_speed = -1;
+				x_speed = 0;
+			}
+			break;
+		case DOWN:
+			if (!movingAlongYcoord) {
+				y_speed = 1;
+				x_speed = 0;
+			}
+			break;
+		case RIGHT:
+			if (movingAlongYcoord) {
+				x_speed = 1;
+				y_speed = 0;
+			}
+			break;
+		case LEFT:
+			if (movingAlongYcoord) {
+				x_speed = -1;
+				y_speed = 0;
+			}
+			break;
+	}
+}
+
+GameState::GameState(uint64_t seed) : rng(seed), snake(START_HEAD_X, START_HEAD_Y) {
+	reset();
+}
+
+void GameState::reset() {
+	snake.reset(START_HEAD_X, START_HEAD_Y);
+	fruit.reset();
+	obstacles.generateObstacles(rng);
+	countClearCells();
+	score = 0;
+	numOfLives = START_LIVES;
+	gameOver = false;
+	gameWon = false;
+	tick = 0;
+	lastSpecialFruitTick = 0;
+	numChangedCells = 0;
+	allChanged = true;
+}
+
+void GameState::reset(uint64_t seed) {
+	rng.reseed(seed);
+	reset();
+}
+
+void GameState::resetWithSnake(const vector<Block> &body) {
+	snake.reset(body);
+	obstacles.clear();
+	countClearCells();
+	score = 0;
+	numOfLives = START_LIVES;
+	gameOver = false;
+	gameWon = false;
+	tick = 0;
+	lastSpecialFruitTick = 0;
+	numChangedCells = 0;
+	allChanged = true;
+	if (!regenerateFruit()) {
+		gameOver = true;
+		gameWon = true;
+	}
+}
+
+void GameState::revive() {
+	if (gameWon) return; // nowhere left to go
+	numOfLives++;
+	gameOver = false;
+}
+
+void GameState::countClearCells() {
+	clearCells.count(snake.occupied.getWords(), obstacles.getCovered().getWords());
+}
+
+bool GameState::regenerateFruit() {
+	int cell = randomClearCell(snake.occupied.getWords(), obstacles.getCovered().getWords(), rng, clearCells);
+	if (cell < 0) return false;
+
+	markChanged(cellIndex(fruit.getX(), fruit.getY()));
+	markChanged(cell);
+	fruit.generateNewFruit(cell % BoardWidth, cell / BoardWidth, rng);
+	if (fruit.getAttribute() == HEART_FRT || fruit.getAttribute() == EVIL_FRT) {
+		lastSpecialFruitTick = tick;
+	}
+	return true;
+}
+
+int GameState::didEatFruit(int headX, int headY, bool &needFruit) {
+	needFruit = false;
+	if (fruit.getX() == headX && fruit.getY() == headY) {
+		int events;
+		if (fruit.getAttribute() == NORMAL_FRT) {
+			score++;
+			events = EV_ATE_NORMAL;
+		} else if (fruit.getAttribute() == HEART_FRT) {
+			if (numOfLives < MAX_LIVES) {
+				numOfLives++;
+			}
+			events = EV_ATE_HEART;
+		} else { // evil fruit
+			if (numOfLives > 0) {
+				numOfLives--;
+			}
+			events = EV_ATE_EVIL | EV_LOST_LIFE;
+			if (numOfLives == 0) {
+				gameOver = true;
+				return events | EV_GAMEOVER;
+			}
+		}
+
+		needFruit = true;
+		return events;
+	} else {
+		if ((fruit.getAttribute() == HEART_FRT || fruit.getAttribute() == EVIL_FRT) &&
+			(tick - lastSpecialFruitTick > SPECIAL_FRUIT_TICKS)) { // regenerate after some time if special fruits
+			needFruit = true;
+			return EV_FRUIT_EXPIRED;
+		}
+		return EV_NONE;
+	}
+}
+
+int GameState::didDead(int headX, int headY) {
+	int events = EV_NONE;
+	if (snake.onSnakeBody(headX, headY)) {
+		events = EV_HIT_BODY;
+	} else if (obstacles.onObstacles(headX, headY)) {
+		events = EV_HIT_OBSTACLE;
+	}
+
+	if (events != EV_NONE) {
+		if (!snake.stillInObstacles) {
+			snake.stillInObstacles = true;
+			numOfLives--;
+			events |= EV_LOST_LIFE;
+		}
+		if (numOfLives == 0) {
+			gameOver = true;
+			events |= EV_GAMEOVER;
+		}
+	} else {
+		snake.stillInObstacles = false;
+	}
+	return events;
+}
+
+int GameState::step(int input) {
+	if (gameOver) return EV_NONE;
+
+	if (input != NO_INPUT) {
+		snake.changeDirection(input);
+	}
+	tick++;
+
+	int headX = wrapCell(snake.getHeadX() + snake.x_speed, BoardWidth);
+	int headY = wrapCell(snake.getHeadY() + snake.y_speed, BoardHeight);
+
+	bool needFruit;
+	int events = didDead(headX, headY);
+	events |= didEatFruit(headX, headY, needFruit);
+
+	/* move the body */
+	if (!(events & EV_ATE_NORMAL)) {
+		int tail = snake.getCell(snake.length - 1);
+		markChanged(tail);
+		snake.popTail();
+		freeCell(tail % BoardWidth, tail / BoardWidth);
+	}
+	markChanged(snake.headIndex); // the old head changes colour
+	takeCell(headX, headY);
+	snake.pushHead(headX, headY);
+	markChanged(snake.headIndex);
+
+	/* the new fruit goes on a free cell once the body has moved */
+	if (needFruit && !regenerateFruit()) {
+		gameOver = true;
+		gameWon = true;
+		events |= EV_GAMEWON | EV_GAMEOVER;
+	}
+	return events;
+}
+
+
+CyclePolicy::CyclePolicy() : cycle(BoardWidth * BoardHeight), next(BoardWidth * BoardHeight) {
+	int k = 0;
+	/* along the top row to the right */
+	for (int x = 0; x < BoardWidth; x++) {
+		cycle[k++] = cellIndex(x, 0);
+	}
+	/* back and forth over the other rows, leaving the first column free */
+	for (int y = 1; y < BoardHeight; y++) {
+		if (y % 2 == 1) {
+			for (int x = BoardWidth - 1; x >= 1; x--) cycle[k++] = cellIndex(x, y);
+		} else {
+			for (int x = 1; x < BoardWidth; x++) cycle[k++] = cellIndex(x, y);
+		}
+	}
+	/* and up the first column back to the start */
+	for (int y = BoardHeight - 1; y >= 1; y--) {
+		cycle[k++] = cellIndex(0, y);
+	}
+
+	for (int i = 0; i < k; i++) {
+		next[cycle[i]] = cycle[(i + 1) % k];
+	}
+}
+
+vector<Block> CyclePolicy::snakeOnCycle(int length) const {
+	vector<Block> body;
+	for (int i = length - 1; i >= 0; i--) {
+		body.push_back(Block(cycle[i] % BoardWidth, cycle[i] / BoardWidth));
+	}
+	return body;
+}
+
+int CyclePolicy::direction(const GameState &game) const {
+	const Snake &snake = game.getSnake();
+	int to = next[cellIndex(snake.getHeadX(), snake.getHeadY())];
+	return directionBetween(snake.getHeadX(), snake.getHeadY(), to % BoardWidth, to / BoardWidth);
+}
@@ -0,0 +1,766 @@
+/*
+ * Headless game engine for Snake.
+ *
+ * Everything in here works on board cells (column, row inside the play region) and game ticks,
+ * there is no X11, no wall clock and no global random state, so the same seed and inputs always play
+ * the same game. The X11 front end (snake.cpp) and the headless tools drive
+ * a GameState by calling step() once per snake move.
+ */
+
+#ifndef GAME_H
+#define GAME_H
+
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+
+/*
+ * Macros for directions
+ */
+#define UP 0
+#define DOWN 1
+#define RIGHT 2
+#define LEFT 3
+#define NO_INPUT -1
+
+/*
+ * Macros for different kind of fruits
+ */
+#define NORMAL_FRT 0
+#define HEART_FRT 1
+#define EVIL_FRT 2
+
+/*
+ * Macros for some varibale limits
+ */
+#define MAX_LIVES 5
+#define START_LIVES 3
+
+/*
+ * Macros for the difficulty, they can be set on the compile line (e.g. -DMAX_OBSTACLES=20) to try other
+ *	values with snake-batch: the obstacle count and length range, and the odds in tenths of a new fruit
+ *	being evil or a heart
+ */
+#ifndef MAX_OBSTACLES
+#define MAX_OBSTACLES 12
+#endif
+#ifndef MIN_OBSTACLES
+#define MIN_OBSTACLES 5
+#endif
+#ifndef EVIL_FRUIT_TENTHS
+#define EVIL_FRUIT_TENTHS 1
+#endif
+#ifndef HEART_FRUIT_TENTHS
+#define HEART_FRUIT_TENTHS 2
+#endif
+
+/*
+ * A special fruit disappears after 35000000/speed microseconds and the snake moves every 750000/speed
+ * microseconds, so the lifetime is the same number of ticks at every speed.
+ */
+#define SPECIAL_FRUIT_TICKS 47
+
+/* How many changed cells GameState remembers before it reports that everything changed */
+#define MAX_CHANGED_CELLS 64
+
+/*
+ * Macros for the events reported by GameState::step
+ */
+#define EV_NONE 0x0
+#define EV_ATE_NORMAL 0x1
+#define EV_ATE_HEART 0x2
+#define EV_ATE_EVIL 0x4
+#define EV_HIT_BODY 0x8
+#define EV_HIT_OBSTACLE 0x10
+#define EV_LOST_LIFE 0x20
+#define EV_GAMEOVER 0x40
+#define EV_FRUIT_EXPIRED 0x80
+#define EV_GAMEWON 0x100
+
+/*
+ * Macros for the size of the play region in cells: the default fills the 800x600 window at 20 pixels a cell,
+ *	the smallest leaves room for the longest obstacle and the start of a game
+ */
+#define DEFAULT_BOARD_WIDTH 40
+#define DEFAULT_BOARD_HEIGHT 28
+#define MIN_BOARD_WIDTH 16
+#define MIN_BOARD_HEIGHT 12
+#define MAX_BOARD_SIZE 4096
+
+/*
+ * The play region in cells, the same for every game in the process. Change it with setBoardSize() before
+ *	creating games, or reset the games after, they size their grids for the board when they are reset.
+ */
+extern int BoardWidth;
+extern int BoardHeight;
+
+/*
+ * Function to set the board size, false (and no change) when it is outside the MIN_ and MAX_BOARD macros
+ */
+bool setBoardSize(int width, int height);
+
+/*
+ * Function to set the board size from text like "200x150", for the --board=WxH options
+ */
+bool parseBoardSize(const char *text);
+
+/*
+ * Macros for where every game starts: a snake of START_LENGTH blocks along the middle row heading right,
+ *	and the first fruit ahead of it
+ */
+#define START_HEAD_X (BoardWidth / 2 - 3)
+#define START_HEAD_Y (BoardHeight / 2 - 1)
+#define START_LENGTH 5
+#define START_FRUIT_X (BoardWidth / 2 + 7)
+#define START_FRUIT_Y (BoardHeight / 2 - 1)
+
+/*
+ * Function to get the index of a cell in the cell-indexed grids
+ */
+inline int cellIndex(int x, int y) {
+	return y * BoardWidth + x;
+}
+
+/*
+ * Function to wrap a cell coordinate into [0, size), the snake can go through each side
+ */
+inline int wrapCell(int value, int size) {
+	return (value < 0) ? (value + size) : ((value >= size) ? (value - size) : value);
+}
+
+
+/*
+ * Class for the random numbers of one game (SplitMix64), small and fast enough to give every game its own
+ */
+class Rng {
+public:
+	Rng(uint64_t seed = 1) {
+		reseed(seed);
+	}
+
+	void reseed(uint64_t seed) {
+		state = seed;
+	}
+
+	uint64_t next() {
+		uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	/* Method to get a number in [0, n) */
+	int below(int n) {
+		return (int)(((next() >> 32) * (uint64_t)n) >> 32);
+	}
+
+private:
+	uint64_t state;
+};
+
+/*
+ * Function to get the direction that leads from one cell to a neighbouring one (through the edges too),
+ *	NO_INPUT when they are not neighbours
+ */
+int directionBetween(int fromX, int fromY, int toX, int toY);
+
+
+/*
+ * Class for each snake block, increase one instance every time the snake eats a normal fruit
+ */
+class Block {
+private:
+	int x;
+	int y;
+public:
+	Block(int x, int y) : x(x), y(y) { }
+
+	int getX() const {
+		return x;
+	}
+
+	int getY() const {
+		return y;
+	}
+};
+
+/*
+ * Functions to get the 64 bit words in a row of a Bitboard and in a whole one
+ */
+inline int boardRowWords() {
+	return (BoardWidth + 63) / 64;
+}
+
+inline int boardWords() {
+	return BoardHeight * boardRowWords();
+}
+
+/*
+ * Function to count the set bits of a word. The engine is built for any x86-64 (and ARM), where
+ *	__builtin_popcountll without a popcnt instruction is a library call, this stays inline.
+ */
+inline int countBits(uint64_t bits) {
+	bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+	bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+	bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (bits * 0x0101010101010101ULL) >> 56;
+}
+
+/*
+ * Class for a set of cells as one bit per cell, bit x of row y for the cell (x, y) with every row starting
+ *	on a new 64 bit word, so set operations and counts take one operation per word, and moving every
+ *	cell one step sideways (through the edges too) is a few shifts per word while moving it up or down
+ *	is taking the next row
+ */
+class Bitboard {
+public:
+	Bitboard() {
+		clear();
+	}
+
+	/* Method to empty the set, it also sizes the set for the current board */
+	void clear() {
+		rowWords = boardRowWords();
+		words.assign(boardWords(), 0);
+	}
+
+	void set(int x, int y) {
+		words[y * rowWords + (x >> 6)] |= 1ULL << (x & 63);
+	}
+
+	void reset(int x, int y) {
+		words[y * rowWords + (x >> 6)] &= ~(1ULL << (x & 63));
+	}
+
+	bool test(int x, int y) const {
+		return (words[y * rowWords + (x >> 6)] >> (x & 63)) & 1;
+	}
+
+	Bitboard &operator|=(const Bitboard &other) {
+		for (size_t w = 0; w < words.size(); w++) words[w] |= other.words[w];
+		return *this;
+	}
+
+	Bitboard &operator&=(const Bitboard &other) {
+		for (size_t w = 0; w < words.size(); w++) words[w] &= other.words[w];
+		return *this;
+	}
+
+	/* Method to remove the cells of other */
+	Bitboard &andNot(const Bitboard &other) {
+		for (size_t w = 0; w < words.size(); w++) words[w] &= ~other.words[w];
+		return *this;
+	}
+
+	bool any() const {
+		uint64_t bits = 0;
+		for (size_t w = 0; w < words.size(); w++) bits |= words[w];
+		return bits != 0;
+	}
+
+	int count() const {
+		int n = 0;
+		for (size_t w = 0; w < words.size(); w++) n += countBits(words[w]);
+		return n;
+	}
+
+	/*
+	 * Method to put the cells next to the set ones in any direction, wrapping through the edges like the snake,
+	 *	into result; it reuses the storage of result, so a search loop does not allocate
+	 */
+	void neighbours(Bitboard &result) const;
+
+	/* Method to exchange the cells with another set without copying them */
+	void swap(Bitboard &other) {
+		words.swap(other.words);
+		int otherRowWords = other.rowWords;
+		other.rowWords = rowWords;
+		rowWords = otherRowWords;
+	}
+
+	/* Method to get the raw words, boardRowWords() per row, for code that indexes them itself */
+	const uint64_t *getWords() const {
+		return words.data();
+	}
+
+private:
+	vector<uint64_t> words;
+	int rowWords;
+};
+
+/*
+ * Macros for the tiles of TileCounts, squares of 32x32 cells so a tile row is half of a Bitboard word
+ */
+#define TILE_SHIFT 5
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+/*
+ * Functions to get the tiles across and down the board, the last ones can be partly off the board
+ */
+inline int boardTileCols() {
+	return (BoardWidth + TILE_SIZE - 1) >> TILE_SHIFT;
+}
+
+inline int boardTileRows() {
+	return (BoardHeight + TILE_SIZE - 1) >> TILE_SHIFT;
+}
+
+/*
+ * Class for how many cells of a Bitboard are in each tile of the board, kept next to it by whoever sets
+ *	and resets its cells, so code that wants the cells in one part of a big board can skip the empty
+ *	tiles without looking at their words
+ */
+class TileCounts {
+public:
+	TileCounts() {
+		clear();
+	}
+
+	/* Method to set every count to 0, it also sizes the counts for the current board */
+	void clear() {
+		tileCols = boardTileCols();
+		counts.assign(tileCols * boardTileRows(), 0);
+	}
+
+	void add(int x, int y) {
+		counts[(y >> TILE_SHIFT) * tileCols + (x >> TILE_SHIFT)]++;
+	}
+
+	void remove(int x, int y) {
+		counts[(y >> TILE_SHIFT) * tileCols + (x >> TILE_SHIFT)]--;
+	}
+
+	/* Method to get the count of the tile in tile column tileX and tile row tileY */
+	int get(int tileX, int tileY) const {
+		return counts[tileY * tileCols + tileX];
+	}
+
+private:
+	vector<int> counts;
+	int tileCols;
+};
+
+/*
+ * Class for how many cells are clear of the snake and obstacles in each row and in each row of tiles, kept
+ *	up to date by whoever takes and frees the cells, so randomClearCell() finds the row of a clear cell by
+ *	walking the counts of the tile rows and then of the rows in one tile row, not the whole board
+ */
+class ClearCounts {
+public:
+	ClearCounts() : total(0) { }
+
+	/* Method to count the cells in neither of two Bitboards (given as their words) from scratch, it also sizes the counts for the current board */
+	void count(const uint64_t *taken, const uint64_t *alsoTaken);
+
+	/* Methods for a cell of row y that was clear being taken, and a taken one becoming clear */
+	void take(int y) {
+		rows[y]--;
+		tileRows[y >> TILE_SHIFT]--;
+		total--;
+	}
+
+	void release(int y) {
+		rows[y]++;
+		tileRows[y >> TILE_SHIFT]++;
+		total++;
+	}
+
+	/* Method to find the row of the k-th clear cell in row order, k becomes its place among the clear cells of that row */
+	int findRow(int &k) const;
+
+	int getTotal() const {
+		return total;
+	}
+
+private:
+	vector<int> rows;
+	vector<int> tileRows;
+	int total;
+};
+
+/*
+ * Function to pick a random cell that is in neither of two Bitboards (given as their words), -1 when there
+ *	is none. It tries a few random cells of the whole board first, which is enough unless the board is
+ *	nearly full, and then picks uniformly among the clear cells in row order, the counts in clear finding
+ *	the row so only the words of that row are looked at.
+ */
+int randomClearCell(const uint64_t *taken, const uint64_t *alsoTaken, Rng &rng, const ClearCounts &clear);
+
+/*
+ * Class for a single obstacle, a straight bar of cells touching one side of the board
+ */
+class Obstacle {
+public:
+	Obstacle(Rng &rng);
+
+	int getX() const {
+		return x;
+	}
+
+	int getY() const {
+		return y;
+	}
+
+	int getXLength() const {
+		return xLength;
+	}
+
+	int getYLength() const {
+		return yLength;
+	}
+
+private:
+	int baseSide; // UP, DOWN, LEFT, RIGHT
+	int x;
+	int y;
+	int xLength;
+	int yLength;
+};
+
+/*
+ * Class to create and query a list of Obstacles
+ */
+class Obstacles {
+public:
+	Obstacles();
+
+	/* Method to generate a list of random obstables */
+	void generateObstacles(Rng &rng);
+
+	/* Method to remove every obstacle */
+	void clear();
+
+	/* Method to get how many times the obstacles were generated, anything cached from them is stale when it changes */
+	unsigned long getGeneration() const {
+		return generation;
+	}
+
+	/* Method to check if a cell is covered by any obstacle */
+	bool onObstacles(int x, int y) const {
+		return covered.test(x, y);
+	}
+
+	/* Method to get every cell covered by an obstacle */
+	const Bitboard &getCovered() const {
+		return covered;
+	}
+
+	/* Method to get how many covered cells are in each tile */
+	const TileCounts &getTiles() const {
+		return tiles;
+	}
+
+	int getNumOfObs() const {
+		return obs.size();
+	}
+
+	const Obstacle &getObs(int i) const {
+		return obs[i];
+	}
+
+private:
+	vector<Obstacle> obs;
+	Bitboard covered; // rebuilt by generateObstacles
+	TileCounts tiles; // the cells of covered in each tile
+	unsigned long generation;
+};
+
+/*
+ * Class for the fruit position and kind
+ */
+class Fruit {
+public:
+	Fruit() {
+		reset();
+	}
+
+	/* Method to put the fruit back to where every game starts */
+	void reset() {
+		x = START_FRUIT_X;
+		y = START_FRUIT_Y;
+		attribute = NORMAL_FRT;
+	}
+
+	/* Method to put the fruit on a new cell with a random kind */
+	void generateNewFruit(int new_x, int new_y, Rng &rng);
+
+	int getX() const {
+		return x;
+	}
+
+	int getY() const {
+		return y;
+	}
+
+	int getAttribute() const {
+		return attribute;
+	}
+
+private:
+	int x;
+	int y;
+	int attribute; // 0 - normal fruit, 1 - heart fruit (increse lives by 1), 2 - evil fruit (decrease by 1)
+};
+
+/* Most slots the body ring of a new snake starts with, 256 KB */
+#define RING_SLOTS 65536
+
+/*
+ * Class that holds the snake body and direction
+ */
+class Snake {
+public:
+	Snake(int x, int y);
+
+	/* Create a snake laid out on the given neighbouring cells, head first, moving away from the second block */
+	Snake(const vector<Block> &body);
+
+	/* Methods to start over like the constructors do, reusing the body storage */
+	void reset(int x, int y);
+	void reset(const vector<Block> &body);
+
+	/* Method to change the direction of the snake */
+	void changeDirection(int direction);
+
+	/* Method to check if any block of the snake, the head included, is on a cell */
+	bool onSnake(int x, int y) const {
+		return occupied.test(x, y);
+	}
+
+	/* Method to get every cell the snake is on */
+	const Bitboard &getOccupied() const {
+		return occupied;
+	}
+
+	/* Method to get how many cells of getOccupied() are in each tile */
+	const TileCounts &getTiles() const {
+		return tiles;
+	}
+
+	/* Helper method to check if a cell is on the snake body (the head excluded) */
+	bool onSnakeBody(int x, int y) const {
+		int i = cellIndex(x, y);
+		return bodyCount[i] > ((i == headIndex) ? 1 : 0);
+	}
+
+	int getHeadX() const {
+		return headX;
+	}
+
+	int getHeadY() const {
+		return headY;
+	}
+
+	int getXspeed() const {
+		return x_speed;
+	}
+
+	int getYspeed() const {
+		return y_speed;
+	}
+
+	/* Method to get the direction the snake is moving in, one of UP, DOWN, RIGHT, LEFT */
+	int getDirection() const {
+		if (y_speed != 0) return (y_speed < 0) ? UP : DOWN;
+		return (x_speed < 0) ? LEFT : RIGHT;
+	}
+
+	int getLength() const {
+		return length;
+	}
+
+	/* Method to get the cell index of block j of the body, 0 is the head and getLength()-1 the tail */
+	int getCell(int j) const {
+		return ring[(ringHead - j) & (ring.size() - 1)];
+	}
+
+	/* Method to get block j of the body, 0 is the head and getLength()-1 the tail */
+	Block getBlock(int j) const {
+		int cell = getCell(j);
+		return Block(cell % BoardWidth, cell / BoardWidth);
+	}
+
+private:
+	friend class GameState;
+
+	/* Method to empty the body, sizing it for the current board */
+	void clearBody();
+
+	/* Methods to grow the snake at the head and shrink it at the tail, keeping bodyCount, occupied and tiles up to date */
+	void pushHead(int x, int y);
+	void popTail();
+
+	int x_speed; // in cells per tick
+	int y_speed;
+	bool stillInObstacles; // flag to indicate if the snake head is still in the obstacle when collides
+	/*
+	 * The body as a circular buffer of cell indices, the head at ringHead and the tail length-1 slots before
+	 *	it. It holds a whole board of blocks, up to RING_SLOTS, and so on boards that size only grows when
+	 *	the snake covers the board and overlaps itself, which a normal game never does. On bigger boards
+	 *	it doubles as the snake gets longer than that.
+	 */
+	vector<uint32_t> ring;
+	int ringHead;
+	int length;
+	int headX;
+	int headY;
+	int headIndex; // cell index of the head
+	vector<unsigned short> bodyCount; // blocks on each cell (the body can cross itself)
+	Bitboard occupied; // the cells with a block on them
+	TileCounts tiles; // the cells of occupied in each tile
+};
+
+/*
+ * The whole state of one game, advanced one snake move at a time by step()
+ */
+class GameState {
+public:
+	GameState(uint64_t seed = 1);
+
+	/* Method to start a new game, new obstacles, a new snake and the default fruit */
+	void reset();
+
+	/* Method to start a new game from a seed; reset() carries on with the random numbers of the last game */
+	void reset(uint64_t seed);
+
+	/* Method to start a game on a board without obstacles with the snake on the given cells, head first */
+	void resetWithSnake(const vector<Block> &body);
+
+	/* Method to pick a new fruit cell uniformly from the cells clear of the snake and obstacles, false when there is none */
+	bool regenerateFruit();
+
+	/* Method to apply an input (a direction or NO_INPUT) and move the snake one cell, returns EV_* flags */
+	int step(int input);
+
+	/* Method to change the direction of the snake without moving it */
+	void changeDirection(int direction) {
+		snake.changeDirection(direction);
+	}
+
+	/* Method to bring a finished game back with one more life */
+	void revive();
+
+	bool isGameOver() const {
+		return gameOver;
+	}
+
+	/* The game is won when the snake and obstacles leave no cell for a new fruit */
+	bool isGameWon() const {
+		return gameWon;
+	}
+
+	unsigned int getScore() const {
+		return score;
+	}
+
+	unsigned int getNumOfLives() const {
+		return numOfLives;
+	}
+
+	unsigned long getTick() const {
+		return tick;
+	}
+
+	const Snake &getSnake() const {
+		return snake;
+	}
+
+	const Fruit &getFruit() const {
+		return fruit;
+	}
+
+	const Obstacles &getObstacles() const {
+		return obstacles;
+	}
+
+	/*
+	 * Methods for the cells that changed since the last clearChanges(), so a renderer only has to touch those.
+	 * allCellsChanged() is true after a reset or when more cells changed than fit in the list.
+	 */
+	bool allCellsChanged() const {
+		return allChanged;
+	}
+
+	int getNumChangedCells() const {
+		return numChangedCells;
+	}
+
+	int getChangedCell(int i) const {
+		return changedCells[i];
+	}
+
+	void clearChanges() {
+		numChangedCells = 0;
+		allChanged = false;
+	}
+
+private:
+	void markChanged(int cell) {
+		if (numChangedCells < MAX_CHANGED_CELLS) {
+			changedCells[numChangedCells++] = cell;
+		} else {
+			allChanged = true;
+		}
+	}
+
+	/* Method to check if the snake eats the fruit, returns the EV_* flags of what happened */
+	int didEatFruit(int headX, int headY, bool &needFruit);
+
+	/* Method to check if the snake is dead, it also manage the lives related work */
+	int didDead(int headX, int headY);
+
+	/* Method to count the cells clear of the snake and obstacles from scratch, after a reset */
+	void countClearCells();
+
+	/* Methods to keep the clear cell counts up to date as a cell is taken or freed by the snake */
+	void takeCell(int x, int y) {
+		if (!snake.onSnake(x, y) && !obstacles.onObstacles(x, y)) {
+			clearCells.take(y);
+		}
+	}
+
+	void freeCell(int x, int y) {
+		if (!snake.onSnake(x, y) && !obstacles.onObstacles(x, y)) {
+			clearCells.release(y);
+		}
+	}
+
+	Rng rng;
+	Snake snake;
+	Fruit fruit;
+	Obstacles obstacles;
+	unsigned int score;
+	unsigned int numOfLives;
+	bool gameOver;
+	bool gameWon;
+	unsigned long tick;
+	unsigned long lastSpecialFruitTick; // tick when the last special fruit showed up
+	int changedCells[MAX_CHANGED_CELLS];
+	int numChangedCells;
+	bool allChanged;
+	ClearCounts clearCells; // cells clear of the snake and obstacles, for placing fruit
+};
+
+/*
+ * Class for a scripted policy that keeps the snake on a cycle through every cell (it needs an even BoardHeight),
+ *	so without obstacles the snake never runs into itself and eventually fills the board. It is made for the
+ *	board size at the time it is created.
+ */
+class CyclePolicy {
+public:
+	CyclePolicy();
+
+	/* Method to lay a snake of the given length along the cycle, for GameState::resetWithSnake */
+	vector<Block> snakeOnCycle(int length) const;
+
+	/* Method to get the direction that takes the head to the next cell on the cycle */
+	int direction(const GameState &game) const;
+
+private:
+	vector<int> cycle; // every cell index, each one neighbouring the next
+	vector<int> next;  // the cell after each cell on the cycle
+};
+
+#endif
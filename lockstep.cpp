@@ -0,0 +1,315 @@
+/*
+ * Lockstep engine for Snake, see lockstep.h
+ */
+
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#include "lockstep.h"
+
+
+#define HIT_BODY 1
+#define HIT_OBSTACLE 2
+
+LockstepGames::LockstepGames(int numGames, uint64_t seed) : numGames(numGames) {
+	numPadded = (numGames + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES * LOCKSTEP_LANES;
+
+	vector<int32_t> *fields[] = { &input, &over, &won, &xSpeed, &ySpeed, &alongY, &headX, &headY, &headCell,
+								  &fruitCell, &fruitAttr, &lives, &score, &stillInObstacles, &length, &ringHead,
+								  &newCell, &hitFlags };
+	for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+		fields[f]->assign(numPadded, 0);
+	}
+	tick.assign(numPadded, 0);
+	lastSpecialFruitTick.assign(numPadded, 0);
+	rngs.resize(numPadded);
+	obstacleWords.assign((size_t)numPadded * boardWords(), 0);
+	occupied.resize(numPadded);
+	bodyCount.assign((size_t)numPadded * COUNT_STRIDE, 0);
+	rings.resize(numPadded);
+	clearCells.resize(numPadded);
+
+	for (int i = 0; i < numPadded; i++) {
+		reset(i, seed + i);
+		if (i >= numGames) over[i] = 1; // padding, never moves
+	}
+}
+
+void LockstepGames::pushHead(int i, int x, int y) {
+	int cell = cellIndex(x, y);
+	vector<uint32_t> &ring = rings[i];
+	if (length[i] == (int)ring.size()) { // full, double it keeping the order from the tail
+		vector<uint32_t> grown(ring.size() * 2);
+		for (int j = 0; j < length[i]; j++) {
+			grown[length[i] - 1 - j] = getBodyCell(i, j);
+		}
+		ring.swap(grown);
+		ringHead[i] = length[i] - 1;
+	}
+	ringHead[i] = (ringHead[i] + 1) & (ring.size() - 1);
+	ring[ringHead[i]] = cell;
+	length[i]++;
+	headX[i] = x;
+	headY[i] = y;
+	headCell[i] = cell;
+	bodyCount[(size_t)i * COUNT_STRIDE + cell]++;
+	if (!occupied[i].test(x, y) && !onObstacles(i, x, y)) clearCells[i].take(y);
+	occupied[i].set(x, y);
+}
+
+void LockstepGames::popTail(int i) {
+	int tail = getBodyCell(i, length[i] - 1);
+	if (--bodyCount[(size_t)i * COUNT_STRIDE + tail] == 0) {
+		int x = tail % BoardWidth;
+		int y = tail / BoardWidth;
+		occupied[i].reset(x, y);
+		if (!onObstacles(i, x, y)) clearCells[i].release(y);
+	}
+	length[i]--;
+}
+
+void LockstepGames::reset(int i) {
+	/* the obstacles come first, drawing the same numbers from the Rng as GameState::reset */
+	Obstacles generated;
+	generated.generateObstacles(rngs[i]);
+	memcpy(&obstacleWords[(size_t)i * boardWords()], generated.getCovered().getWords(), boardWords() * sizeof(uint64_t));
+
+	memset(&bodyCount[(size_t)i * COUNT_STRIDE], 0, COUNT_STRIDE * sizeof(uint16_t));
+	occupied[i].clear();
+	clearCells[i].count(occupied[i].getWords(), &obstacleWords[(size_t)i * boardWords()]);
+	if (rings[i].size() < 64) rings[i].assign(64, 0);
+	length[i] = 0;
+	ringHead[i] = 0;
+	for (int k = START_LENGTH - 1; k >= 0; k--) {
+		pushHead(i, START_HEAD_X - k, START_HEAD_Y);
+	}
+	xSpeed[i] = 1;
+	ySpeed[i] = 0;
+	alongY[i] = 0;
+	stillInObstacles[i] = 0;
+
+	fruitCell[i] = cellIndex(START_FRUIT_X, START_FRUIT_Y);
+	fruitAttr[i] = NORMAL_FRT;
+	score[i] = 0;
+	lives[i] = START_LIVES;
+	over[i] = 0;
+	won[i] = 0;
+	tick[i] = 0;
+	lastSpecialFruitTick[i] = 0;
+}
+
+void LockstepGames::reset(int i, uint64_t seed) {
+	rngs[i].reseed(seed);
+	reset(i);
+}
+
+bool LockstepGames::usingAvx2() {
+#ifdef HAVE_X86
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+void LockstepGames::moveHeadsScalar(int first) {
+	for (int i = first; i < first + LOCKSTEP_LANES; i++) {
+		if (over[i]) continue;
+
+		/* turn, the same tests as Snake::changeDirection */
+		switch (input[i]) {
+			case UP:
+				if (!alongY[i]) { ySpeed[i] = -1; xSpeed[i] = 0; }
+				break;
+			case DOWN:
+				if (!alongY[i]) { ySpeed[i] = 1; xSpeed[i] = 0; }
+				break;
+			case RIGHT:
+				if (alongY[i]) { xSpeed[i] = 1; ySpeed[i] = 0; }
+				break;
+			case LEFT:
+				if (alongY[i]) { xSpeed[i] = -1; ySpeed[i] = 0; }
+				break;
+		}
+
+		int x = wrapCell(headX[i] + xSpeed[i], BoardWidth);
+		int y = wrapCell(headY[i] + ySpeed[i], BoardHeight);
+		int cell = cellIndex(x, y);
+		newCell[i] = cell;
+
+		int count = bodyCount[(size_t)i * COUNT_STRIDE + cell];
+		if (count > ((cell == headCell[i]) ? 1 : 0)) {
+			hitFlags[i] = HIT_BODY;
+		} else if ((obstacleWords[(size_t)i * boardWords() + y * boardRowWords() + (x >> 6)] >> (x & 63)) & 1) {
+			hitFlags[i] = HIT_OBSTACLE;
+		} else {
+			hitFlags[i] = 0;
+		}
+	}
+}
+
+#ifdef HAVE_X86
+__attribute__((target("avx2")))
+void LockstepGames::moveHeadsAvx2(int first) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i minusOne = _mm256_set1_epi32(-1);
+	const __m256i width = _mm256_set1_epi32(BoardWidth);
+	const __m256i height = _mm256_set1_epi32(BoardHeight);
+
+	__m256i live = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&over[first]), zero);
+	__m256i in = _mm256_loadu_si256((const __m256i *)&input[first]);
+	__m256i ay = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&alongY[first]), one);
+	__m256i xs = _mm256_loadu_si256((const __m256i *)&xSpeed[first]);
+	__m256i ys = _mm256_loadu_si256((const __m256i *)&ySpeed[first]);
+
+	/* turn: UP and DOWN only when moving sideways, RIGHT and LEFT only when moving along a column */
+	__m256i up = _mm256_cmpeq_epi32(in, _mm256_set1_epi32(UP));
+	__m256i down = _mm256_cmpeq_epi32(in, _mm256_set1_epi32(DOWN));
+	__m256i right = _mm256_cmpeq_epi32(in, _mm256_set1_epi32(RIGHT));
+	__m256i left = _mm256_cmpeq_epi32(in, _mm256_set1_epi32(LEFT));
+	__m256i turnY = _mm256_andnot_si256(ay, _mm256_and_si256(live, _mm256_or_si256(up, down)));
+	__m256i turnX = _mm256_and_si256(ay, _mm256_and_si256(live, _mm256_or_si256(right, left)));
+	__m256i newYs = _mm256_blendv_epi8(one, minusOne, up);
+	__m256i newXs = _mm256_blendv_epi8(one, minusOne, left);
+	ys = _mm256_blendv_epi8(ys, newYs, turnY);
+	xs = _mm256_blendv_epi8(xs, zero, turnY);
+	xs = _mm256_blendv_epi8(xs, newXs, turnX);
+	ys = _mm256_blendv_epi8(ys, zero, turnX);
+	_mm256_storeu_si256((__m256i *)&xSpeed[first], xs);
+	_mm256_storeu_si256((__m256i *)&ySpeed[first], ys);
+
+	/* step the head and wrap it through the edges, what wrapCell does */
+	__m256i hx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&headX[first]), xs);
+	__m256i hy = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&headY[first]), ys);
+	hx = _mm256_add_epi32(hx, _mm256_and_si256(_mm256_cmpgt_epi32(zero, hx), width));
+	hx = _mm256_sub_epi32(hx, _mm256_and_si256(_mm256_cmpgt_epi32(hx, _mm256_set1_epi32(BoardWidth - 1)), width));
+	hy = _mm256_add_epi32(hy, _mm256_and_si256(_mm256_cmpgt_epi32(zero, hy), height));
+	hy = _mm256_sub_epi32(hy, _mm256_and_si256(_mm256_cmpgt_epi32(hy, _mm256_set1_epi32(BoardHeight - 1)), height));
+	__m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(hy, width), hx);
+	_mm256_storeu_si256((__m256i *)&newCell[first], cell);
+
+	/* gather the body count and obstacle bit of each game's new head cell */
+	__m256i game = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i countIndex = _mm256_add_epi32(_mm256_mullo_epi32(game, _mm256_set1_epi32(COUNT_STRIDE)), cell);
+	__m256i count = _mm256_mask_i32gather_epi32(zero, (const int *)bodyCount.data(), countIndex, live, 2);
+	count = _mm256_and_si256(count, _mm256_set1_epi32(0xffff));
+	__m256i rowHalf = _mm256_add_epi32(_mm256_mullo_epi32(hy, _mm256_set1_epi32(boardRowWords() * 2)),
+									   _mm256_srli_epi32(hx, 5));
+	__m256i wordIndex = _mm256_add_epi32(_mm256_mullo_epi32(game, _mm256_set1_epi32(boardWords() * 2)), rowHalf);
+	__m256i word = _mm256_mask_i32gather_epi32(zero, (const int *)obstacleWords.data(), wordIndex, live, 4);
+	__m256i onObstacle = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(hx, _mm256_set1_epi32(31))), one);
+
+	/* the head's own cell counts once more, see Snake::onSnakeBody */
+	__m256i head = _mm256_loadu_si256((const __m256i *)&headCell[first]);
+	__m256i threshold = _mm256_and_si256(_mm256_cmpeq_epi32(cell, head), one);
+	__m256i onBody = _mm256_cmpgt_epi32(count, threshold);
+	__m256i flags = _mm256_blendv_epi8(_mm256_slli_epi32(onObstacle, 1), one, onBody);
+	_mm256_storeu_si256((__m256i *)&hitFlags[first], _mm256_and_si256(flags, live));
+}
+#else
+void LockstepGames::moveHeadsAvx2(int first) {
+	moveHeadsScalar(first);
+}
+#endif
+
+int LockstepGames::applyMove(int i) {
+	tick[i]++;
+	int cell = newCell[i];
+
+	/* what GameState::didDead does */
+	int events = EV_NONE;
+	if (hitFlags[i] == HIT_BODY) {
+		events = EV_HIT_BODY;
+	} else if (hitFlags[i] == HIT_OBSTACLE) {
+		events = EV_HIT_OBSTACLE;
+	}
+	if (events != EV_NONE) {
+		if (!stillInObstacles[i]) {
+			stillInObstacles[i] = 1;
+			lives[i]--;
+			events |= EV_LOST_LIFE;
+		}
+		if (lives[i] == 0) {
+			over[i] = 1;
+			events |= EV_GAMEOVER;
+		}
+	} else {
+		stillInObstacles[i] = 0;
+	}
+
+	/* what GameState::didEatFruit does */
+	bool needFruit = false;
+	if (cell == fruitCell[i]) {
+		if (fruitAttr[i] == NORMAL_FRT) {
+			score[i]++;
+			events |= EV_ATE_NORMAL;
+			needFruit = true;
+		} else if (fruitAttr[i] == HEART_FRT) {
+			if (lives[i] < MAX_LIVES) lives[i]++;
+			events |= EV_ATE_HEART;
+			needFruit = true;
+		} else {
+			if (lives[i] > 0) lives[i]--;
+			events |= EV_ATE_EVIL | EV_LOST_LIFE;
+			if (lives[i] == 0) {
+				over[i] = 1;
+				events |= EV_GAMEOVER;
+			} else {
+				needFruit = true;
+			}
+		}
+	} else if (fruitAttr[i] != NORMAL_FRT && tick[i] - lastSpecialFruitTick[i] > SPECIAL_FRUIT_TICKS) {
+		needFruit = true;
+		events |= EV_FRUIT_EXPIRED;
+	}
+
+	/* move the body */
+	if (!(events & EV_ATE_NORMAL)) {
+		popTail(i);
+	}
+	alongY[i] = (cell % BoardWidth == headX[i]);
+	pushHead(i, cell % BoardWidth, cell / BoardWidth);
+
+	/* the new fruit, what GameState::regenerateFruit does */
+	if (needFruit) {
+		const uint64_t *obstacleBits = &obstacleWords[(size_t)i * boardWords()];
+		int fruit = randomClearCell(occupied[i].getWords(), obstacleBits, rngs[i], clearCells[i]);
+		if (fruit < 0) {
+			over[i] = 1;
+			won[i] = 1;
+			events |= EV_GAMEWON | EV_GAMEOVER;
+		} else {
+			Fruit kind;
+			kind.generateNewFruit(fruit % BoardWidth, fruit / BoardWidth, rngs[i]);
+			fruitCell[i] = fruit;
+			fruitAttr[i] = kind.getAttribute();
+			if (fruitAttr[i] == HEART_FRT || fruitAttr[i] == EVIL_FRT) {
+				lastSpecialFruitTick[i] = tick[i];
+			}
+		}
+	}
+	return events;
+}
+
+void LockstepGames::step(const int inputs[], int events[]) {
+	memcpy(input.data(), inputs, numGames * sizeof(int));
+	bool avx2 = usingAvx2() && bodyCount.size() <= INT_MAX; // the gathers take 32 bit indices
+
+	for (int first = 0; first < numPadded; first += LOCKSTEP_LANES) {
+		if (avx2) {
+			moveHeadsAvx2(first);
+		} else {
+			moveHeadsScalar(first);
+		}
+
+		int last = (first + LOCKSTEP_LANES < numGames) ? first + LOCKSTEP_LANES : numGames;
+		for (int i = first; i < last; i++) {
+			events[i] = over[i] ? EV_NONE : applyMove(i);
+		}
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ * Lockstep engine for Snake: thousands of games advanced together, for bulk evaluation.
+ *
+ * Each field of the games (head, direction, fruit cell, lives, ...) is an array over the games, so
+ * the per-move work that every game does (turning, the wrapping head step, the body and obstacle
+ * collision lookups and the fruit test) runs eight games per instruction with AVX2 where the CPU has
+ * it, gathering the occupancy of the new head cells from every game's grids at once. What follows a
+ * move (growing, dying, placing a fruit) is then applied game by game in exactly the order
+ * GameState::step does it, with the same Rng calls, so every game stays identical to a GameState
+ * with the same seed and inputs; snake-sim --lockstep=N --check compares them tick by tick.
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "game.h"
+
+using namespace std;
+
+
+/* Games are processed in groups of this many, the width of an AVX2 register in 32 bit lanes */
+#define LOCKSTEP_LANES 8
+
+/* 16 bit counts in a game's body grid, with room for a 32 bit gather at the last cell */
+#define COUNT_STRIDE (BoardWidth * BoardHeight + 2)
+
+/*
+ * Class for many games advanced in lockstep
+ */
+class LockstepGames {
+public:
+	/* Create numGames games on the current board, game i reset with seed + i */
+	LockstepGames(int numGames, uint64_t seed);
+
+	/* Method to start a new game in slot i, carrying on with its random numbers like GameState::reset() */
+	void reset(int i);
+
+	/* Method to start a new game in slot i from a seed */
+	void reset(int i, uint64_t seed);
+
+	/*
+	 * Method to apply inputs[i] (a direction or NO_INPUT) to every game and move every snake one cell,
+	 *	events[i] gets the EV_* flags GameState::step would return. Finished games do not move.
+	 */
+	void step(const int inputs[], int events[]);
+
+	/* Method to check if the vector kernel is used, it needs AVX2 */
+	static bool usingAvx2();
+
+	int getNumGames() const {
+		return numGames;
+	}
+
+	bool isGameOver(int i) const {
+		return over[i];
+	}
+
+	bool isGameWon(int i) const {
+		return won[i];
+	}
+
+	unsigned int getScore(int i) const {
+		return score[i];
+	}
+
+	unsigned int getNumOfLives(int i) const {
+		return lives[i];
+	}
+
+	unsigned long getTick(int i) const {
+		return tick[i];
+	}
+
+	int getHeadX(int i) const {
+		return headX[i];
+	}
+
+	int getHeadY(int i) const {
+		return headY[i];
+	}
+
+	int getFruitX(int i) const {
+		return fruitCell[i] % BoardWidth;
+	}
+
+	int getFruitY(int i) const {
+		return fruitCell[i] / BoardWidth;
+	}
+
+	int getFruitAttribute(int i) const {
+		return fruitAttr[i];
+	}
+
+	int getLength(int i) const {
+		return length[i];
+	}
+
+	/* Method to get the cell index of block j of game i's body, 0 is the head */
+	int getBodyCell(int i, int j) const {
+		return rings[i][(ringHead[i] - j) & (rings[i].size() - 1)];
+	}
+
+private:
+	/* Methods for the per-group kernels: turn, step the head and look up what it runs into */
+	void moveHeadsScalar(int first);
+	void moveHeadsAvx2(int first);
+
+	/* Method to finish the move of game i the way GameState::step does, returns the EV_* flags */
+	int applyMove(int i);
+
+	void pushHead(int i, int x, int y);
+	void popTail(int i);
+
+	/* Method to check if a cell is covered by game i's obstacles */
+	bool onObstacles(int i, int x, int y) const {
+		return (obstacleWords[(size_t)i * boardWords() + y * boardRowWords() + (x >> 6)] >> (x & 63)) & 1;
+	}
+
+	int numGames;
+	int numPadded; // numGames rounded up to LOCKSTEP_LANES, the extra games are always over
+
+	/* per game fields, 32 bit each so a group loads into one register */
+	vector<int32_t> input;
+	vector<int32_t> over;
+	vector<int32_t> won;
+	vector<int32_t> xSpeed;
+	vector<int32_t> ySpeed;
+	vector<int32_t> alongY;    // 1 when the head and the block behind it share a column, see Snake::changeDirection
+	vector<int32_t> headX;
+	vector<int32_t> headY;
+	vector<int32_t> headCell;
+	vector<int32_t> fruitCell;
+	vector<int32_t> fruitAttr;
+	vector<int32_t> lives;
+	vector<int32_t> score;
+	vector<int32_t> stillInObstacles;
+	vector<int32_t> length;
+	vector<int32_t> ringHead;  // where the head is in the game's ring
+	vector<int32_t> newCell;   // what the kernels found for the move being made
+	vector<int32_t> hitFlags;  // 1 hit the body, 2 hit an obstacle
+	vector<unsigned long> tick;
+	vector<unsigned long> lastSpecialFruitTick;
+	vector<Rng> rngs;
+
+	/* per game grids, one after the other */
+	vector<uint64_t> obstacleWords; // the words of each game's obstacle Bitboard, boardWords() per game
+	vector<Bitboard> occupied;      // the cells with a block of the snake
+	vector<uint16_t> bodyCount;     // COUNT_STRIDE per game
+	vector<vector<uint32_t> > rings; // the body cells, a power of two long, growing when full
+	vector<ClearCounts> clearCells;  // the cells clear of the body and obstacles, for placing fruit
+};
+
+#endif
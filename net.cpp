@@ -0,0 +1,859 @@
+/*
+ * The game server, its clients and their protocol, see net.h
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "net.h"
+#include "replay.h"
+
+
+NetAddress::NetAddress() {
+	memset(&addr, 0, sizeof(addr));
+	length = 0;
+}
+
+bool NetAddress::parse(const char *text) {
+	memset(&addr, 0, sizeof(addr));
+	if (strchr(text, '/')) {
+		sockaddr_un *un = (sockaddr_un *)&addr;
+		if (strlen(text) >= sizeof(un->sun_path)) return false;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, text);
+		length = offsetof(sockaddr_un, sun_path) + strlen(text) + 1;
+		return true;
+	}
+
+	char *end;
+	long port = strtol(text, &end, 10);
+	if (*text == '\0' || *end != '\0' || port <= 0 || port > 65535) return false;
+	sockaddr_in *in = (sockaddr_in *)&addr;
+	in->sin_family = AF_INET;
+	in->sin_port = htons((uint16_t)port);
+	in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	length = sizeof(sockaddr_in);
+	return true;
+}
+
+string NetAddress::toString() const {
+	if (addr.ss_family == AF_UNIX) return string(((const sockaddr_un *)&addr)->sun_path);
+
+	const sockaddr_in *in = (const sockaddr_in *)&addr;
+	char text[32];
+	snprintf(text, sizeof(text), "127.0.0.1:%d", ntohs(in->sin_port));
+	return string(text);
+}
+
+int openDatagramSocket(const NetAddress &address, bool bindIt) {
+	int fd = socket(address.addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	int result;
+	if (bindIt) {
+		if (address.addr.ss_family == AF_UNIX) unlink(((const sockaddr_un *)&address.addr)->sun_path); // left by an earlier run
+		result = bind(fd, (const sockaddr *)&address.addr, address.length);
+
+		/* the server sends a snapshot to every client every tick, let a few ticks of them queue up */
+		int bufferSize = 1 << 20;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+	} else if (address.addr.ss_family == AF_UNIX) {
+		sockaddr_un any;
+		any.sun_family = AF_UNIX;
+		result = bind(fd, (const sockaddr *)&any, sizeof(sa_family_t)); // autobind, so the server can answer
+	} else {
+		sockaddr_in any;
+		memset(&any, 0, sizeof(any));
+		any.sin_family = AF_INET;
+		any.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		result = bind(fd, (const sockaddr *)&any, sizeof(any));
+	}
+	if (result < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+unsigned long threadCpuNs() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Function to check that a command from the wire is one applyCommand() takes
+ */
+static bool validCommand(int command) {
+	return (command >= UP && command <= LEFT) || command == CMD_RESET || command == CMD_REVIVE;
+}
+
+/*
+ * Function to get what a snapshot says is on a cell of a game, the body wins over an obstacle it is in
+ */
+static int cellValue(const GameState &game, int x, int y) {
+	if (game.getSnake().onSnake(x, y)) return NET_BODY;
+	if (game.getObstacles().onObstacles(x, y)) return NET_OBSTACLE;
+	return NET_EMPTY;
+}
+
+
+NetClient::NetClient(GameState &game) : game(game), gameTick(0), confirmedTick(0), serverTick(0), nextSeq(1),
+										confirmedSeq(0), mispredicted(false), unsent(false), fd(-1), room(-1), role(NET_SPECTATOR),
+										tickInterval(0), dropRate(0.0), snapshots(0), keyframes(0), dropped(0),
+										bytesReceived(0), bytesSent(0), lateInputs(0), corrections(0), desyncs(0) {
+}
+
+NetClient::~NetClient() {
+	if (fd >= 0) close(fd);
+}
+
+bool NetClient::join(const char *address, int room, int timeoutMs, string &error) {
+	if (!server.parse(address)) {
+		error = string("Not a port or socket path: ") + address;
+		return false;
+	}
+	fd = openDatagramSocket(server, false);
+	if (fd < 0 || connect(fd, (const sockaddr *)&server.addr, server.length) < 0) {
+		error = string("Cannot open a socket: ") + strerror(errno);
+		return false;
+	}
+
+	/* ask again every 100 ms, a datagram can get lost */
+	for (int waited = 0; waited < timeoutMs; waited += 100) {
+		out.clear();
+		out.writeByte(MSG_JOIN);
+		out.writeByte(NET_VERSION);
+		out.writeVarint(room);
+		::send(fd, out.getData(), out.getSize(), 0);
+
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		int size = recv(fd, in, sizeof(in), 0);
+		if (size <= 0) continue;
+		PacketReader reader(in, size);
+		int type = reader.readByte();
+		if (type == MSG_REFUSED) {
+			error = "The server refused to join, wrong room or version";
+			return false;
+		}
+		if (type != MSG_WELCOME || reader.readByte() != NET_VERSION) continue;
+
+		int welcomeRoom = reader.readVarint();
+		int welcomeRole = reader.readByte();
+		int width = reader.readVarint();
+		int height = reader.readVarint();
+		uint64_t seed = reader.readU64();
+		unsigned long startTick = reader.readVarint();
+		unsigned long tick = reader.readVarint();
+		unsigned long interval = reader.readVarint();
+		if (reader.isBad() || welcomeRoom != room) continue;
+		if (!setBoardSize(width, height)) {
+			error = "The server's board size is out of range";
+			return false;
+		}
+
+		this->room = room;
+		role = welcomeRole;
+		tickInterval = interval;
+		view.cells.assign(BoardWidth * BoardHeight, NET_EMPTY);
+		dropRng.reseed(seed ^ (uint64_t)fd);
+		if (role == NET_PLAYER) {
+			confirmed.reset(seed);
+			game.reset(seed);
+			confirmedTick = startTick;
+			gameTick = startTick;
+		}
+		serverTick = tick;
+		return true;
+	}
+	error = string("No answer from ") + server.toString();
+	return false;
+}
+
+void NetClient::leave() {
+	if (fd < 0) return;
+	out.clear();
+	out.writeByte(MSG_LEAVE);
+	::send(fd, out.getData(), out.getSize(), 0);
+}
+
+bool NetClient::input(int command) {
+	if (role != NET_PLAYER || pending.size() >= NET_MAX_PENDING) return false;
+
+	NetInput input;
+	input.seq = nextSeq++;
+	input.tick = gameTick;
+	input.command = command;
+	input.sentNs = nowNs();
+	pending.push_back(input);
+	applyCommand(game, command);
+	sendInputs();
+	return true;
+}
+
+int NetClient::tick() {
+	if (unsent) sendInputs();
+	if (role != NET_PLAYER) return EV_NONE;
+
+	/* one move a tick, two to catch up with the server and none to let it catch up */
+	unsigned long target = serverTick + NET_LEAD_TICKS;
+	int steps = 1;
+	if (gameTick + 1 < target) {
+		steps = 2;
+	} else if (gameTick > target) {
+		steps = 0;
+	}
+
+	int events = EV_NONE;
+	for (int i = 0; i < steps; i++) {
+		events |= game.step(NO_INPUT);
+		gameTick++;
+	}
+	return events;
+}
+
+bool NetClient::receive() {
+	if (unsent) sendInputs();
+	bool changed = false;
+	while (true) {
+		int size = recv(fd, in, sizeof(in), 0);
+		if (size < 0) break;
+		bytesReceived += size;
+
+		PacketReader reader(in, size);
+		if (reader.readByte() != MSG_SNAPSHOT) continue;
+		if (dropRate > 0.0 && (dropRng.next() >> 11) * (1.0 / 9007199254740992.0) < dropRate) {
+			dropped++;
+			continue;
+		}
+		if (handleSnapshot(reader)) changed = true;
+	}
+	return changed;
+}
+
+void NetClient::sendInputs() {
+	out.clear();
+	out.writeByte(MSG_INPUT);
+	out.writeVarint(view.tick);
+	out.writeVarint(confirmedSeq);
+	out.writeVarint(pending.empty() ? 0 : pending[0].seq);
+	out.writeVarint(pending.size());
+	for (size_t i = 0; i < pending.size(); i++) {
+		out.writeVarint(pending[i].tick);
+		out.writeByte(pending[i].command);
+	}
+	int sent = ::send(fd, out.getData(), out.getSize(), 0);
+	if (sent < 0 && errno == EAGAIN) {
+		/* a Unix socket only queues a few datagrams (net.unix.max_dgram_qlen), give the server a moment to read them */
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 1) > 0) sent = ::send(fd, out.getData(), out.getSize(), 0);
+	}
+	if (sent > 0) {
+		bytesSent += sent;
+		unsent = false;
+	} else {
+		unsent = true; // try again on the next tick or snapshot
+	}
+}
+
+bool NetClient::handleSnapshot(PacketReader &reader) {
+	unsigned long tick = reader.readVarint();
+	unsigned long base = reader.readVarint();
+	int flags = reader.readByte();
+	unsigned int score = reader.readVarint();
+	unsigned int lives = reader.readVarint();
+	int fruitX = reader.readVarint();
+	int fruitY = reader.readVarint();
+	int fruitAttribute = reader.readByte();
+	int headX = reader.readVarint();
+	int headY = reader.readVarint();
+	uint64_t hash = reader.readU64();
+
+	int numInputs = reader.readVarint();
+	uint32_t firstSeq = reader.readVarint();
+	if (reader.isBad() || numInputs > NET_MAX_PACKET) return false;
+	/* an old one, or one built on a snapshot this client never got */
+	if (tick <= view.tick || (base != 0 && base > view.tick)) {
+		sendInputs();
+		return false;
+	}
+
+	for (int i = 0; i < numInputs; i++) {
+		uint32_t seq = firstSeq + i;
+		unsigned long inputTick = reader.readVarint();
+		int command = reader.readByte();
+		if (reader.isBad() || seq != confirmedSeq + 1) continue; // known already
+
+		if (!pending.empty() && pending[0].seq == seq) {
+			if (pending[0].tick != inputTick) {
+				lateInputs++;
+				mispredicted = true;
+			}
+			confirmTime.record(nowNs() - pending[0].sentNs);
+			pending.erase(pending.begin());
+		}
+		NetInput input;
+		input.seq = seq;
+		input.tick = inputTick;
+		input.command = command;
+		input.sentNs = 0;
+		toApply.push_back(input);
+		confirmedSeq = seq;
+	}
+
+	/* the cells go straight into the view: gaps from the previous cell and what is on it */
+	int numCells = reader.readVarint();
+	if (base == 0) {
+		fill(view.cells.begin(), view.cells.end(), NET_EMPTY);
+		keyframes++;
+	}
+	int cell = -1;
+	for (int i = 0; i < numCells; i++) {
+		uint64_t value = reader.readVarint();
+		cell += (int)(value >> NET_CELL_BITS) + 1;
+		if (reader.isBad() || cell >= (int)view.cells.size()) break;
+		view.cells[cell] = value & ((1 << NET_CELL_BITS) - 1);
+	}
+	if (reader.isBad()) {
+		view.tick = 0; // ask for a keyframe
+		sendInputs();
+		return false;
+	}
+	view.tick = tick;
+	view.flags = flags;
+	view.score = score;
+	view.lives = lives;
+	view.fruitX = fruitX;
+	view.fruitY = fruitY;
+	view.fruitAttribute = fruitAttribute;
+	view.headX = headX;
+	view.headY = headY;
+	snapshots++;
+	if (tick > serverTick) serverTick = tick;
+
+	bool changed = false;
+	if (role == NET_PLAYER) {
+		advanceConfirmed(tick);
+		if (stateHash(confirmed) != hash) desyncs++;
+
+		/* an input the server has not applied by now is late, guess it lands on this tick */
+		for (size_t i = 0; i < pending.size(); i++) {
+			if (pending[i].tick < confirmedTick) {
+				pending[i].tick = confirmedTick;
+				lateInputs++;
+				mispredicted = true;
+			}
+		}
+		if (gameTick < confirmedTick) {
+			if (mispredicted || !pending.empty()) {
+				mispredicted = true;
+			} else {
+				/* fell behind the server with nothing to predict, the moves to catch up are the server's */
+				while (gameTick < confirmedTick) {
+					game.step(NO_INPUT);
+					gameTick++;
+				}
+			}
+		}
+		if (mispredicted) {
+			changed = predictAgain();
+			mispredicted = false;
+		}
+	}
+	sendInputs();
+	return changed;
+}
+
+void NetClient::advanceConfirmed(unsigned long toTick) {
+	size_t next = 0;
+	while (confirmedTick < toTick) {
+		while (next < toApply.size() && toApply[next].tick <= confirmedTick) {
+			applyCommand(confirmed, toApply[next++].command);
+		}
+		confirmed.step(NO_INPUT);
+		confirmedTick++;
+	}
+	toApply.erase(toApply.begin(), toApply.begin() + next);
+	confirmed.clearChanges();
+}
+
+bool NetClient::predictAgain() {
+	scratch = confirmed;
+	unsigned long target = max(gameTick, confirmedTick);
+	unsigned long t = confirmedTick;
+	size_t next = 0;
+	while (true) {
+		while (next < pending.size() && pending[next].tick <= t) {
+			applyCommand(scratch, pending[next++].command);
+		}
+		if (t >= target) break;
+		scratch.step(NO_INPUT);
+		t++;
+	}
+
+	if (target == gameTick && stateHash(scratch) == stateHash(game)) return false;
+	game = scratch;
+	gameTick = target;
+	corrections++;
+	return true;
+}
+
+
+NetServer::NetServer(int numRooms, uint64_t seed, unsigned long tickInterval) : rooms(numRooms),
+		tickInterval(tickInterval), tick(0), fd(-1), epollFd(-1), timerFd(-1), stopFd(-1), sendErrors(0) {
+	for (int r = 0; r < numRooms; r++) {
+		NetRoom &room = rooms[r];
+		room.gameSeed = seed + r;
+		room.nextSeed = seed + r;
+		room.player = -1;
+		room.tick = 0;
+		room.startTick = 0;
+		for (int i = 0; i < NET_HISTORY; i++) {
+			room.historyAll[i] = true;
+		}
+		room.nextSeq = 1;
+		room.ticks = 0;
+		room.bytesSent = 0;
+		room.bytesReceived = 0;
+		room.snapshots = 0;
+		room.keyframes = 0;
+		room.cpuNs = 0;
+	}
+}
+
+NetServer::~NetServer() {
+	if (fd >= 0) close(fd);
+	if (epollFd >= 0) close(epollFd);
+	if (timerFd >= 0) close(timerFd);
+	if (stopFd >= 0) close(stopFd);
+}
+
+bool NetServer::listen(const char *address) {
+	NetAddress local;
+	if (!local.parse(address)) return false;
+	fd = openDatagramSocket(local, true);
+	if (fd < 0) return false;
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epollFd < 0 || timerFd < 0 || stopFd < 0) return false;
+
+	itimerspec spec;
+	spec.it_value.tv_sec = tickInterval / 1000000;
+	spec.it_value.tv_nsec = (tickInterval % 1000000) * 1000;
+	spec.it_interval = spec.it_value;
+	timerfd_settime(timerFd, 0, &spec, NULL);
+
+	int fds[3] = { fd, timerFd, stopFd };
+	for (int i = 0; i < 3; i++) {
+		epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = fds[i];
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &event) < 0) return false;
+	}
+	return true;
+}
+
+void NetServer::stop() {
+	uint64_t one = 1;
+	if (write(stopFd, &one, sizeof(one)) < 0) return;
+}
+
+void NetServer::run(unsigned long ticks, unsigned long reportEvery) {
+	unsigned long reportTick = tick;
+	unsigned long reportBytes = 0;
+	unsigned long reportCpu = threadCpuNs();
+	unsigned long reportWall = nowNs();
+	unsigned long reportRoomTicks = 0;
+
+	epoll_event events[8];
+	while (ticks == 0 || tick < ticks) {
+		int n = epoll_wait(epollFd, events, 8, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+
+		for (int e = 0; e < n; e++) {
+			int ready = events[e].data.fd;
+			if (ready == stopFd) return;
+
+			if (ready == fd) {
+				readPackets();
+			} else if (ready == timerFd) {
+				uint64_t due;
+				if (read(timerFd, &due, sizeof(due)) != sizeof(due)) continue;
+				if (due > NET_MAX_CATCHUP) due = NET_MAX_CATCHUP;
+				readPackets(); // the inputs that came before the deadline are in time for it
+
+				for (uint64_t i = 0; i < due && (ticks == 0 || tick < ticks); i++) {
+					tick++;
+					for (size_t r = 0; r < rooms.size(); r++) {
+						if (rooms[r].members.empty()) continue;
+						tickRoom(r);
+						/* a Unix socket only queues a few datagrams (net.unix.max_dgram_qlen), take the answers as they come */
+						readPackets();
+					}
+				}
+
+				/* the clients that went quiet */
+				unsigned long now = nowNs();
+				for (size_t p = 0; p < peers.size(); p++) {
+					if (peers[p].room >= 0 && now - peers[p].lastHeardNs > NET_TIMEOUT_MS * 1000000UL) dropPeer(p);
+				}
+
+				if (reportEvery && tick - reportTick >= reportEvery) {
+					unsigned long bytes = 0;
+					unsigned long roomTicks = 0;
+					int playing = 0;
+					int clients = 0;
+					for (size_t r = 0; r < rooms.size(); r++) {
+						bytes += rooms[r].bytesSent;
+						roomTicks += rooms[r].ticks;
+						playing += (rooms[r].player >= 0);
+						clients += rooms[r].members.size();
+					}
+					unsigned long cpu = threadCpuNs();
+					unsigned long wall = nowNs();
+					unsigned long sinceTicks = roomTicks - reportRoomTicks;
+					printf("tick %lu: %d rooms playing, %d clients, %.1f bytes a room tick, %.2f us CPU a room tick, "
+						   "server thread %.1f%% CPU\n", tick, playing, clients,
+						   sinceTicks ? (double)(bytes - reportBytes) / sinceTicks : 0.0,
+						   sinceTicks ? (cpu - reportCpu) / 1000.0 / sinceTicks : 0.0,
+						   100.0 * (cpu - reportCpu) / (wall - reportWall));
+					fflush(stdout);
+					reportTick = tick;
+					reportBytes = bytes;
+					reportCpu = cpu;
+					reportWall = wall;
+					reportRoomTicks = roomTicks;
+				}
+			}
+		}
+	}
+}
+
+void NetServer::readPackets() {
+	while (true) {
+		NetAddress from;
+		from.length = sizeof(from.addr);
+		int size = recvfrom(fd, in, sizeof(in), 0, (sockaddr *)&from.addr, &from.length);
+		if (size < 0) return;
+		handlePacket(in, size, from);
+	}
+}
+
+void NetServer::handlePacket(const uint8_t *data, int size, const NetAddress &from) {
+	unsigned long start = threadCpuNs();
+	PacketReader reader(data, size);
+	int type = reader.readByte();
+
+	if (type == MSG_JOIN) {
+		handleJoin(reader, from);
+	} else {
+		map<string, int>::iterator found = peerIndex.find(from.key());
+		if (found == peerIndex.end()) return; // not in a room, or timed out
+		NetPeer &peer = peers[found->second];
+		peer.lastHeardNs = nowNs();
+		rooms[peer.room].bytesReceived += size;
+
+		if (type == MSG_INPUT) {
+			handleInput(reader, peer);
+		} else if (type == MSG_LEAVE) {
+			dropPeer(found->second);
+		}
+	}
+
+	map<string, int>::iterator found = peerIndex.find(from.key());
+	if (found != peerIndex.end()) rooms[peers[found->second].room].cpuNs += threadCpuNs() - start;
+}
+
+void NetServer::handleJoin(PacketReader &reader, const NetAddress &from) {
+	int version = reader.readByte();
+	unsigned int r = reader.readVarint();
+	if (reader.isBad() || version != NET_VERSION || r >= rooms.size()) {
+		out.clear();
+		out.writeByte(MSG_REFUSED);
+		out.writeByte(NET_VERSION);
+		send(out, from, NULL);
+		return;
+	}
+	NetRoom &room = rooms[r];
+
+	/* a repeated join, the welcome was lost, is answered again without starting over */
+	int p;
+	map<string, int>::iterator found = peerIndex.find(from.key());
+	if (found != peerIndex.end() && peers[found->second].room == (int)r) {
+		p = found->second;
+	} else {
+		if (found != peerIndex.end()) dropPeer(found->second); // moving to another room
+
+		for (p = 0; p < (int)peers.size() && peers[p].room >= 0; p++) { }
+		if (p == (int)peers.size()) peers.push_back(NetPeer());
+		NetPeer &peer = peers[p];
+		peer.address = from;
+		peer.room = r;
+		peer.ackTick = 0;
+		peer.confirmedSeq = 0;
+		peerIndex[from.key()] = p;
+		room.members.push_back(p);
+
+		if (room.player < 0) {
+			/* a new player gets a new game, starting at the next tick */
+			peer.role = NET_PLAYER;
+			room.player = p;
+			room.gameSeed = room.nextSeed;
+			room.nextSeed += rooms.size();
+			room.game.reset(room.gameSeed);
+			room.startTick = room.tick;
+			room.queued.clear();
+			room.applied.clear();
+			room.nextSeq = 1;
+		} else {
+			peer.role = NET_SPECTATOR;
+		}
+	}
+	NetPeer &peer = peers[p];
+	peer.lastHeardNs = nowNs();
+
+	out.clear();
+	out.writeByte(MSG_WELCOME);
+	out.writeByte(NET_VERSION);
+	out.writeVarint(r);
+	out.writeByte(peer.role);
+	out.writeVarint(BoardWidth);
+	out.writeVarint(BoardHeight);
+	out.writeU64(room.gameSeed);
+	out.writeVarint(room.startTick);
+	out.writeVarint(room.tick);
+	out.writeVarint(tickInterval);
+	send(out, from, &room);
+}
+
+void NetServer::handleInput(PacketReader &reader, NetPeer &peer) {
+	NetRoom &room = rooms[peer.room];
+	unsigned long ackTick = reader.readVarint();
+	uint32_t confirmedSeq = reader.readVarint();
+	uint32_t firstSeq = reader.readVarint();
+	int count = reader.readVarint();
+	if (reader.isBad()) return;
+
+	if (ackTick == 0) {
+		peer.ackTick = 0; // it lost track and wants a keyframe
+	} else if (ackTick > peer.ackTick && ackTick <= room.tick) {
+		peer.ackTick = ackTick;
+	}
+	if (peer.role != NET_PLAYER) return;
+
+	if (confirmedSeq > peer.confirmedSeq && confirmedSeq < room.nextSeq) {
+		peer.confirmedSeq = confirmedSeq;
+		size_t known = 0;
+		while (known < room.applied.size() && room.applied[known].seq <= confirmedSeq) known++;
+		room.applied.erase(room.applied.begin(), room.applied.begin() + known);
+	}
+
+	/* every message repeats the inputs not confirmed yet, take the ones not seen before in order */
+	for (int i = 0; i < count; i++) {
+		uint32_t seq = firstSeq + i;
+		unsigned long inputTick = reader.readVarint();
+		int command = reader.readByte();
+		if (reader.isBad()) return;
+		if (seq != room.nextSeq || !validCommand(command)) continue;
+
+		/* at the tick the client gave it when that is still to come, and never before an earlier input */
+		NetInput input;
+		input.seq = seq;
+		input.tick = min(max(inputTick, room.tick), room.tick + NET_MAX_EARLY);
+		if (!room.queued.empty()) input.tick = max(input.tick, room.queued.back().tick);
+		input.command = command;
+		input.sentNs = 0;
+		room.queued.push_back(input);
+		room.nextSeq++;
+	}
+}
+
+void NetServer::dropPeer(int p) {
+	NetPeer &peer = peers[p];
+	NetRoom &room = rooms[peer.room];
+	room.members.erase(find(room.members.begin(), room.members.end(), p));
+	if (room.player == p) {
+		room.player = -1;
+		room.queued.clear();
+		room.applied.clear();
+	}
+	peerIndex.erase(peer.address.key());
+	peer.room = -1;
+}
+
+void NetServer::tickRoom(int r) {
+	unsigned long start = threadCpuNs();
+	NetRoom &room = rooms[r];
+
+	if (room.player >= 0) {
+		size_t next = 0;
+		while (next < room.queued.size() && room.queued[next].tick <= room.tick) {
+			NetInput input = room.queued[next++];
+			applyCommand(room.game, input.command);
+			input.tick = room.tick;
+			room.applied.push_back(input);
+		}
+		room.queued.erase(room.queued.begin(), room.queued.begin() + next);
+		room.game.step(NO_INPUT);
+	}
+	room.tick++;
+	room.ticks++;
+
+	int slot = room.tick % NET_HISTORY;
+	room.history[slot].clear();
+	room.historyAll[slot] = room.game.allCellsChanged();
+	if (!room.historyAll[slot]) {
+		for (int i = 0; i < room.game.getNumChangedCells(); i++) {
+			room.history[slot].push_back(room.game.getChangedCell(i));
+		}
+	}
+	room.game.clearChanges();
+
+	for (size_t m = 0; m < room.members.size(); m++) {
+		sendSnapshot(room, peers[room.members[m]]);
+	}
+	room.cpuNs += threadCpuNs() - start;
+}
+
+bool NetServer::collectDelta(const NetRoom &room, const NetPeer &peer, vector<int> &cells) {
+	if (peer.ackTick == 0 || room.tick - peer.ackTick >= NET_HISTORY) return false;
+
+	cells.clear();
+	for (unsigned long t = peer.ackTick + 1; t <= room.tick; t++) {
+		int slot = t % NET_HISTORY;
+		if (room.historyAll[slot]) return false;
+		cells.insert(cells.end(), room.history[slot].begin(), room.history[slot].end());
+	}
+	sort(cells.begin(), cells.end());
+	cells.erase(unique(cells.begin(), cells.end()), cells.end());
+	return true;
+}
+
+void NetServer::sendSnapshot(NetRoom &room, NetPeer &peer) {
+	const GameState &game = room.game;
+	bool keyframe = !collectDelta(room, peer, delta);
+
+	out.clear();
+	out.writeByte(MSG_SNAPSHOT);
+	out.writeVarint(room.tick);
+	out.writeVarint(keyframe ? 0 : peer.ackTick);
+	out.writeByte((game.isGameOver() ? SNAP_GAMEOVER : 0) | (game.isGameWon() ? SNAP_GAMEWON : 0));
+	out.writeVarint(game.getScore());
+	out.writeVarint(game.getNumOfLives());
+	out.writeVarint(game.getFruit().getX());
+	out.writeVarint(game.getFruit().getY());
+	out.writeByte(game.getFruit().getAttribute());
+	out.writeVarint(game.getSnake().getHeadX());
+	out.writeVarint(game.getSnake().getHeadY());
+	out.writeU64(stateHash(game));
+
+	/* the player gets the inputs applied that it has not confirmed, a spectator none */
+	size_t first = room.applied.size();
+	if (peer.role == NET_PLAYER) {
+		first = 0;
+		while (first < room.applied.size() && room.applied[first].seq <= peer.confirmedSeq) first++;
+	}
+	out.writeVarint(room.applied.size() - first);
+	out.writeVarint(first < room.applied.size() ? room.applied[first].seq : 0);
+	for (size_t i = first; i < room.applied.size(); i++) {
+		out.writeVarint(room.applied[i].tick);
+		out.writeByte(room.applied[i].command);
+	}
+
+	int cell = -1;
+	if (keyframe) {
+		/* every cell with the body or an obstacle on it, in order */
+		const uint64_t *body = game.getSnake().getOccupied().getWords();
+		const uint64_t *covered = game.getObstacles().getCovered().getWords();
+		const int rowWords = boardRowWords();
+		int numCells = 0;
+		for (int w = 0; w < boardWords(); w++) {
+			numCells += countBits(body[w] | covered[w]);
+		}
+		out.writeVarint(numCells);
+		for (int y = 0; y < BoardHeight; y++) {
+			for (int w = 0; w < rowWords; w++) {
+				uint64_t bits = body[y * rowWords + w] | covered[y * rowWords + w];
+				while (bits) {
+					int x = w * 64 + __builtin_ctzll(bits);
+					int next = cellIndex(x, y);
+					out.writeVarint(((uint64_t)(next - cell - 1) << NET_CELL_BITS) | cellValue(game, x, y));
+					cell = next;
+					bits &= bits - 1;
+				}
+			}
+		}
+		room.keyframes++;
+	} else {
+		out.writeVarint(delta.size());
+		for (size_t i = 0; i < delta.size(); i++) {
+			out.writeVarint(((uint64_t)(delta[i] - cell - 1) << NET_CELL_BITS) |
+							cellValue(game, delta[i] % BoardWidth, delta[i] / BoardWidth));
+			cell = delta[i];
+		}
+	}
+
+	if (out.isOverflow()) {
+		sendErrors++;
+		return;
+	}
+	send(out, peer.address, &room);
+	room.snapshots++;
+}
+
+void NetServer::send(const PacketWriter &packet, const NetAddress &to, NetRoom *room) {
+	if (sendto(fd, packet.getData(), packet.getSize(), 0, (const sockaddr *)&to.addr, to.length) < 0) {
+		sendErrors++; // the socket buffer is full or the client is gone, the next snapshot makes up for it
+		return;
+	}
+	if (room) room->bytesSent += packet.getSize();
+}
+
+void NetServer::printReport(FILE *out) const {
+	fprintf(out, "%6s %8s %8s %12s %12s %10s %12s\n", "room", "clients", "ticks", "bytes/tick", "in bytes/tick",
+			"keyframes", "CPU us/tick");
+	unsigned long ticks = 0;
+	unsigned long bytesSent = 0;
+	unsigned long bytesReceived = 0;
+	unsigned long cpuNs = 0;
+	for (size_t r = 0; r < rooms.size(); r++) {
+		const NetRoom &room = rooms[r];
+		if (room.ticks == 0) continue;
+		fprintf(out, "%6d %8d %8lu %12.1f %12.1f %10lu %12.2f\n", (int)r, (int)room.members.size(), room.ticks,
+				(double)room.bytesSent / room.ticks, (double)room.bytesReceived / room.ticks, room.keyframes,
+				room.cpuNs / 1000.0 / room.ticks);
+		ticks += room.ticks;
+		bytesSent += room.bytesSent;
+		bytesReceived += room.bytesReceived;
+		cpuNs += room.cpuNs;
+	}
+	if (ticks) {
+		fprintf(out, "%6s %8s %8lu %12.1f %12.1f %10s %12.2f\n", "all", "", ticks, (double)bytesSent / ticks,
+				(double)bytesReceived / ticks, "", cpuNs / 1000.0 / ticks);
+	}
+	if (sendErrors) fprintf(out, "%lu datagrams could not be sent\n", sendErrors);
+}
@@ -0,0 +1,555 @@
+/*
+ * Network play for Snake: an authoritative server runs the games and the clients predict their own.
+ *
+ * A NetServer has a number of rooms, each one GameState stepped on the server's clock, and talks to
+ * its clients over one datagram socket, UDP on the loopback interface or a Unix socket, from a single
+ * thread that waits in epoll. The first client in a room plays in it, the others watch. After every
+ * tick each client of the room gets a snapshot: the cells that changed since the last snapshot the
+ * client acknowledged (from the engine's changed-cell lists, kept for NET_HISTORY ticks), the fruit,
+ * the head, score and lives, and the inputs the server applied. A client with no recent snapshot gets
+ * every taken cell instead (a keyframe), so a lost packet only makes the next one a little bigger.
+ *
+ * The engine plays the same game for the same seed and inputs, so the player's NetClient runs the
+ * room's game too, NET_LEAD_TICKS ahead of the server, and applies its own inputs at once. Each input goes to
+ * the server with the tick it was given at, and the server applies it at that tick when it arrives in
+ * time, or at once when it is late, and says which tick it used. The client keeps the game as of the
+ * last snapshot with the confirmed inputs, checks it against the snapshot's state hash, and only when
+ * an input landed on another tick than predicted plays the unconfirmed inputs on top of it again.
+ *
+ * Every message is one datagram: a type byte followed by varints (LEB128, like the recordings).
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "game.h"
+#include "stats.h"
+
+using namespace std;
+
+
+/*
+ * Macros for the protocol limits
+ */
+#define NET_VERSION 1
+#define NET_MAX_PACKET 65507  // the biggest UDP datagram
+#define NET_MAX_CELLS 60000   // the biggest board a keyframe always fits in one packet for
+#define NET_HISTORY 64        // ticks of changed cells a room keeps for the deltas
+#define NET_LEAD_TICKS 2      // how far the player's client runs ahead of the server, for its inputs to be in time
+#define NET_MAX_EARLY 8       // ticks ahead of the server an input is still taken at its own tick
+#define NET_MAX_PENDING 64    // unconfirmed inputs a client keeps, it ignores more
+#define NET_TIMEOUT_MS 5000   // a client that sent nothing for this long has left
+#define NET_MAX_CATCHUP 5     // server ticks run for one wakeup when the server fell behind
+#define DEFAULT_NET_PORT 7777
+
+/*
+ * Macros for the message types
+ */
+#define MSG_JOIN 'J'     // client: version, room
+#define MSG_INPUT 'I'    // client: acknowledged tick, confirmed input, the unconfirmed inputs
+#define MSG_LEAVE 'L'    // client
+#define MSG_WELCOME 'W'  // server: version, room, role, board size, seed, start tick, tick, tick interval
+#define MSG_REFUSED 'R'  // server: version
+#define MSG_SNAPSHOT 'S' // server: tick, base tick, state, applied inputs, cells
+
+/*
+ * Macros for the roles of a client in a room
+ */
+#define NET_PLAYER 0
+#define NET_SPECTATOR 1
+
+/*
+ * Macros for what a snapshot says is on a cell, the fruit and head are sent on their own
+ */
+#define NET_EMPTY 0
+#define NET_BODY 1
+#define NET_OBSTACLE 2
+#define NET_CELL_BITS 2
+
+/*
+ * Macros for the snapshot flags
+ */
+#define SNAP_GAMEOVER 0x1
+#define SNAP_GAMEWON 0x2
+
+/*
+ * Class to write a message into a buffer of NET_MAX_PACKET bytes
+ */
+class PacketWriter {
+public:
+	PacketWriter() {
+		clear();
+	}
+
+	void clear() {
+		size = 0;
+		overflow = false;
+	}
+
+	void writeByte(int value) {
+		if (size < NET_MAX_PACKET) {
+			data[size++] = (uint8_t)value;
+		} else {
+			overflow = true;
+		}
+	}
+
+	void writeVarint(uint64_t value) {
+		while (value >= 0x80) {
+			writeByte((int)(value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		writeByte((int)value);
+	}
+
+	/* Method to write 8 little endian bytes */
+	void writeU64(uint64_t value) {
+		for (int i = 0; i < 8; i++) {
+			writeByte((int)((value >> (i * 8)) & 0xff));
+		}
+	}
+
+	const uint8_t *getData() const {
+		return data;
+	}
+
+	int getSize() const {
+		return size;
+	}
+
+	/* The message did not fit and must not be sent */
+	bool isOverflow() const {
+		return overflow;
+	}
+
+private:
+	uint8_t data[NET_MAX_PACKET];
+	int size;
+	bool overflow;
+};
+
+/*
+ * Class to read a message, reading past the end gives zeros and marks it bad
+ */
+class PacketReader {
+public:
+	PacketReader(const uint8_t *data, int size) : data(data), size(size), pos(0), bad(false) { }
+
+	int readByte() {
+		if (pos >= size) {
+			bad = true;
+			return 0;
+		}
+		return data[pos++];
+	}
+
+	uint64_t readVarint() {
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			int c = readByte();
+			value |= (uint64_t)(c & 0x7f) << shift;
+			if (!(c & 0x80)) return value;
+		}
+		bad = true;
+		return 0;
+	}
+
+	uint64_t readU64() {
+		uint64_t value = 0;
+		for (int i = 0; i < 8; i++) {
+			value |= (uint64_t)readByte() << (i * 8);
+		}
+		return value;
+	}
+
+	bool isBad() const {
+		return bad;
+	}
+
+private:
+	const uint8_t *data;
+	int size;
+	int pos;
+	bool bad;
+};
+
+/*
+ * Class for the address of a socket: a port on 127.0.0.1 or the path of a Unix socket
+ */
+class NetAddress {
+public:
+	NetAddress();
+
+	/* Method to set the address from text, a path when it has a '/' in it and a port number otherwise; false when it is neither */
+	bool parse(const char *text);
+
+	/* Method to get the bytes of the address, the same for the same peer, to look peers up by */
+	string key() const {
+		return string((const char *)&addr, length);
+	}
+
+	/* Method to get the address as text, for messages */
+	string toString() const;
+
+	sockaddr_storage addr;
+	socklen_t length;
+};
+
+/*
+ * Function to open a non-blocking datagram socket of the family of address, bound to it when bindIt is true
+ *	(a server) and otherwise to any free local address (a client; a Unix one gets an abstract name), -1 on error
+ */
+int openDatagramSocket(const NetAddress &address, bool bindIt);
+
+/*
+ * Function to get the CPU time the calling thread used in nanoseconds
+ */
+unsigned long threadCpuNs();
+
+/*
+ * Class for an input in flight: its number, the tick it is applied at (after that many moves, like the
+ *	recordings) and the command (a direction, CMD_RESET or CMD_REVIVE)
+ */
+struct NetInput {
+	uint32_t seq;
+	unsigned long tick;
+	int command;
+	unsigned long sentNs; // when the client gave it, for the confirmation time
+};
+
+/*
+ * Class for what the server has said about a room, rebuilt from the snapshots with no engine: what is on
+ *	every cell, the head, the fruit and the score
+ */
+class NetView {
+public:
+	NetView() : tick(0), score(0), lives(0), flags(0), headX(0), headY(0), fruitX(0), fruitY(0), fruitAttribute(0) { }
+
+	/* Method to get NET_EMPTY, NET_BODY or NET_OBSTACLE for a cell */
+	int getCell(int x, int y) const {
+		return cells[cellIndex(x, y)];
+	}
+
+	/* Method to get the tick of the last snapshot taken in, 0 before the first */
+	unsigned long getTick() const {
+		return tick;
+	}
+
+	unsigned int getScore() const {
+		return score;
+	}
+
+	unsigned int getNumOfLives() const {
+		return lives;
+	}
+
+	bool isGameOver() const {
+		return flags & SNAP_GAMEOVER;
+	}
+
+	bool isGameWon() const {
+		return flags & SNAP_GAMEWON;
+	}
+
+	int getHeadX() const {
+		return headX;
+	}
+
+	int getHeadY() const {
+		return headY;
+	}
+
+	int getFruitX() const {
+		return fruitX;
+	}
+
+	int getFruitY() const {
+		return fruitY;
+	}
+
+	int getFruitAttribute() const {
+		return fruitAttribute;
+	}
+
+private:
+	friend class NetClient;
+
+	vector<uint8_t> cells;
+	unsigned long tick;
+	unsigned int score;
+	unsigned int lives;
+	int flags;
+	int headX;
+	int headY;
+	int fruitX;
+	int fruitY;
+	int fruitAttribute;
+};
+
+/*
+ * Class for a client of a room. A player's client predicts into the GameState it is given, which is what
+ *	it shows; a spectator's only has the NetView. Call tick() every tick interval and receive() when
+ *	the socket is readable.
+ */
+class NetClient {
+public:
+	NetClient(GameState &game);
+	~NetClient();
+
+	/*
+	 * Method to join a room of the server at address, waiting up to timeoutMs for the answer. On success
+	 *	the board size is set to the server's and a player's game starts from the room's seed; false with
+	 *	the reason in error otherwise.
+	 */
+	bool join(const char *address, int room, int timeoutMs, string &error);
+
+	/* Method to tell the server the client is gone */
+	void leave();
+
+	/* Method to give an input, it is applied to the predicted game at once and sent; false when too many wait for the server */
+	bool input(int command);
+
+	/*
+	 * Method for the client's own clock: moves the predicted game one tick, or two or none to stay
+	 *	NET_LEAD_TICKS ahead of the last snapshot, and returns the EV_* flags of the moves
+	 */
+	int tick();
+
+	/* Method to read every datagram that is waiting, returns true when a snapshot changed the predicted game */
+	bool receive();
+
+	/* Method to drop a fraction of the snapshots received, to try the protocol with lost packets on loopback */
+	void setDropRate(double rate) {
+		dropRate = rate;
+	}
+
+	int getFd() const {
+		return fd;
+	}
+
+	bool isPlayer() const {
+		return role == NET_PLAYER;
+	}
+
+	int getRoom() const {
+		return room;
+	}
+
+	/* Method to get the server's tick interval in microseconds */
+	unsigned long getTickInterval() const {
+		return tickInterval;
+	}
+
+	const NetView &getView() const {
+		return view;
+	}
+
+	/* Method to get the game as of the last snapshot, which the server's has to hash the same as */
+	const GameState &getConfirmed() const {
+		return confirmed;
+	}
+
+	unsigned long getSnapshots() const {
+		return snapshots;
+	}
+
+	unsigned long getKeyframes() const {
+		return keyframes;
+	}
+
+	unsigned long getDropped() const {
+		return dropped;
+	}
+
+	unsigned long getBytesReceived() const {
+		return bytesReceived;
+	}
+
+	unsigned long getBytesSent() const {
+		return bytesSent;
+	}
+
+	/* Method to get how many inputs were given */
+	unsigned long getNumInputs() const {
+		return nextSeq - 1;
+	}
+
+	/* Method to get how many inputs the server applied at another tick than predicted, and how many times that changed the game shown */
+	unsigned long getLateInputs() const {
+		return lateInputs;
+	}
+
+	unsigned long getCorrections() const {
+		return corrections;
+	}
+
+	/* Method to get how many snapshots did not hash like the confirmed game, 0 unless the engine lost its determinism */
+	unsigned long getDesyncs() const {
+		return desyncs;
+	}
+
+	/* Method to get the time from giving an input to the snapshot that confirmed it */
+	const Histogram &getConfirmTime() const {
+		return confirmTime;
+	}
+
+private:
+	/* Method to send the acknowledged tick, the last confirmed input and every unconfirmed one */
+	void sendInputs();
+
+	/* Method to take in a snapshot, returns true when the predicted game had to change */
+	bool handleSnapshot(PacketReader &reader);
+
+	/* Method to play the confirmed game forward to a tick with the confirmed inputs */
+	void advanceConfirmed(unsigned long toTick);
+
+	/* Method to get the predicted game again from the confirmed one, true when it came out different */
+	bool predictAgain();
+
+	GameState &game;          // predicted, gameTick moves made in the room
+	GameState confirmed;      // as of confirmedTick, made of confirmed inputs only
+	GameState scratch;        // where predictAgain() plays
+	unsigned long gameTick;
+	unsigned long confirmedTick;
+	unsigned long serverTick;  // of the newest snapshot, or the tick the client joined at
+	vector<NetInput> pending;  // given and not confirmed, in order
+	vector<NetInput> toApply;  // confirmed with the server's ticks, not yet played into confirmed
+	uint32_t nextSeq;
+	uint32_t confirmedSeq;     // the last input the server confirmed
+	bool mispredicted;         // an input landed on another tick than predicted since predictAgain()
+	bool unsent;               // the last message could not be sent
+
+	NetView view;
+	int fd;
+	NetAddress server;
+	int room;
+	int role;
+	unsigned long tickInterval;
+	double dropRate;
+	Rng dropRng;
+
+	unsigned long snapshots;
+	unsigned long keyframes;
+	unsigned long dropped;
+	unsigned long bytesReceived;
+	unsigned long bytesSent;
+	unsigned long lateInputs;
+	unsigned long corrections;
+	unsigned long desyncs;
+	Histogram confirmTime;
+	PacketWriter out;
+	uint8_t in[NET_MAX_PACKET];
+};
+
+/*
+ * Class for a client as the server sees it
+ */
+struct NetPeer {
+	NetAddress address;
+	int room;                 // -1 for a free slot
+	int role;
+	unsigned long ackTick;    // the last snapshot it has, 0 for none
+	uint32_t confirmedSeq;    // the last input it knows the server applied
+	unsigned long lastHeardNs;
+};
+
+/*
+ * Class for a room of the server: the game, the changed cells of the last ticks, the inputs, and what it cost
+ */
+struct NetRoom {
+	GameState game;
+	uint64_t gameSeed;        // of the player's game
+	uint64_t nextSeed;        // for the next player's game
+	vector<int> members;      // the peers in the room, it only ticks with some
+	int player;               // the peer playing, -1 for none; the game only moves with a player
+	unsigned long tick;       // ticks the room made, never reset
+	unsigned long startTick;  // the tick the player's game started at
+	vector<int> history[NET_HISTORY]; // the cells that changed at each tick, by tick % NET_HISTORY
+	bool historyAll[NET_HISTORY];     // every cell changed at that tick (a new game)
+	vector<NetInput> queued;  // received, waiting for their tick
+	vector<NetInput> applied; // applied, not yet known to be confirmed to the player
+	uint32_t nextSeq;         // the input expected next from the player
+
+	unsigned long ticks;      // counted for the report
+	unsigned long bytesSent;
+	unsigned long bytesReceived;
+	unsigned long snapshots;
+	unsigned long keyframes;
+	unsigned long cpuNs;      // of the server thread, for this room's ticks, snapshots and messages
+};
+
+/*
+ * Class for the server: rooms ticked on one clock and their clients on one socket, all on the thread that calls run()
+ */
+class NetServer {
+public:
+	/* Create numRooms rooms, room i's first game seeded with seed + i, ticking every tickInterval microseconds */
+	NetServer(int numRooms, uint64_t seed, unsigned long tickInterval);
+	~NetServer();
+
+	/* Method to open the socket, false when it cannot be bound */
+	bool listen(const char *address);
+
+	/* Method to serve until ticks ticks were run (0 for ever) or stop() is called, reporting every reportEvery ticks (0 for never) */
+	void run(unsigned long ticks, unsigned long reportEvery);
+
+	/* Method to make run() return, from any thread */
+	void stop();
+
+	/* Method to print every room's clients, traffic and CPU time a tick */
+	void printReport(FILE *out) const;
+
+	int getNumRooms() const {
+		return rooms.size();
+	}
+
+	const NetRoom &getRoom(int i) const {
+		return rooms[i];
+	}
+
+	unsigned long getTick() const {
+		return tick;
+	}
+
+private:
+	/* Method to handle every datagram waiting on the socket */
+	void readPackets();
+
+	void handlePacket(const uint8_t *data, int size, const NetAddress &from);
+	void handleJoin(PacketReader &reader, const NetAddress &from);
+	void handleInput(PacketReader &reader, NetPeer &peer);
+
+	/* Method to remove a peer, the room stops ticking when it was the player */
+	void dropPeer(int p);
+
+	/* Method to apply the inputs due, move the game and send every client its snapshot */
+	void tickRoom(int r);
+
+	/* Method to put the cells a peer needs into cells, returns false when it needs a keyframe */
+	bool collectDelta(const NetRoom &room, const NetPeer &peer, vector<int> &cells);
+
+	void sendSnapshot(NetRoom &room, NetPeer &peer);
+	void send(const PacketWriter &packet, const NetAddress &to, NetRoom *room);
+
+	vector<NetRoom> rooms;
+	vector<NetPeer> peers;
+	map<string, int> peerIndex; // by NetAddress::key()
+	unsigned long tickInterval;
+	unsigned long tick;
+	int fd;
+	int epollFd;
+	int timerFd;
+	int stopFd;                 // an eventfd stop() writes to
+	unsigned long sendErrors;
+	vector<int> delta;          // what a snapshot works on, kept to not allocate
+	PacketWriter out;
+	uint8_t in[NET_MAX_PACKET];
+};
+
+#endif
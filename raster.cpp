@@ -0,0 +1,416 @@
+/*
+ * The CPU rasteriser of the framebuffer backend, see raster.h
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#include "raster.h"
+
+
+/*
+ * The fill kernels, n pixels of one colour from dst on; the fastest one the CPU runs is picked once
+ */
+typedef void (*FillKernel)(uint32_t *dst, int n, uint32_t color);
+
+static void fillScalar(uint32_t *dst, int n, uint32_t color) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = color;
+	}
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static void fillSse2(uint32_t *dst, int n, uint32_t color) {
+	const __m128i c = _mm_set1_epi32(color);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_si128((__m128i *)(dst + i), c);
+	}
+	for (; i < n; i++) {
+		dst[i] = color;
+	}
+}
+
+__attribute__((target("avx2")))
+static void fillAvx2(uint32_t *dst, int n, uint32_t color) {
+	const __m256i c = _mm256_set1_epi32(color);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_si256((__m256i *)(dst + i), c);
+	}
+	if (i + 4 <= n) {
+		_mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(c));
+		i += 4;
+	}
+	for (; i < n; i++) {
+		dst[i] = color;
+	}
+}
+#endif
+
+static FillKernel chooseFillKernel() {
+#ifdef HAVE_X86
+	if (__builtin_cpu_supports("avx2")) return fillAvx2;
+	if (__builtin_cpu_supports("sse2")) return fillSse2;
+#endif
+	return fillScalar;
+}
+
+static const FillKernel fillKernel = chooseFillKernel();
+
+
+/*
+ * The built-in 5x7 font from the space to the tilde, a byte per column with the top row in bit 0 and the
+ *	descenders in bit 7
+ */
+static const uint8_t builtinGlyphs[LAST_GLYPH - FIRST_GLYPH + 1][5] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+	{ 0x00, 0x00, 0x5F, 0x00, 0x00 }, // !
+	{ 0x00, 0x07, 0x00, 0x07, 0x00 }, // "
+	{ 0x14, 0x7F, 0x14, 0x7F, 0x14 }, // #
+	{ 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, // $
+	{ 0x23, 0x13, 0x08, 0x64, 0x62 }, // %
+	{ 0x36, 0x49, 0x56, 0x20, 0x50 }, // &
+	{ 0x00, 0x08, 0x07, 0x03, 0x00 }, // '
+	{ 0x00, 0x1C, 0x22, 0x41, 0x00 }, // (
+	{ 0x00, 0x41, 0x22, 0x1C, 0x00 }, // )
+	{ 0x2A, 0x1C, 0x7F, 0x1C, 0x2A }, // *
+	{ 0x08, 0x08, 0x3E, 0x08, 0x08 }, // +
+	{ 0x00, 0x80, 0x70, 0x30, 0x00 }, // ,
+	{ 0x08, 0x08, 0x08, 0x08, 0x08 }, // -
+	{ 0x00, 0x00, 0x60, 0x60, 0x00 }, // .
+	{ 0x20, 0x10, 0x08, 0x04, 0x02 }, // /
+	{ 0x3E, 0x51, 0x49, 0x45, 0x3E }, // 0
+	{ 0x00, 0x42, 0x7F, 0x40, 0x00 }, // 1
+	{ 0x72, 0x49, 0x49, 0x49, 0x46 }, // 2
+	{ 0x21, 0x41, 0x49, 0x4D, 0x33 }, // 3
+	{ 0x18, 0x14, 0x12, 0x7F, 0x10 }, // 4
+	{ 0x27, 0x45, 0x45, 0x45, 0x39 }, // 5
+	{ 0x3C, 0x4A, 0x49, 0x49, 0x31 }, // 6
+	{ 0x41, 0x21, 0x11, 0x09, 0x07 }, // 7
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, // 8
+	{ 0x46, 0x49, 0x49, 0x29, 0x1E }, // 9
+	{ 0x00, 0x00, 0x14, 0x00, 0x00 }, // :
+	{ 0x00, 0x40, 0x34, 0x00, 0x00 }, // ;
+	{ 0x00, 0x08, 0x14, 0x22, 0x41 }, // <
+	{ 0x14, 0x14, 0x14, 0x14, 0x14 }, // =
+	{ 0x00, 0x41, 0x22, 0x14, 0x08 }, // >
+	{ 0x02, 0x01, 0x59, 0x09, 0x06 }, // ?
+	{ 0x3E, 0x41, 0x5D, 0x59, 0x4E }, // @
+	{ 0x7C, 0x12, 0x11, 0x12, 0x7C }, // A
+	{ 0x7F, 0x49, 0x49, 0x49, 0x36 }, // B
+	{ 0x3E, 0x41, 0x41, 0x41, 0x22 }, // C
+	{ 0x7F, 0x41, 0x41, 0x41, 0x3E }, // D
+	{ 0x7F, 0x49, 0x49, 0x49, 0x41 }, // E
+	{ 0x7F, 0x09, 0x09, 0x09, 0x01 }, // F
+	{ 0x3E, 0x41, 0x41, 0x51, 0x73 }, // G
+	{ 0x7F, 0x08, 0x08, 0x08, 0x7F }, // H
+	{ 0x00, 0x41, 0x7F, 0x41, 0x00 }, // I
+	{ 0x20, 0x40, 0x41, 0x3F, 0x01 }, // J
+	{ 0x7F, 0x08, 0x14, 0x22, 0x41 }, // K
+	{ 0x7F, 0x40, 0x40, 0x40, 0x40 }, // L
+	{ 0x7F, 0x02, 0x1C, 0x02, 0x7F }, // M
+	{ 0x7F, 0x04, 0x08, 0x10, 0x7F }, // N
+	{ 0x3E, 0x41, 0x41, 0x41, 0x3E }, // O
+	{ 0x7F, 0x09, 0x09, 0x09, 0x06 }, // P
+	{ 0x3E, 0x41, 0x51, 0x21, 0x5E }, // Q
+	{ 0x7F, 0x09, 0x19, 0x29, 0x46 }, // R
+	{ 0x26, 0x49, 0x49, 0x49, 0x32 }, // S
+	{ 0x03, 0x01, 0x7F, 0x01, 0x03 }, // T
+	{ 0x3F, 0x40, 0x40, 0x40, 0x3F }, // U
+	{ 0x1F, 0x20, 0x40, 0x20, 0x1F }, // V
+	{ 0x3F, 0x40, 0x38, 0x40, 0x3F }, // W
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, // X
+	{ 0x03, 0x04, 0x78, 0x04, 0x03 }, // Y
+	{ 0x61, 0x59, 0x49, 0x4D, 0x43 }, // Z
+	{ 0x00, 0x7F, 0x41, 0x41, 0x41 }, // [
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, // backslash
+	{ 0x00, 0x41, 0x41, 0x41, 0x7F }, // ]
+	{ 0x04, 0x02, 0x01, 0x02, 0x04 }, // ^
+	{ 0x40, 0x40, 0x40, 0x40, 0x40 }, // _
+	{ 0x00, 0x03, 0x07, 0x08, 0x00 }, // `
+	{ 0x20, 0x54, 0x54, 0x78, 0x40 }, // a
+	{ 0x7F, 0x28, 0x44, 0x44, 0x38 }, // b
+	{ 0x38, 0x44, 0x44, 0x44, 0x28 }, // c
+	{ 0x38, 0x44, 0x44, 0x28, 0x7F }, // d
+	{ 0x38, 0x54, 0x54, 0x54, 0x18 }, // e
+	{ 0x00, 0x08, 0x7E, 0x09, 0x02 }, // f
+	{ 0x18, 0xA4, 0xA4, 0x9C, 0x78 }, // g
+	{ 0x7F, 0x08, 0x04, 0x04, 0x78 }, // h
+	{ 0x00, 0x44, 0x7D, 0x40, 0x00 }, // i
+	{ 0x20, 0x40, 0x40, 0x3D, 0x00 }, // j
+	{ 0x7F, 0x10, 0x28, 0x44, 0x00 }, // k
+	{ 0x00, 0x41, 0x7F, 0x40, 0x00 }, // l
+	{ 0x7C, 0x04, 0x78, 0x04, 0x78 }, // m
+	{ 0x7C, 0x08, 0x04, 0x04, 0x78 }, // n
+	{ 0x38, 0x44, 0x44, 0x44, 0x38 }, // o
+	{ 0xFC, 0x18, 0x24, 0x24, 0x18 }, // p
+	{ 0x18, 0x24, 0x24, 0x18, 0xFC }, // q
+	{ 0x7C, 0x08, 0x04, 0x04, 0x08 }, // r
+	{ 0x48, 0x54, 0x54, 0x54, 0x24 }, // s
+	{ 0x04, 0x04, 0x3F, 0x44, 0x24 }, // t
+	{ 0x3C, 0x40, 0x40, 0x20, 0x7C }, // u
+	{ 0x1C, 0x20, 0x40, 0x20, 0x1C }, // v
+	{ 0x3C, 0x40, 0x30, 0x40, 0x3C }, // w
+	{ 0x44, 0x28, 0x10, 0x28, 0x44 }, // x
+	{ 0x4C, 0x90, 0x90, 0x90, 0x7C }, // y
+	{ 0x44, 0x64, 0x54, 0x4C, 0x44 }, // z
+	{ 0x00, 0x08, 0x36, 0x41, 0x00 }, // {
+	{ 0x00, 0x00, 0x77, 0x00, 0x00 }, // |
+	{ 0x00, 0x41, 0x36, 0x08, 0x00 }, // }
+	{ 0x02, 0x01, 0x02, 0x04, 0x02 }, // ~
+};
+
+
+GlyphFont::GlyphFont() {
+	memset(glyphs, 0, sizeof(glyphs));
+}
+
+void GlyphFont::setGlyph(int c, int left, int top, int width, int height, int advance, const uint8_t *mask) {
+	if (c < FIRST_GLYPH || c > LAST_GLYPH) return;
+	Glyph &glyph = glyphs[c - FIRST_GLYPH];
+	glyph.left = left;
+	glyph.top = top;
+	glyph.width = width;
+	glyph.height = height;
+	glyph.advance = advance;
+	glyph.offset = masks.size();
+	masks.insert(masks.end(), mask, mask + width * height);
+}
+
+void GlyphFont::loadBuiltin(int scale) {
+	masks.clear();
+	vector<uint8_t> mask(5 * scale * 8 * scale);
+	for (int c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+		const uint8_t *columns = builtinGlyphs[c - FIRST_GLYPH];
+		for (int y = 0; y < 8 * scale; y++) {
+			for (int x = 0; x < 5 * scale; x++) {
+				mask[y * 5 * scale + x] = ((columns[x / scale] >> (y / scale)) & 1) ? 0xFF : 0;
+			}
+		}
+		/* seven rows above the baseline, the eighth for the descenders */
+		setGlyph(c, 0, -7 * scale, 5 * scale, 8 * scale, 6 * scale, mask.data());
+	}
+}
+
+int GlyphFont::textWidth(const char *text, int length) const {
+	int w = 0;
+	for (int i = 0; i < length; i++) {
+		int c = (unsigned char)text[i];
+		if (c < FIRST_GLYPH || c > LAST_GLYPH) c = ' ';
+		w += glyphs[c - FIRST_GLYPH].advance;
+	}
+	return w;
+}
+
+
+Framebuffer::Framebuffer(int width, int height) : width(width), height(height), stride(width), ownPixels(true) {
+	pixels = new uint32_t[(size_t)width * height]();
+	clearClip();
+}
+
+Framebuffer::Framebuffer(uint32_t *pixels, int width, int height, int stride)
+	: pixels(pixels), width(width), height(height), stride(stride), ownPixels(false) {
+	clearClip();
+}
+
+Framebuffer::~Framebuffer() {
+	if (ownPixels) delete[] pixels;
+}
+
+void Framebuffer::setClip(int x, int y, int w, int h) {
+	clipX0 = max(x, 0);
+	clipY0 = max(y, 0);
+	clipX1 = min(x + w, width);
+	clipY1 = min(y + h, height);
+}
+
+void Framebuffer::clearClip() {
+	setClip(0, 0, width, height);
+}
+
+bool Framebuffer::usingAvx2() {
+#ifdef HAVE_X86
+	return fillKernel == fillAvx2;
+#else
+	return false;
+#endif
+}
+
+void Framebuffer::fillSpan(int y, int x0, int x1, uint32_t color) {
+	if (y < clipY0 || y >= clipY1) return;
+	x0 = max(x0, clipX0);
+	x1 = min(x1, clipX1);
+	if (x0 < x1) fillKernel(pixels + (size_t)y * stride + x0, x1 - x0, color);
+}
+
+void Framebuffer::fillRect(int x, int y, int w, int h, uint32_t color) {
+	int y0 = max(y, clipY0);
+	int y1 = min(y + h, clipY1);
+	int x0 = max(x, clipX0);
+	int x1 = min(x + w, clipX1);
+	if (x0 >= x1) return;
+	for (int row = y0; row < y1; row++) {
+		fillKernel(pixels + (size_t)row * stride + x0, x1 - x0, color);
+	}
+}
+
+void Framebuffer::drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+	if (lineWidth < 1) lineWidth = 1;
+
+	/* the outer edge of the outline, half the line outside the rectangle and the rest inside */
+	int ox = x - lineWidth / 2;
+	int oy = y - lineWidth / 2;
+	int ow = w + lineWidth;
+	int oh = h + lineWidth;
+	if (ow <= 2 * lineWidth || oh <= 2 * lineWidth) {
+		fillRect(ox, oy, ow, oh, color); // too small to have a hole
+		return;
+	}
+	fillRect(ox, oy, ow, lineWidth, color);
+	fillRect(ox, oy + oh - lineWidth, ow, lineWidth, color);
+	fillRect(ox, oy + lineWidth, lineWidth, oh - 2 * lineWidth, color);
+	fillRect(ox + ow - lineWidth, oy + lineWidth, lineWidth, oh - 2 * lineWidth, color);
+}
+
+void Framebuffer::drawLine(int x0, int y0, int x1, int y1, uint32_t color) {
+	if (y0 == y1) {
+		fillSpan(y0, min(x0, x1), max(x0, x1) + 1, color);
+		return;
+	}
+
+	/* Bresenham, a pixel at a time */
+	int dx = abs(x1 - x0), sx = (x0 < x1) ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = (y0 < y1) ? 1 : -1;
+	int err = dx + dy;
+	while (true) {
+		fillSpan(y0, x0, x0 + 1, color);
+		if (x0 == x1 && y0 == y1) break;
+		int e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+bool Framebuffer::ellipseSpan(double cy, double rx, double ry, int y, double &half) {
+	if (rx <= 0.0 || ry <= 0.0) return false;
+	double dy = (y + 0.5 - cy) / ry;
+	if (dy <= -1.0 || dy >= 1.0) return false;
+	half = rx * sqrt(1.0 - dy * dy);
+	return true;
+}
+
+void Framebuffer::fillEllipse(int x, int y, int w, int h, uint32_t color) {
+	double cx = x + w / 2.0, cy = y + h / 2.0;
+	int y0 = max(y, clipY0);
+	int y1 = min(y + h, clipY1);
+	for (int row = y0; row < y1; row++) {
+		double half;
+		if (!ellipseSpan(cy, w / 2.0, h / 2.0, row, half)) continue;
+		/* the pixels whose centres are within half of the centre */
+		fillSpan(row, (int)ceil(cx - half - 0.5), (int)floor(cx + half - 0.5) + 1, color);
+	}
+}
+
+void Framebuffer::drawEllipse(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+	if (lineWidth < 1) lineWidth = 1;
+	double cx = x + w / 2.0, cy = y + h / 2.0;
+	double outerX = w / 2.0 + lineWidth / 2.0, outerY = h / 2.0 + lineWidth / 2.0;
+	double innerX = w / 2.0 - lineWidth / 2.0, innerY = h / 2.0 - lineWidth / 2.0;
+
+	int y0 = max((int)floor(cy - outerY), clipY0);
+	int y1 = min((int)ceil(cy + outerY), clipY1);
+	for (int row = y0; row < y1; row++) {
+		double outer, inner;
+		if (!ellipseSpan(cy, outerX, outerY, row, outer)) continue;
+		int left = (int)ceil(cx - outer - 0.5);
+		int right = (int)floor(cx + outer - 0.5) + 1;
+		if (ellipseSpan(cy, innerX, innerY, row, inner)) {
+			/* the ring on both sides of the hole */
+			fillSpan(row, left, (int)ceil(cx - inner - 0.5), color);
+			fillSpan(row, (int)floor(cx + inner - 0.5) + 1, right, color);
+		} else {
+			fillSpan(row, left, right, color);
+		}
+	}
+}
+
+void Framebuffer::fillPolygon(const RasterPoint points[], int numPoints, uint32_t color) {
+	if (numPoints < 3 || numPoints > MAX_POLYGON_POINTS) return;
+
+	int minY = points[0].y, maxY = points[0].y;
+	for (int i = 1; i < numPoints; i++) {
+		minY = min(minY, points[i].y);
+		maxY = max(maxY, points[i].y);
+	}
+
+	double crossings[MAX_POLYGON_POINTS];
+	int y0 = max(minY, clipY0);
+	int y1 = min(maxY + 1, clipY1);
+	for (int row = y0; row < y1; row++) {
+		/* where the edges cross the centre line of the row, sorted */
+		double yc = row + 0.5;
+		int n = 0;
+		for (int i = 0; i < numPoints; i++) {
+			const RasterPoint &a = points[i];
+			const RasterPoint &b = points[(i + 1) % numPoints];
+			if ((a.y <= yc) == (b.y <= yc)) continue;
+			double xc = a.x + (yc - a.y) * (b.x - a.x) / (double)(b.y - a.y);
+			int k = n++;
+			for (; k > 0 && crossings[k - 1] > xc; k--) {
+				crossings[k] = crossings[k - 1];
+			}
+			crossings[k] = xc;
+		}
+
+		/* even-odd: inside between the first and second crossing, the third and fourth, ... */
+		for (int k = 0; k + 1 < n; k += 2) {
+			fillSpan(row, (int)ceil(crossings[k] - 0.5), (int)ceil(crossings[k + 1] - 0.5), color);
+		}
+	}
+}
+
+void Framebuffer::drawText(const GlyphFont &font, int x, int y, const char *text, int length, uint32_t color) {
+	for (int i = 0; i < length; i++) {
+		int c = (unsigned char)text[i];
+		if (c < FIRST_GLYPH || c > LAST_GLYPH) c = ' ';
+		const GlyphFont::Glyph &glyph = font.glyphs[c - FIRST_GLYPH];
+
+		int gx = x + glyph.left;
+		int gy = y + glyph.top;
+		int c0 = max(clipX0 - gx, 0);
+		int c1 = min(clipX1 - gx, glyph.width);
+		for (int r = max(clipY0 - gy, 0); r < min(clipY1 - gy, glyph.height); r++) {
+			const uint8_t *mask = &font.masks[glyph.offset + r * glyph.width];
+			uint32_t *dst = pixels + (size_t)(gy + r) * stride + gx;
+			for (int k = c0; k < c1; k++) {
+				if (mask[k]) dst[k] = color;
+			}
+		}
+		x += glyph.advance;
+	}
+}
+
+void Framebuffer::copy(const Framebuffer &from, int x, int y, int w, int h) {
+	int x0 = max(x, clipX0);
+	int x1 = min(min(x + w, clipX1), from.width);
+	int y0 = max(y, clipY0);
+	int y1 = min(min(y + h, clipY1), from.height);
+	if (x0 >= x1) return;
+	for (int row = y0; row < y1; row++) {
+		memcpy(pixels + (size_t)row * stride + x0, from.pixels + (size_t)row * from.stride + x0, (x1 - x0) * sizeof(uint32_t));
+	}
+}
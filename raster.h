@@ -0,0 +1,158 @@
+/*
+ * A frame drawn by the CPU, for the framebuffer backend of the game.
+ *
+ * The pixels are 32 bit 0xRRGGBB words in rows of a stride, the layout of a ZPixmap XImage on a 24 bit
+ * TrueColor screen, so a whole frame goes to the X server with one XShmPutImage (or XPutImage) instead
+ * of one request for every block, arc and string. Every shape is cut into horizontal spans inside the
+ * clip rectangle and each span is written by a fill kernel, eight pixels per AVX2 store where the CPU
+ * has it and four per SSE2 store otherwise on x86. Text is drawn from coverage masks of the glyphs,
+ * made once from a font by whoever has the font. There is no X11 in here, snake-bench measures the
+ * rasteriser too.
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+
+/* The characters a GlyphFont has masks for, printable ASCII */
+#define FIRST_GLYPH 32
+#define LAST_GLYPH 126
+
+/* The most corners fillPolygon() takes, the game's hearts have ten */
+#define MAX_POLYGON_POINTS 64
+
+/*
+ * A corner of a polygon, in pixels
+ */
+struct RasterPoint {
+	int x;
+	int y;
+};
+
+/*
+ * Class for a font as coverage masks of its glyphs, one byte per pixel, 0 or not
+ */
+class GlyphFont {
+public:
+	GlyphFont();
+
+	/*
+	 * Method to set the glyph of character c: its box from the origin on the baseline (top is negative
+	 *	above the baseline), how far the origin moves after it and its width x height mask, which is copied
+	 */
+	void setGlyph(int c, int left, int top, int width, int height, int advance, const uint8_t *mask);
+
+	/*
+	 * Method to set every glyph from the built-in 5x7 font, each pixel a scale x scale square, for when there
+	 *	is no font to read them from
+	 */
+	void loadBuiltin(int scale);
+
+	/* Method to get the width of a string in pixels, the sum of the advances */
+	int textWidth(const char *text, int length) const;
+
+private:
+	friend class Framebuffer;
+
+	struct Glyph {
+		int left;
+		int top;
+		int width;
+		int height;
+		int advance;
+		size_t offset; // of the mask in masks
+	};
+
+	Glyph glyphs[LAST_GLYPH - FIRST_GLYPH + 1];
+	vector<uint8_t> masks;
+};
+
+/*
+ * Class for a frame of pixels drawn by the CPU. Everything drawn is clipped to the clip rectangle,
+ *	the whole frame unless setClip() says otherwise.
+ */
+class Framebuffer {
+public:
+	/* Create a width x height frame of its own pixels, all black */
+	Framebuffer(int width, int height);
+
+	/* Create a frame over pixels someone else owns, e.g. the shared memory of an XImage; stride is in pixels */
+	Framebuffer(uint32_t *pixels, int width, int height, int stride);
+
+	~Framebuffer();
+
+	/* Method to draw only inside a rectangle of the frame from now on */
+	void setClip(int x, int y, int w, int h);
+
+	/* Method to draw on the whole frame again */
+	void clearClip();
+
+	/* Method to fill a rectangle, like XFillRectangle */
+	void fillRect(int x, int y, int w, int h, uint32_t color);
+
+	/* Method to draw the outline of a rectangle with lines lineWidth wide centred on its edges, like XDrawRectangle */
+	void drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color);
+
+	/* Method to draw a one pixel line with both end points, like XDrawLine with a thin line */
+	void drawLine(int x0, int y0, int x1, int y1, uint32_t color);
+
+	/* Method to fill the ellipse that fits a box, every pixel whose centre is in it, like a whole XFillArc */
+	void fillEllipse(int x, int y, int w, int h, uint32_t color);
+
+	/* Method to draw the ellipse that fits a box as a ring lineWidth wide, like a whole XDrawArc */
+	void drawEllipse(int x, int y, int w, int h, int lineWidth, uint32_t color);
+
+	/* Method to fill a polygon with the even-odd rule, like XFillPolygon; it is closed for you */
+	void fillPolygon(const RasterPoint points[], int numPoints, uint32_t color);
+
+	/* Method to draw a string with its origin at (x, y) on the baseline, like XDrawString */
+	void drawText(const GlyphFont &font, int x, int y, const char *text, int length, uint32_t color);
+
+	/* Method to copy a rectangle of another frame of the same size to the same place in this one */
+	void copy(const Framebuffer &from, int x, int y, int w, int h);
+
+	/* Method to check if the fill kernel uses AVX2 */
+	static bool usingAvx2();
+
+	uint32_t *getPixels() const {
+		return pixels;
+	}
+
+	int getWidth() const {
+		return width;
+	}
+
+	int getHeight() const {
+		return height;
+	}
+
+	int getStride() const {
+		return stride;
+	}
+
+private:
+	/* Method to fill the pixels x0 to x1 - 1 of row y, clipped */
+	void fillSpan(int y, int x0, int x1, uint32_t color);
+
+	/* Method to get the half width at the centre of row y of an ellipse centred on cy, false when the row misses it */
+	static bool ellipseSpan(double cy, double rx, double ry, int y, double &half);
+
+	uint32_t *pixels;
+	int width;
+	int height;
+	int stride;
+	bool ownPixels;
+
+	/* the clip rectangle, from (clipX0, clipY0) up to but not including (clipX1, clipY1) */
+	int clipX0;
+	int clipY0;
+	int clipX1;
+	int clipY1;
+};
+
+#endif
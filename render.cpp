@@ -0,0 +1,113 @@
+/*
+ * The renderers that need no display, see render.h
+ */
+
+#include <stdio.h>
+
+#include "render.h"
+
+
+/* The built-in font is scaled to about the pixel size of each of the game's X fonts */
+static const int builtinScale[NUM_FONTS] = { 2, 2, 4, 2 };
+
+
+FramebufferRenderer::FramebufferRenderer(Framebuffer *frame, GlyphFont *const fonts[NUM_FONTS]) : frame(frame), canvas(frame) {
+	for (int i = 0; i < NUM_FONTS; i++) {
+		this->fonts[i] = fonts ? fonts[i] : NULL;
+	}
+}
+
+FramebufferRenderer::~FramebufferRenderer() {
+	for (size_t i = 0; i < layers.size(); i++) {
+		delete layers[i];
+	}
+}
+
+void FramebufferRenderer::clear() {
+	canvas->fillRect(0, 0, canvas->getWidth(), canvas->getHeight(), 0x000000);
+}
+
+void FramebufferRenderer::fillRect(int x, int y, int w, int h, uint32_t color) {
+	canvas->fillRect(x, y, w, h, color);
+}
+
+void FramebufferRenderer::drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+	canvas->drawRect(x, y, w, h, lineWidth, color);
+}
+
+void FramebufferRenderer::drawLine(int x0, int y0, int x1, int y1, uint32_t color) {
+	canvas->drawLine(x0, y0, x1, y1, color);
+}
+
+void FramebufferRenderer::fillArc(int x, int y, int w, int h, uint32_t color) {
+	canvas->fillEllipse(x, y, w, h, color);
+}
+
+void FramebufferRenderer::drawArc(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+	canvas->drawEllipse(x, y, w, h, lineWidth, color);
+}
+
+void FramebufferRenderer::fillPolygon(const RasterPoint points[], int numPoints, bool /* convex */, uint32_t color) {
+	canvas->fillPolygon(points, numPoints, color);
+}
+
+void FramebufferRenderer::drawText(int font, int x, int y, const char *text, int length, uint32_t color) {
+	canvas->drawText(*fonts[font], x, y, text, length, color);
+}
+
+void FramebufferRenderer::setClip(int x, int y, int w, int h) {
+	canvas->setClip(x, y, w, h);
+}
+
+void FramebufferRenderer::clearClip() {
+	canvas->clearClip();
+}
+
+int FramebufferRenderer::createLayer() {
+	layers.push_back(new Framebuffer(frame->getWidth(), frame->getHeight()));
+	return layers.size() - 1;
+}
+
+void FramebufferRenderer::beginLayer(int layer) {
+	canvas = layers[layer];
+}
+
+void FramebufferRenderer::endLayer() {
+	canvas = frame;
+}
+
+void FramebufferRenderer::copyLayer(int layer, int x, int y, int w, int h) {
+	canvas->copy(*layers[layer], x, y, w, h);
+}
+
+
+OffscreenRenderer::OffscreenRenderer(int width, int height)
+	: FramebufferRenderer(new Framebuffer(width, height), NULL) {
+	for (int i = 0; i < NUM_FONTS; i++) {
+		builtinFonts[i].loadBuiltin(builtinScale[i]);
+		fonts[i] = &builtinFonts[i];
+	}
+}
+
+OffscreenRenderer::~OffscreenRenderer() {
+	delete frame;
+}
+
+bool OffscreenRenderer::writePpm(const char *path) const {
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", frame->getWidth(), frame->getHeight());
+	vector<uint8_t> row(frame->getWidth() * 3);
+	for (int y = 0; y < frame->getHeight(); y++) {
+		const uint32_t *pixels = frame->getPixels() + (size_t)y * frame->getStride();
+		for (int x = 0; x < frame->getWidth(); x++) {
+			row[x * 3] = pixels[x] >> 16;
+			row[x * 3 + 1] = pixels[x] >> 8;
+			row[x * 3 + 2] = pixels[x];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	bool ok = !ferror(file);
+	return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,199 @@
+/*
+ * What the game draws with, whatever it is drawn on.
+ *
+ * The displayables of snake.cpp paint through a Renderer: filled and outlined rectangles, whole ellipses,
+ * polygons, lines and text in 0xRRGGBB colours, and layers that are drawn once and copied into later
+ * frames. The X11 backends are in snake.cpp: one turns the calls into Xlib requests, the other draws on
+ * the CPU and puts the frame with MIT-SHM. The two here need no display. The null backend draws nothing,
+ * so ./snake --null-renderer --bench-frames=N times the painting code with no drawing and no X server at
+ * all. The offscreen backend rasterises like the framebuffer one (raster.h) with a built-in font and
+ * writes the frame as a PPM image, so frames can be compared with golden images without a display.
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "raster.h"
+
+using namespace std;
+
+
+/*
+ * Macros for fonts
+ */
+#define NEW_CENT_FT 0
+#define TIMES_FT 1
+#define UTOPIA_FT 2
+#define UTOPIA_S_FT 3
+#define NUM_FONTS 4
+
+/* present() with the whole frame rather than a list of damaged areas */
+#define FULL_FRAME -1
+
+/*
+ * A rectangle of the frame, in pixels
+ */
+struct RenderRect {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/*
+ * An abstract class for what a frame is drawn on. Everything drawn goes into the current layer, the frame
+ *	unless beginLayer() said otherwise, and is clipped to the clip rectangle.
+ */
+class Renderer {
+public:
+	virtual ~Renderer() { }
+
+	/* Method to get the name of the backend, for the benchmark lines */
+	virtual const char *getName() = 0;
+
+	/* Method to check if the frame keeps what was drawn in it from one frame to the next, so the damage alone can be repainted */
+	virtual bool keepsFrame() {
+		return true;
+	}
+
+	/* Method to get ready to draw a frame, e.g. wait until the last one is off the hands of the server */
+	virtual void beginFrame() { }
+
+	/* Method to clear the whole frame to black */
+	virtual void clear() = 0;
+
+	virtual void fillRect(int x, int y, int w, int h, uint32_t color) = 0;
+
+	/* Method to draw the outline of a rectangle with lines lineWidth wide centred on its edges */
+	virtual void drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color) = 0;
+
+	/* Method to draw a one pixel line with both end points */
+	virtual void drawLine(int x0, int y0, int x1, int y1, uint32_t color) = 0;
+
+	/* Methods to fill, or draw lineWidth wide, the ellipse that fits a box */
+	virtual void fillArc(int x, int y, int w, int h, uint32_t color) = 0;
+	virtual void drawArc(int x, int y, int w, int h, int lineWidth, uint32_t color) = 0;
+
+	/* Method to fill a polygon with the even-odd rule, convex says it is, which some backends fill faster */
+	virtual void fillPolygon(const RasterPoint points[], int numPoints, bool convex, uint32_t color) = 0;
+
+	/* Method to draw a string in one of the fonts with its origin at (x, y) on the baseline */
+	virtual void drawText(int font, int x, int y, const char *text, int length, uint32_t color) = 0;
+
+	/* Methods to draw only inside a rectangle from now on, and on everything again */
+	virtual void setClip(int x, int y, int w, int h) = 0;
+	virtual void clearClip() = 0;
+
+	/* Method to make a layer the size of the frame, returns the number the other layer methods take */
+	virtual int createLayer() = 0;
+
+	/* Methods to draw into a layer instead of the frame, and back into the frame */
+	virtual void beginLayer(int layer) = 0;
+	virtual void endLayer() = 0;
+
+	/* Method to copy a rectangle of a layer to the same place in the frame */
+	virtual void copyLayer(int layer, int x, int y, int w, int h) = 0;
+
+	/* Method to show the frame, numRects is FULL_FRAME or the number of damaged areas in rects */
+	virtual void present(const RenderRect rects[], int numRects) = 0;
+
+	/* Method to send what is queued to the display, and with wait to wait until it has been drawn */
+	virtual void flush(bool) { }
+
+	/* Method to get the number of requests sent to a display server so far, 0 without one */
+	virtual unsigned long getRequests() {
+		return 0;
+	}
+};
+
+/*
+ * Class for a backend that draws nothing
+ */
+class NullRenderer : public Renderer {
+public:
+	virtual const char *getName() {
+		return "null";
+	}
+
+	virtual void clear() { }
+	virtual void fillRect(int, int, int, int, uint32_t) { }
+	virtual void drawRect(int, int, int, int, int, uint32_t) { }
+	virtual void drawLine(int, int, int, int, uint32_t) { }
+	virtual void fillArc(int, int, int, int, uint32_t) { }
+	virtual void drawArc(int, int, int, int, int, uint32_t) { }
+	virtual void fillPolygon(const RasterPoint [], int, bool, uint32_t) { }
+	virtual void drawText(int, int, int, const char *, int, uint32_t) { }
+	virtual void setClip(int, int, int, int) { }
+	virtual void clearClip() { }
+
+	virtual int createLayer() {
+		return 0;
+	}
+
+	virtual void beginLayer(int) { }
+	virtual void endLayer() { }
+	virtual void copyLayer(int, int, int, int, int) { }
+	virtual void present(const RenderRect [], int) { }
+};
+
+/*
+ * Class for a backend that rasterises on the CPU into a Framebuffer, the frame and the fonts belong to
+ *	whoever made them (a subclass can set the fonts later); a subclass shows the frame
+ */
+class FramebufferRenderer : public Renderer {
+public:
+	FramebufferRenderer(Framebuffer *frame, GlyphFont *const fonts[NUM_FONTS]);
+	virtual ~FramebufferRenderer();
+
+	virtual void clear();
+	virtual void fillRect(int x, int y, int w, int h, uint32_t color);
+	virtual void drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color);
+	virtual void drawLine(int x0, int y0, int x1, int y1, uint32_t color);
+	virtual void fillArc(int x, int y, int w, int h, uint32_t color);
+	virtual void drawArc(int x, int y, int w, int h, int lineWidth, uint32_t color);
+	virtual void fillPolygon(const RasterPoint points[], int numPoints, bool convex, uint32_t color);
+	virtual void drawText(int font, int x, int y, const char *text, int length, uint32_t color);
+	virtual void setClip(int x, int y, int w, int h);
+	virtual void clearClip();
+	virtual int createLayer();
+	virtual void beginLayer(int layer);
+	virtual void endLayer();
+	virtual void copyLayer(int layer, int x, int y, int w, int h);
+
+	Framebuffer *getFrame() const {
+		return frame;
+	}
+
+protected:
+	Framebuffer *frame;
+	Framebuffer *canvas; // the frame or the layer being drawn
+	GlyphFont *fonts[NUM_FONTS];
+	vector<Framebuffer *> layers;
+};
+
+/*
+ * Class for the backend that keeps the frame in memory and can write it out as an image
+ */
+class OffscreenRenderer : public FramebufferRenderer {
+public:
+	/* Create a width x height frame, the text in the built-in font at about the size of the game's X fonts */
+	OffscreenRenderer(int width, int height);
+	virtual ~OffscreenRenderer();
+
+	virtual const char *getName() {
+		return "offscreen";
+	}
+
+	virtual void present(const RenderRect [], int) { }
+
+	/* Method to write the frame as a binary PPM image, returns false when the file cannot be written */
+	bool writePpm(const char *path) const;
+
+private:
+	GlyphFont builtinFonts[NUM_FONTS];
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Recording and replay of the inputs of a play session, see replay.h
+ */
+
+#include <stdio.h>
+#include <cstring>
+
+#include "replay.h"
+
+
+void applyCommand(GameState &game, int command) {
+	switch (command) {
+		case UP:
+		case DOWN:
+		case RIGHT:
+		case LEFT:
+			game.changeDirection(command);
+			break;
+		case CMD_RESET:
+			game.reset();
+			break;
+		case CMD_REVIVE:
+			game.revive();
+			break;
+	}
+}
+
+/*
+ * Function to mix a value into an FNV-1a hash
+ */
+static uint64_t hashMix(uint64_t hash, uint64_t value) {
+	for (int i = 0; i < 8; i++) {
+		hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+uint64_t stateHash(const GameState &game) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const Snake &snake = game.getSnake();
+	for (int j = 0; j < snake.getLength(); j++) {
+		hash = hashMix(hash, snake.getCell(j));
+	}
+	hash = hashMix(hash, cellIndex(game.getFruit().getX(), game.getFruit().getY()));
+	hash = hashMix(hash, game.getFruit().getAttribute());
+	hash = hashMix(hash, game.getScore());
+	hash = hashMix(hash, game.getNumOfLives());
+	hash = hashMix(hash, game.getTick());
+	hash = hashMix(hash, game.isGameOver());
+	return hash;
+}
+
+
+void Recording::start(uint64_t seed, int speed) {
+	this->seed = seed;
+	this->speed = speed;
+	boardWidth = BoardWidth;
+	boardHeight = BoardHeight;
+	length = 0;
+	inputs.clear();
+}
+
+void Recording::add(unsigned long tick, int command) {
+	Input input;
+	input.tick = tick;
+	input.command = command;
+	inputs.push_back(input);
+	if (tick > length) length = tick;
+}
+
+/*
+ * Functions to write and read an unsigned LEB128 varint
+ */
+static void writeVarint(FILE *out, uint64_t value) {
+	while (value >= 0x80) {
+		fputc((int)(value & 0x7f) | 0x80, out);
+		value >>= 7;
+	}
+	fputc((int)value, out);
+}
+
+static bool readVarint(FILE *in, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(in);
+		if (c == EOF) return false;
+		value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+bool Recording::save(const char *path) const {
+	FILE *out = fopen(path, "wb");
+	if (!out) return false;
+
+	fwrite("SNKR", 1, 4, out);
+	fputc(REPLAY_VERSION, out);
+	fputc(speed, out);
+	for (int i = 0; i < 8; i++) {
+		fputc((int)((seed >> (i * 8)) & 0xff), out);
+	}
+	fputc(boardWidth & 0xff, out);
+	fputc(boardWidth >> 8, out);
+	fputc(boardHeight & 0xff, out);
+	fputc(boardHeight >> 8, out);
+
+	unsigned long last = 0;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		writeVarint(out, ((uint64_t)(inputs[i].tick - last) << CMD_BITS) | inputs[i].command);
+		last = inputs[i].tick;
+	}
+	writeVarint(out, ((uint64_t)(length - last) << CMD_BITS) | CMD_END);
+
+	bool ok = !ferror(out);
+	return (fclose(out) == 0) && ok;
+}
+
+bool Recording::load(const char *path) {
+	FILE *in = fopen(path, "rb");
+	if (!in) return false;
+
+	unsigned char header[18];
+	if (fread(header, 1, sizeof(header), in) != sizeof(header) || memcmp(header, "SNKR", 4) != 0 ||
+		header[4] != REPLAY_VERSION || header[5] < MIN_REPLAY_SPEED || header[5] > MAX_REPLAY_SPEED) {
+		fclose(in);
+		return false;
+	}
+	uint64_t newSeed = 0;
+	for (int i = 0; i < 8; i++) {
+		newSeed |= (uint64_t)header[6 + i] << (i * 8);
+	}
+	int width = header[14] | (header[15] << 8);
+	int height = header[16] | (header[17] << 8);
+	if (width < MIN_BOARD_WIDTH || width > MAX_BOARD_SIZE || height < MIN_BOARD_HEIGHT || height > MAX_BOARD_SIZE) {
+		fclose(in);
+		return false;
+	}
+	start(newSeed, header[5]);
+	boardWidth = width;
+	boardHeight = height;
+
+	unsigned long tick = 0;
+	uint64_t value;
+	while (readVarint(in, value)) {
+		tick += value >> CMD_BITS;
+		int command = value & ((1 << CMD_BITS) - 1);
+		if (command == CMD_END) {
+			length = tick;
+			fclose(in);
+			return true;
+		}
+		add(tick, command);
+	}
+	fclose(in); // no CMD_END, the file was cut short
+	return false;
+}
+
+
+bool Replay::applyInputs(GameState &game) {
+	bool restarted = false;
+	while (next < recording.getNumInputs() && recording.getInputTick(next) == tick) {
+		int command = recording.getInputCommand(next++);
+		applyCommand(game, command);
+		if (command == CMD_RESET || command == CMD_REVIVE) restarted = true;
+	}
+	return restarted;
+}
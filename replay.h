@@ -0,0 +1,159 @@
+/*
+ * Recording and replay of the inputs of a play session.
+ *
+ * Every input that reaches the engine is kept with the number of snake moves (ticks) made in the
+ * session before it, and the seed of the first game is kept too. Since the engine draws all its
+ * random numbers from a seeded Rng, applying the same inputs at the same ticks plays the same games
+ * again, whatever the frame rate or how fast the ticks are run.
+ *
+ * The file is an 18 byte header ("SNKR", a version byte, the speed, the seed as 8 little endian bytes,
+ * the board width and height as 2 little endian bytes each) followed by one varint per input holding the ticks since the previous input and the command, so a
+ * long session takes a few bytes per key press. The last entry is CMD_END at the session length.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "game.h"
+
+using namespace std;
+
+
+/*
+ * Macros for the recorded commands, the directions are UP, DOWN, RIGHT and LEFT from game.h
+ */
+#define CMD_RESET 4
+#define CMD_REVIVE 5
+#define CMD_END 7
+#define CMD_BITS 3
+
+#define REPLAY_VERSION 3
+
+/*
+ * Macros for the speeds a recording may hold, the same range the speed argument accepts
+ */
+#define MIN_REPLAY_SPEED 1
+#define MAX_REPLAY_SPEED 10
+
+/*
+ * Function to apply a recorded command (not CMD_END) to a game
+ */
+void applyCommand(GameState &game, int command);
+
+/*
+ * Function to get a hash of the snake, fruit, score, lives and tick, to check that two runs ended the same
+ */
+uint64_t stateHash(const GameState &game);
+
+/*
+ * Class for the inputs of one session
+ */
+class Recording {
+public:
+	Recording() {
+		start(1, 5);
+	}
+
+	/* Method to start an empty recording for a session on the current board whose first game is reset with the given seed */
+	void start(uint64_t seed, int speed);
+
+	/* Method to add a command given after tick snake moves */
+	void add(unsigned long tick, int command);
+
+	/* Method to mark the end of the session after tick snake moves */
+	void finish(unsigned long tick) {
+		length = tick;
+	}
+
+	/* Methods to write and read the binary form, both return false on an I/O or format error */
+	bool save(const char *path) const;
+	bool load(const char *path);
+
+	uint64_t getSeed() const {
+		return seed;
+	}
+
+	int getSpeed() const {
+		return speed;
+	}
+
+	int getBoardWidth() const {
+		return boardWidth;
+	}
+
+	int getBoardHeight() const {
+		return boardHeight;
+	}
+
+	unsigned long getLength() const {
+		return length;
+	}
+
+	int getNumInputs() const {
+		return inputs.size();
+	}
+
+	unsigned long getInputTick(int i) const {
+		return inputs[i].tick;
+	}
+
+	int getInputCommand(int i) const {
+		return inputs[i].command;
+	}
+
+private:
+	struct Input {
+		unsigned long tick;
+		int command;
+	};
+
+	uint64_t seed;
+	int speed;
+	int boardWidth;
+	int boardHeight;
+	unsigned long length; // ticks in the session
+	vector<Input> inputs; // in the order given
+};
+
+/*
+ * Class to feed a recording back into a game, one tick at a time
+ */
+class Replay {
+public:
+	Replay(const Recording &recording) : recording(recording), next(0), tick(0) { }
+
+	/* Method to reset the game with the recorded board size and seed and go back to the first input */
+	void restart(GameState &game) {
+		setBoardSize(recording.getBoardWidth(), recording.getBoardHeight());
+		game.reset(recording.getSeed());
+		next = 0;
+		tick = 0;
+	}
+
+	/* Method to apply the inputs given before the next move, returns true if one of them was a reset or revive */
+	bool applyInputs(GameState &game);
+
+	/* Method to count a move made by the caller */
+	void moved() {
+		tick++;
+	}
+
+	/* Method to check if every recorded move was made, applyInputs once more then for the inputs after the last one */
+	bool finished() const {
+		return tick >= recording.getLength();
+	}
+
+	unsigned long getTick() const {
+		return tick;
+	}
+
+private:
+	const Recording &recording;
+	int next;          // the next input to apply
+	unsigned long tick; // moves made so far
+};
+
+#endif
@@ -0,0 +1,279 @@
+/*
+- - - - - - - - - - - - - - - - - - - - - -
+
+Game server for Snake: many rooms of the headless engine served to clients over local datagram sockets.
+
+Commands to compile and run:
+
+    g++ -O2 -pthread -o snake-server server.cpp net.cpp game.cpp replay.cpp autopilot.cpp lockstep.cpp stats.cpp -std=c++11
+    ./snake-server [--addr=PORT|PATH] [--rooms=N] [--tick-ms=N] [--board=WxH] [--seed=N] [--ticks=N]
+                   [--report=N] [--bots=N [--drop=P]]
+
+The server listens on a UDP port of 127.0.0.1 (default 7777), or on a Unix datagram socket when the
+address has a '/' in it, and runs every room on one thread (see net.h). ./snake --connect=ADDR plays
+in a room. Every --report ticks (default a second's worth) it prints the bytes sent and the CPU time
+a room tick took since the last line, and when --ticks ticks are done a table of every room.
+
+--bots=N starts N clients on a second thread of the same process, talking to the server over the
+sockets like any other client: bot i joins room i % rooms, so the first bot of a room plays it
+with the autopilot and some random turns and the others watch. Every bot checks the cells it got
+from the snapshots against the confirmed game, and the players check the confirmed game against the
+server's state hash. --drop=P makes the bots drop that fraction of the snapshots they receive, to
+try the protocol with lost packets. The bots' totals are printed at the end and the exit status is
+non-zero when a check failed, so a loopback run is a test of the whole protocol.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "game.h"
+#include "replay.h"
+#include "autopilot.h"
+#include "net.h"
+
+using namespace std;
+
+
+/* A bot turns somewhere random on one tick in this many, so the games have deaths, resets and late inputs */
+#define BOT_RANDOM_TURN 8
+
+const char *address = NULL;
+int numRooms = 16;
+unsigned long tickMs = 150; // the game's speed 5
+uint64_t seed = 1;
+unsigned long maxTicks = 0;
+unsigned long reportEvery = 0;
+int numBots = 0;
+double dropRate = 0.0;
+
+/*
+ * Function for command line argument error handling
+ */
+void usage(char *argv[]) {
+	cerr << "Usage: " << argv[0] << " [--addr=PORT|PATH (default " << DEFAULT_NET_PORT << ")] [--rooms=N (default 16)] "
+		 << "[--tick-ms=N (default 150)] [--board=WxH (default 40x28)] [--seed=N (default 1)] [--ticks=N (default no end)] "
+		 << "[--report=N ticks] [--bots=N [--drop=P]]" << endl;
+	cerr << "       (boards of up to " << NET_MAX_CELLS << " cells)" << endl;
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Class for a bot: a client and the game it predicts, and what its checks found
+ */
+struct Bot {
+	Bot() : client(game), viewMismatches(0) { }
+
+	GameState game;
+	NetClient client;
+	Autopilot autopilot;
+	Rng rng;
+	unsigned long viewMismatches; // snapshots whose cells were not those of the confirmed game
+};
+
+/*
+ * Function to check the cells a player's bot got from the snapshots against its confirmed game
+ */
+bool viewMatches(const NetClient &client) {
+	const GameState &game = client.getConfirmed();
+	const NetView &view = client.getView();
+	for (int y = 0; y < BoardHeight; y++) {
+		for (int x = 0; x < BoardWidth; x++) {
+			int value = game.getSnake().onSnake(x, y) ? NET_BODY :
+						(game.getObstacles().onObstacles(x, y) ? NET_OBSTACLE : NET_EMPTY);
+			if (view.getCell(x, y) != value) return false;
+		}
+	}
+	return view.getHeadX() == game.getSnake().getHeadX() && view.getHeadY() == game.getSnake().getHeadY() &&
+		   view.getFruitX() == game.getFruit().getX() && view.getFruitY() == game.getFruit().getY() &&
+		   view.getScore() == game.getScore() && view.getNumOfLives() == game.getNumOfLives();
+}
+
+/*
+ * Function for the bots' thread: join, then play on the bots' own clock until quit is set
+ */
+void runBots(vector<Bot *> &bots, atomic<bool> &quit) {
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	for (size_t i = 0; i < bots.size(); i++) {
+		epoll_event event;
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, bots[i]->client.getFd(), &event);
+	}
+
+	unsigned long interval = bots[0]->client.getTickInterval();
+	int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	itimerspec spec;
+	spec.it_value.tv_sec = interval / 1000000;
+	spec.it_value.tv_nsec = (interval % 1000000) * 1000;
+	spec.it_interval = spec.it_value;
+	timerfd_settime(timerFd, 0, &spec, NULL);
+	epoll_event timerEvent;
+	timerEvent.events = EPOLLIN;
+	timerEvent.data.u32 = bots.size();
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &timerEvent);
+
+	epoll_event events[64];
+	while (!quit) {
+		int n = epoll_wait(epollFd, events, 64, 100);
+		for (int e = 0; e < n; e++) {
+			unsigned int i = events[e].data.u32;
+			if (i < bots.size()) {
+				Bot &bot = *bots[i];
+				unsigned long before = bot.client.getView().getTick();
+				bot.client.receive();
+				if (bot.client.isPlayer() && bot.client.getView().getTick() != before && !viewMatches(bot.client)) {
+					bot.viewMismatches++;
+				}
+				continue;
+			}
+
+			uint64_t due;
+			if (read(timerFd, &due, sizeof(due)) != sizeof(due)) continue;
+			for (size_t b = 0; b < bots.size(); b++) {
+				Bot &bot = *bots[b];
+				if (!bot.client.isPlayer()) continue;
+
+				const GameState &game = bot.game;
+				if (game.isGameOver()) {
+					bot.client.input(CMD_RESET);
+				} else {
+					int direction = (bot.rng.below(BOT_RANDOM_TURN) == 0) ? bot.rng.below(4) : bot.autopilot.decide(game);
+					if (direction != NO_INPUT && direction != game.getSnake().getDirection()) bot.client.input(direction);
+				}
+				bot.client.tick();
+			}
+		}
+	}
+
+	for (size_t i = 0; i < bots.size(); i++) {
+		bots[i]->client.leave();
+	}
+	close(timerFd);
+	close(epollFd);
+}
+
+/*
+ * Function to print what the bots counted, returns false when a check failed
+ */
+bool reportBots(const vector<Bot *> &bots) {
+	unsigned long snapshots = 0, keyframes = 0, dropped = 0, bytesReceived = 0, bytesSent = 0;
+	unsigned long inputs = 0, lateInputs = 0, corrections = 0, desyncs = 0, mismatches = 0;
+	Histogram confirmTime;
+	int players = 0;
+	for (size_t i = 0; i < bots.size(); i++) {
+		const NetClient &client = bots[i]->client;
+		snapshots += client.getSnapshots();
+		keyframes += client.getKeyframes();
+		dropped += client.getDropped();
+		bytesReceived += client.getBytesReceived();
+		bytesSent += client.getBytesSent();
+		inputs += client.getNumInputs();
+		lateInputs += client.getLateInputs();
+		corrections += client.getCorrections();
+		desyncs += client.getDesyncs();
+		mismatches += bots[i]->viewMismatches;
+		players += client.isPlayer();
+		confirmTime.merge(client.getConfirmTime());
+	}
+
+	printf("bots: %d players, %d spectators\n", players, (int)bots.size() - players);
+	printf("snapshots: %lu (%lu keyframes, %lu dropped on purpose), %.1f bytes each\n", snapshots, keyframes, dropped,
+		   snapshots ? (double)bytesReceived / snapshots : 0.0);
+	printf("bytes sent by the bots: %lu\n", bytesSent);
+	printf("inputs: %lu, %lu applied at another tick than predicted, predicted game corrected %lu times\n", inputs,
+		   lateInputs, corrections);
+	printf("inputs confirmed by the server after: p50 %.2f ms, p99 %.2f ms\n",
+		   confirmTime.percentile(0.5) / 1e6, confirmTime.percentile(0.99) / 1e6);
+	printf("state hash mismatches: %lu, snapshot cells not matching the confirmed game: %lu\n", desyncs, mismatches);
+	return desyncs == 0 && mismatches == 0;
+}
+
+int main(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--addr=", 7) == 0) {
+			address = argv[i] + 7;
+		} else if (strncmp(argv[i], "--rooms=", 8) == 0) {
+			numRooms = atoi(argv[i] + 8);
+			if (numRooms <= 0) usage(argv);
+		} else if (strncmp(argv[i], "--tick-ms=", 10) == 0) {
+			tickMs = strtoul(argv[i] + 10, NULL, 10);
+			if (tickMs == 0) usage(argv);
+		} else if (strncmp(argv[i], "--board=", 8) == 0) {
+			if (!parseBoardSize(argv[i] + 8) || BoardWidth * BoardHeight > NET_MAX_CELLS) usage(argv);
+		} else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			seed = strtoull(argv[i] + 7, NULL, 10);
+		} else if (strncmp(argv[i], "--ticks=", 8) == 0) {
+			maxTicks = strtoul(argv[i] + 8, NULL, 10);
+		} else if (strncmp(argv[i], "--report=", 9) == 0) {
+			reportEvery = strtoul(argv[i] + 9, NULL, 10);
+		} else if (strncmp(argv[i], "--bots=", 7) == 0) {
+			numBots = atoi(argv[i] + 7);
+			if (numBots < 0) usage(argv);
+		} else if (strncmp(argv[i], "--drop=", 7) == 0) {
+			dropRate = atof(argv[i] + 7);
+			if (dropRate < 0.0 || dropRate >= 1.0) usage(argv);
+		} else {
+			usage(argv);
+		}
+	}
+	if (dropRate > 0.0 && numBots == 0) usage(argv);
+	if (reportEvery == 0) reportEvery = max(1UL, 1000 / tickMs);
+
+	char defaultAddress[16];
+	if (!address) {
+		snprintf(defaultAddress, sizeof(defaultAddress), "%d", DEFAULT_NET_PORT);
+		address = defaultAddress;
+	}
+
+	NetServer server(numRooms, seed, tickMs * 1000);
+	if (!server.listen(address)) {
+		cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "Serving " << numRooms << " rooms of " << BoardWidth << "x" << BoardHeight << " on " << address << ", a tick every "
+		 << tickMs << " ms" << endl;
+
+	/* the bots join from their own thread while the server answers on this one */
+	vector<Bot *> bots;
+	atomic<bool> quit(false);
+	thread botThread;
+	if (numBots > 0) {
+		botThread = thread([&]() {
+			for (int i = 0; i < numBots; i++) {
+				Bot *bot = new Bot();
+				bot->rng.reseed(seed + i);
+				bot->client.setDropRate(dropRate);
+				string error;
+				if (!bot->client.join(address, i % numRooms, 2000, error)) {
+					cerr << "Bot " << i << " cannot join: " << error << endl;
+					exit(EXIT_FAILURE);
+				}
+				bots.push_back(bot);
+			}
+			runBots(bots, quit);
+		});
+	}
+
+	server.run(maxTicks, reportEvery);
+
+	bool ok = true;
+	if (numBots > 0) {
+		quit = true;
+		botThread.join();
+	}
+	server.printReport(stdout);
+	if (numBots > 0) ok = reportBots(bots);
+	for (size_t i = 0; i < bots.size(); i++) {
+		delete bots[i];
+	}
+	return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,299 @@
+/*
+- - - - - - - - - - - - - - - - - - - - - -
+
+Headless simulation of the Snake game engine, no window and no frame pacing.
+
+Commands to compile and run:
+
+    g++ -O2 -o snake-sim sim.cpp game.cpp replay.cpp autopilot.cpp lockstep.cpp -std=c++11
+    ./snake-sim [--board=WxH] [--record=file] [--autopilot] [ticks [seed]]
+    ./snake-sim --replay=file [runs]
+    ./snake-sim --lockstep=N [--check] [--board=WxH] [ticks [seed]]
+
+The snake is driven by a random policy that turns every few ticks, a new game starts whenever the
+current one is over, or by the autopilot with --autopilot. The tool prints the number of ticks and games played and the ticks per second.
+With --record the inputs of the policy are written out in the format of ./snake --record.
+--board sets the board size in cells (default 40x28, up to 4096x4096).
+
+With --replay a recording (from either program) is played back the given number of times as fast as
+the CPU allows, each run printing the ticks per second and a hash of the final state, which is the
+same every run and the same as the one ./snake --replay prints.
+
+With --lockstep N games (seeds seed to seed + N - 1) are played side by side by the lockstep engine
+(lockstep.h) with the random policy until ticks moves were made in total. --check plays the same
+games with GameState as well and compares the events, snake, fruit, score, lives and tick after
+every move, stopping at the first difference.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <time.h>
+
+#include "game.h"
+#include "replay.h"
+#include "autopilot.h"
+#include "lockstep.h"
+
+using namespace std;
+
+
+/*
+ * Function for command line argument error handling
+ */
+void usage(char *argv[]) {
+	cerr << "Usage: " << argv[0] << " [--board=WxH] [--record=file] [--autopilot] [ticks (default 10000000)] "
+		 << "[seed (default 1)]" << endl;
+	cerr << "       " << argv[0] << " --replay=file [runs (default 1)]" << endl;
+	cerr << "       " << argv[0] << " --lockstep=N [--check] [--board=WxH] [ticks (default 10000000)] [seed (default 1)]"
+		 << endl;
+	cerr << "       (boards from " << MIN_BOARD_WIDTH << "x" << MIN_BOARD_HEIGHT << " to " << MAX_BOARD_SIZE << "x"
+		 << MAX_BOARD_SIZE << " cells)" << endl;
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Function to get the microseconds from a monotonic clock
+ */
+unsigned long now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Function to play a recording back runs times, returns the exit status
+ */
+int replayRecording(const char *path, int runs) {
+	Recording recording;
+	if (!recording.load(path)) {
+		cerr << "Cannot read the recording " << path << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "board: " << recording.getBoardWidth() << "x" << recording.getBoardHeight() << endl;
+	cout << "ticks: " << recording.getLength() << endl;
+	cout << "inputs: " << recording.getNumInputs() << endl;
+
+	GameState game;
+	Replay replay(recording);
+	for (int run = 0; run < runs; run++) {
+		unsigned long start = now();
+		replay.restart(game);
+		while (!replay.finished()) {
+			replay.applyInputs(game);
+			game.step(NO_INPUT);
+			replay.moved();
+		}
+		replay.applyInputs(game);
+		unsigned long elapsed = now() - start;
+		if (elapsed == 0) elapsed = 1;
+
+		cout << "run " << run + 1 << ": score " << game.getScore() << ", state hash " << hex << stateHash(game) << dec
+			 << ", ticks/s " << (unsigned long)(recording.getLength() * 1000000.0 / elapsed) << endl;
+	}
+	return 0;
+}
+
+/*
+ * Function to compare lockstep game i with a GameState, prints the first difference and returns false
+ */
+bool sameGame(const LockstepGames &games, int i, const GameState &game) {
+	const Snake &snake = game.getSnake();
+	const char *field = NULL;
+	if (games.isGameOver(i) != game.isGameOver() || games.isGameWon(i) != game.isGameWon()) {
+		field = "game over";
+	} else if (games.getScore(i) != game.getScore() || games.getNumOfLives(i) != game.getNumOfLives()) {
+		field = "score or lives";
+	} else if (games.getTick(i) != game.getTick()) {
+		field = "tick";
+	} else if (games.getFruitX(i) != game.getFruit().getX() || games.getFruitY(i) != game.getFruit().getY() ||
+			   games.getFruitAttribute(i) != game.getFruit().getAttribute()) {
+		field = "fruit";
+	} else if (games.getLength(i) != snake.getLength()) {
+		field = "snake length";
+	} else {
+		for (int j = 0; j < snake.getLength() && !field; j++) {
+			if (games.getBodyCell(i, j) != snake.getCell(j)) field = "snake body";
+		}
+	}
+	if (field) {
+		cerr << "game " << i << " differs in " << field << " at tick " << game.getTick() << endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Function to play numGames games with the lockstep engine, and with GameState too when check is set;
+ *	returns the exit status
+ */
+int runLockstep(int numGames, unsigned long ticks, unsigned int seed, bool check) {
+	LockstepGames games(numGames, seed);
+	vector<GameState> scalar(check ? numGames : 0);
+	vector<Rng> policies(numGames);
+	for (int i = 0; i < numGames; i++) {
+		policies[i].reseed((seed + i) ^ 0x5deece66dULL);
+		if (check) scalar[i].reset(seed + i);
+	}
+	vector<int> inputs(numGames), events(numGames);
+
+	unsigned long steps = ticks / numGames;
+	unsigned long finished = 0;
+	unsigned long start = now();
+	for (unsigned long s = 0; s < steps; s++) {
+		for (int i = 0; i < numGames; i++) {
+			inputs[i] = (policies[i].below(8) == 0) ? policies[i].below(4) : NO_INPUT;
+		}
+		games.step(inputs.data(), events.data());
+
+		for (int i = 0; i < numGames; i++) {
+			if (check) {
+				int expected = scalar[i].step(inputs[i]);
+				if (events[i] != expected) {
+					cerr << "game " << i << " events " << events[i] << " instead of " << expected << " at tick "
+						 << scalar[i].getTick() << endl;
+					return EXIT_FAILURE;
+				}
+				if (!sameGame(games, i, scalar[i])) return EXIT_FAILURE;
+			}
+			if (games.isGameOver(i)) {
+				finished++;
+				games.reset(i);
+				if (check) scalar[i].reset();
+			}
+		}
+	}
+	unsigned long elapsed = now() - start;
+	if (elapsed == 0) elapsed = 1;
+
+	cout << "kernel: " << (LockstepGames::usingAvx2() ? "avx2" : "scalar") << endl;
+	cout << "board: " << BoardWidth << "x" << BoardHeight << endl;
+	cout << "lockstep games: " << numGames << endl;
+	cout << "ticks: " << steps * numGames << endl;
+	cout << "finished games: " << finished << endl;
+	cout << "elapsed: " << elapsed / 1000.0 << " ms" << endl;
+	cout << "ticks/s: " << (unsigned long)(steps * numGames * 1000000.0 / elapsed) << endl;
+	if (check) cout << "check: every game matched GameState after every move" << endl;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long ticks = 10000000;
+	unsigned int seed = 1;
+	const char *recordPath = NULL;
+	const char *replayPath = NULL;
+	bool useAutopilot = false;
+	int numLockstep = 0;
+	bool check = false;
+	bool boardSet = false;
+
+	/* Handle the --options first */
+	int numArgs = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--record=", 9) == 0) {
+			recordPath = argv[i] + 9;
+		} else if (strncmp(argv[i], "--replay=", 9) == 0) {
+			replayPath = argv[i] + 9;
+		} else if (strcmp(argv[i], "--autopilot") == 0) {
+			useAutopilot = true;
+		} else if (strncmp(argv[i], "--lockstep=", 11) == 0) {
+			numLockstep = atoi(argv[i] + 11);
+			if (numLockstep <= 0) usage(argv);
+		} else if (strcmp(argv[i], "--check") == 0) {
+			check = true;
+		} else if (strncmp(argv[i], "--board=", 8) == 0) {
+			if (!parseBoardSize(argv[i] + 8)) usage(argv);
+			boardSet = true;
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			usage(argv);
+		} else {
+			argv[numArgs++] = argv[i];
+		}
+	}
+	argc = numArgs;
+
+	if (replayPath) {
+		if (recordPath || boardSet || argc > 2) usage(argv); // the board comes from the recording
+		int runs = (argc == 2) ? atoi(argv[1]) : 1;
+		if (runs <= 0) usage(argv);
+		return replayRecording(replayPath, runs);
+	}
+
+	switch (argc) {
+		case 3:
+			seed = strtoul(argv[2], NULL, 10);
+			// FALL THROUGH
+		case 2:
+			ticks = strtoul(argv[1], NULL, 10);
+			if (ticks == 0) usage(argv);
+			// FALL THROUGH
+		case 1:
+			break;
+		default:
+			usage(argv);
+	}
+
+	if (check && !numLockstep) usage(argv);
+	if (numLockstep) {
+		if (recordPath || useAutopilot) usage(argv);
+		return runLockstep(numLockstep, ticks, seed, check);
+	}
+
+	GameState game(seed);
+	Rng policy(seed + 1); // the policy's own numbers, so recording it does not change the games
+	Autopilot autopilot;
+	Recording recording;
+	recording.start(seed, 5);
+
+	unsigned long games = 1;
+	unsigned long wins = 0;
+	unsigned long totalScore = 0;
+	unsigned int bestScore = 0;
+
+	unsigned long start = now();
+	for (unsigned long i = 0; i < ticks; i++) {
+		int input = NO_INPUT;
+		if (useAutopilot) {
+			input = autopilot.decide(game);
+			if (input == game.getSnake().getDirection()) input = NO_INPUT;
+		} else if (policy.below(8) == 0) { // turn now and then
+			input = policy.below(4);
+		}
+		if (input != NO_INPUT) {
+			if (recordPath) recording.add(i, input);
+			game.changeDirection(input);
+		}
+		game.step(NO_INPUT);
+
+		if (game.isGameOver()) {
+			if (game.isGameWon()) wins++;
+			totalScore += game.getScore();
+			if (game.getScore() > bestScore) bestScore = game.getScore();
+			if (recordPath) recording.add(i + 1, CMD_RESET);
+			game.reset();
+			games++;
+		}
+	}
+	unsigned long elapsed = now() - start;
+	if (elapsed == 0) elapsed = 1;
+
+	cout << "board: " << BoardWidth << "x" << BoardHeight << endl;
+	cout << "ticks: " << ticks << endl;
+	cout << "games: " << games << endl;
+	cout << "wins: " << wins << endl;
+	cout << "best score: " << bestScore << endl;
+	cout << "average score: " << (double)totalScore / games << endl;
+	cout << "elapsed: " << elapsed / 1000.0 << " ms" << endl;
+	cout << "ticks/s: " << (unsigned long)(ticks * 1000000.0 / elapsed) << endl;
+	cout << "state hash: " << hex << stateHash(game) << dec << endl;
+
+	if (recordPath) {
+		recording.finish(ticks);
+		if (!recording.save(recordPath)) {
+			cerr << "Cannot write " << recordPath << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	return 0;
+}
@@ -3,7 +3,7 @@
 
 Commands to compile and run:
 
-    g++ -o snake snake.cpp -L/usr/X11R6/lib -lX11 -lstdc++
+    g++ -O2 -pthread -o snake snake.cpp game.cpp replay.cpp autopilot.cpp lockstep.cpp arena.cpp camera.cpp net.cpp raster.cpp render.cpp stats.cpp -L/usr/X11R6/lib -lX11 -lXext -lstdc++
     ./snake
 
 Note: the -L option and -lstdc++ may not be needed on some machines.
@@ -19,6 +19,7 @@ Note: the -L option and -lstdc++ may not be needed on some machines.
 
 #include <iostream>
 #include <list>
+#include <algorithm>
 #include <cstdlib>
 #include <sys/time.h>
 #include <math.h>
@@ -28,42 +29,48 @@ Note: the -L option and -lstdc++ may not be needed on some machines.
 #include <time.h>
 #include <cstring>
 #include <string>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <thread>
 
 /*
  * Header files for X functions
  */
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/Xdbe.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "game.h"
+#include "replay.h"
+#include "autopilot.h"
+#include "arena.h"
+#include "camera.h"
+#include "net.h"
+#include "render.h"
+#include "stats.h"
 
 using namespace std;
 
 
 /*
- * Macros for directions
+ * Macros for colours, as 0xRRGGBB
  */
-#define UP 0
-#define DOWN 1
-#define RIGHT 2
-#define LEFT 3
-
-/* 
- * Macros for graphic context
- */
-#define GENERAL_GC 0
-#define GREEN_GC 1
-#define BLUE_GC 2
-#define TOMATO_GC 3
-#define GRAY_GC 4
-#define DIMGRAY_GC 5
-#define DARKKHAKI 6
-
-/*
- * Macros for fonts
- */
-#define NEW_CENT_FT 0
-#define TIMES_FT 1
-#define UTOPIA_FT 2
-#define UTOPIA_S_FT 3
+#define WHITE_COLOR 0xFFFFFF
+#define GREEN_COLOR 0x008000
+#define BLUE_COLOR 0x1E90FF
+#define TOMATO_COLOR 0xFF6347
+#define GRAY_COLOR 0x808080
+#define DIMGRAY_COLOR 0x696969
+#define DARKKHAKI_COLOR 0xBDB76B
+#define BACKGROUND_COLOR 0x000000
+#define GOLD_COLOR 0xFFD700
+#define TURQUOISE_COLOR 0x40E0D0
+#define ALMOND_COLOR 0xFFEBCD
 
 /*
  * Macros for different stage of the game
@@ -73,20 +80,27 @@ using namespace std;
 #define PAUSE_STG 0x4
 #define GAMEOVER_STG 0x8
 
-/* 
- * Macros for different kind of fruits
+/*
+ * Macros for where a frame is drawn before it shows up in the window
  */
-#define NORMAL_FRT 0
-#define HEART_FRT 1
-#define EVIL_FRT 2
+#define DIRECT_BUF 0 // straight onto the window, the window is cleared between frames
+#define PIXMAP_BUF 1 // into an off-screen pixmap, copied to the window once per frame
+#define DBE_BUF 2    // into an XDBE back buffer, swapped once per frame
+#define FRAMEBUFFER_BUF 3 // by the CPU into an image (raster.h), put to the window once per frame
 
 /*
- * Macros for some varibale limits
+ * Macros for the fields of the HUD, the bar above the play region
  */
-#define MAX_LIVES 5
-#define MAX_OBSTACLES 12
-#define MIN_OBSTACLES 5
+#define SCORE_HUD 0
+#define LIVES_HUD 1
+#define KEYS_HUD 2
+#define NUM_HUD_FIELDS 3
 
+/* The longest text a HudText holds, with the terminating zero */
+#define HUD_TEXT_SIZE 64
+
+/* The most ticks run in one go after the loop was held up, e.g. the process was stopped */
+#define MAX_CATCHUP_TICKS 25
 
 /*
  * Global game state variables
@@ -95,34 +109,42 @@ const int Border = 10;
 const int BufferSize = 10;
 const int width = 800;
 const int height = 600;
-const int BlockSize = 20;
+const int DefaultBlockSize = 20; // pixels a cell takes on the default board, and on the start screen
+const int MinBlockSize = 4;
+int BlockSize = DefaultBlockSize; // pixels a cell takes, set for the board by initBoardLayout()
 int FPS = 30;
 int speed = 5;
 
 /* The region actual start and end pixel */
 const int RegionStartX = 0;
-const int RegionStartY = BlockSize * 2;
+const int RegionStartY = DefaultBlockSize * 2;
 const int RegionEndX = width;
 const int RegionEndY = height;
 
-/* Store the current x and y speed when pause and load back when resume */
-int curXspeed = 0;
-int curYspeed = 0;
-
 /* Keep track of last time enter/leave notify flag */
 int lastEnterLeaveNotify = 0;
 
-/* Keep track of last time a special fruit generated, it will disappear in a while depends on the snake speed */
-unsigned long lastTimeSpecialFruit = 0;
+/* All the game rules and state live in the headless engine, see game.h */
+GameState game;
+
+/* The cells on screen, the whole board unless it is too big for the window, see initBoardLayout() */
+Camera camera;
 
 /*
- * Keep track of the time that has passed since the last special fruit generated to get the same remaining time
- *	after pause and resume
+ * --arena=N plays in an arena with N AI snakes instead of the game above, on an ArenaBoardSize square board
+ *	unless --board gives another
  */
-unsigned long SpecialFruitTimeUsed = 0;
+const int ArenaBoardSize = 256;
+int arenaSnakes = 0;
+Arena *arena = NULL;
 
-unsigned int score = 0;
-unsigned int numOfLives = 3;
+/*
+ * --connect=ADDR plays in a room of a snake-server (net.h) instead: the game above is the one the client
+ *	predicts, and the server's tick interval sets the speed
+ */
+const char *connectAddress = NULL;
+int connectRoom = 0;
+NetClient *net = NULL;
 
 /* stage indicates the current stage of the game (start, playing, pause, gameover) */
 int curStage = 0;
@@ -130,6 +152,91 @@ int curStage = 0;
 /* enable to 1 to have output */
 int verbose = 0;
 
+/* the buffer mode wanted, falls back to PIXMAP_BUF when the server has no XDBE or the screen no 24 bit TrueColor */
+int bufferMode = DBE_BUF;
+
+/* what the frames are drawn with, see render.h; the framebuffer backend also as itself for its completion events */
+class ShmRenderer;
+Renderer *renderer = NULL;
+ShmRenderer *shmRenderer = NULL;
+
+/* enable to 1 to draw with the null backend, no X connection, for --bench-frames */
+int nullRenderer = 0;
+
+/* where --ppm writes the last frame drawn by the offscreen backend, no X connection, for --bench-frames */
+const char *ppmPath = NULL;
+
+/* enable to 1 to repaint only what changed since the last frame, needs a buffer that keeps its contents */
+int damageMode = 1;
+
+/* set when the whole frame has to be repainted, e.g. the window was exposed */
+bool needFullRepaint = true;
+
+/* the stage shown by the last repaint */
+int lastStage = -1;
+
+/*
+ * enable to 1 to draw the snake head and tail sliding between cells, interpolated by how far the time is
+ *	into the current tick; it repaints the whole frame every time
+ */
+int smooth = 0;
+
+/* Interpolation state for smooth: fraction of the tick interval passed, whether the last tick moved the snake,
+ *	and the tail cell the last move left */
+double tickProgress = 1.0;
+bool lastTickMoved = false;
+Block prevTail(0, 0);
+
+/*
+ * With --stats the timings of every frame and tick go into these and are written to statsPath on exit
+ */
+const char *statsPath = NULL;
+Stats stats;
+Histogram *eventTime = NULL;
+Histogram *moveTime = NULL;
+Histogram *frameTime = NULL;
+Histogram *flushTime = NULL;
+Histogram *tickTime = NULL;
+Histogram *autopilotTime = NULL;
+Histogram *tickOvershootTime = NULL;
+Histogram *renderOvershootTime = NULL;
+unsigned long *frameCount = NULL;
+unsigned long *tickCount = NULL;
+unsigned long *tickMisses = NULL;
+unsigned long *renderMisses = NULL;
+unsigned long *droppedTicks = NULL;
+
+/* enable to 1 to print the frame time and X requests per frame every second */
+int reportFrames = 0;
+
+/* the number of frames --bench-frames renders before exiting, 0 to play */
+int benchFrameCount = 0;
+
+/* the seed of the first game, --seed or the time */
+uint64_t seed = 0;
+bool haveSeed = false;
+
+/* set when --board gave the board size in cells, the default is DEFAULT_BOARD_WIDTH x DEFAULT_BOARD_HEIGHT */
+bool boardSet = false;
+
+/*
+ * --record keeps every input that reaches the engine and writes it to recordPath on exit, --replay plays a
+ *	recording back at replaySpeed times the recorded speed instead of taking input
+ */
+const char *recordPath = NULL;
+const char *replayPath = NULL;
+double replaySpeed = 1.0;
+Recording recording;
+Replay *replay = NULL;
+bool replayDone = false;
+
+/* enable to 1 to let the autopilot steer, the arrow keys still work in between its moves */
+int autopilotMode = 0;
+Autopilot autopilot;
+
+/* the snake moves made since the program started, what the recorded inputs are tagged with */
+unsigned long sessionTick = 0;
+
 /*
  * Information to draw on the window.
  */
@@ -137,8 +244,7 @@ struct XInfo {
 	Display	 *display;
 	int		 screen;
 	Window	 window;
-	GC		 gc[7];
-	XFontStruct  *font[4];
+	XFontStruct  *font[NUM_FONTS];
 	int		width;		// size of window
 	int		height;
 };
@@ -147,7 +253,11 @@ struct XInfo {
  * Function for command line argument error handling
  */
 void usage(char *argv[]) {
-    cerr << "Usage: " << argv[0] << " frame rate (1 <= frame rate <= 100, default 30)  " << // output the error msg
+    cerr << "Usage: " << argv[0] << " [--direct | --no-dbe | --framebuffer] [--full-repaint] [--smooth] [--report] [--stats[=file]] " <<
+    "[--bench-frames=N [--null-renderer | --ppm=file]] " <<
+    "[--seed=N] [--board=WxH] [--record=file | --replay=file [--replay-speed=X]] [--autopilot] [--arena=N] " <<
+    "[--connect=PORT|PATH [--room=N]] " <<
+    "frame rate (1 <= frame rate <= 360, default 30)  " << // output the error msg
     "speed (1 <= speed <= 10, default 5)" << endl;
     exit(EXIT_FAILURE); // TERMINATE
 } // usage
@@ -160,36 +270,110 @@ void error( string str ) {
   exit(0);
 }
 
-/* 
- * Function to round the value to the BlockSize
+/*
+ * Function to size the cells for the board: as big as fit in the play region, but at least MinBlockSize
+ *	pixels, and to point the camera at the cells that fit, the last row and column in view can be cut
+ *	off by the edge of the window
  */
-int roundBlockSize(int value) {
-	return (value / BlockSize) * BlockSize + (((value % BlockSize) > (BlockSize / 2)) ? 1 : 0)  * BlockSize;
+void initBoardLayout() {
+	BlockSize = min((RegionEndX - RegionStartX) / BoardWidth, (RegionEndY - RegionStartY) / BoardHeight);
+	if (BlockSize < MinBlockSize) BlockSize = MinBlockSize;
+	camera.setView((RegionEndX - RegionStartX + BlockSize - 1) / BlockSize, (RegionEndY - RegionStartY + BlockSize - 1) / BlockSize);
 }
 
 /*
- * Function to module the value with respect to the region start and region end, which is in a region [start, end)
+ * Functions to get the pixel position of a board cell, only meaningful for the cells in view
  */
-int MyMod(int start, int end, int value) {
-	if (value >= start) {
-		int mod = value % end;
-		return (mod < start) ? (mod + start) : mod;
-	} else if (value >= 0) {
-		return end - start + (abs(value) % end);
-	} else { // value < 0, this case is only possible for x coord (start = 0)
-		return end - (abs(value) % end);
-	}
+int cellToPixelX(int x) {
+	return RegionStartX + camera.viewX(x) * BlockSize;
+}
+
+int cellToPixelY(int y) {
+	return RegionStartY + camera.viewY(y) * BlockSize;
+}
+
+/*
+ * Functions to get what the displays show of the player's game, the one game or the player's snake in the arena
+ */
+const Obstacles &shownObstacles() {
+	return arena ? arena->getObstacles() : game.getObstacles();
+}
+
+unsigned int shownScore() {
+	return arena ? arena->getSnake(PLAYER_SNAKE).getScore() : game.getScore();
+}
+
+unsigned int shownLives() {
+	return arena ? arena->getNumOfLives() : game.getNumOfLives();
 }
 
 /*
- * Function to get the microseconds
+ * Function to get the microseconds from the monotonic clock, it does not jump when the wall clock is changed
  */
 unsigned long now() {
-	timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000000 + tv.tv_usec;
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+/*
+ * Class for a periodic CLOCK_MONOTONIC timerfd, it also keeps track of how late each expiration is handled
+ */
+class DeadlineTimer {
+public:
+	DeadlineTimer() {
+		fd = -1;
+	}
+
+	/* Method to start the timer, the first deadline is one interval from now */
+	void start(unsigned long intervalUs) {
+		fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0) error("Cannot create a timerfd.");
+
+		interval = intervalUs;
+		first = now() + interval;
+		expirations = 0;
+
+		itimerspec spec;
+		spec.it_value.tv_sec = first / 1000000;
+		spec.it_value.tv_nsec = (first % 1000000) * 1000;
+		spec.it_interval.tv_sec = interval / 1000000;
+		spec.it_interval.tv_nsec = (interval % 1000000) * 1000;
+		timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	}
+
+	/* Method to consume the expirations when the fd is readable, returns how many deadlines have passed */
+	unsigned long expire() {
+		uint64_t count;
+		if (read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+		expirations += count;
+		overshoot = now() - (first + (expirations - 1) * interval); // how late the latest deadline is handled
+		return count;
+	}
+
+	/* Method to get how far the time is from the latest deadline to the next one, between 0 and 1 */
+	double progress() {
+		if (expirations == 0) return 1.0;
+		double p = (double)(now() - (first + (expirations - 1) * interval)) / interval;
+		return (p < 0.0) ? 0.0 : ((p > 1.0) ? 1.0 : p);
+	}
+
+	int getFd() {
+		return fd;
+	}
+
+	unsigned long getOvershoot() {
+		return overshoot;
+	}
+
+private:
+	int fd;
+	unsigned long interval;   // in microseconds
+	unsigned long first;      // first deadline on the monotonic clock
+	unsigned long expirations;
+	unsigned long overshoot;
+};
+
 /* 
  * Function to load the fonts from the machine, if cannot find, use the fixed font
  */
@@ -223,248 +407,333 @@ void loadFonts(XInfo &xinfo) {
     }
 }
 
-/* 
- * Function to set a graphic context with a specified font
- */
-void setFont(XInfo &xinfo, int gc, int font) {
-    XSetFont(xinfo.display, xinfo.gc[gc], xinfo.font[font]->fid);
-}
-
 /*
- * An abstract class representing displayable things. 
+ * An abstract class representing displayable things.
  */
 class Displayable {
 	public:
-		virtual void paint(XInfo &xinfo) = 0;
+		Displayable() {
+			paintTime = NULL;
+		}
+		virtual void paint(Renderer &r) = 0;
+		/* Method to paint only what is on one board cell, used by the incremental repaint */
+		virtual void paintCell(Renderer &r, int x, int y) { }
+		/* Method to tell if paint() covers the whole window, so the buffer needs no clearing first */
+		virtual bool coversFrame() {
+			return false;
+		}
 		int getStage() {
 			return stage;
 		}
+		const char *getName() {
+			return name;
+		}
+		Histogram *paintTime; // where the paint time goes with --stats, NULL otherwise
 	protected:
 		int stage;
+		const char *name;
 };
 
 /*
- * Class to create each single obstable with a random length in a random side of the window
+ * Class for a layer rendered once by the renderer and then copied into the frame,
+ * until the key it was rendered for changes
  */
-class Obstacle : public Displayable {
+class CachedLayer {
 public:
-	virtual void paint(XInfo &xinfo) {
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[DARKKHAKI], x, y, xLength, yLength);
+	CachedLayer() {
+		layer = -1;
+		key = 0;
 	}
 
-	Obstacle() {
-		stage = PLAY_STG;
-
-		unsigned int length = rand() % MAX_OBSTACLES;
-		length = (length >= MIN_OBSTACLES) ? length : (length + MIN_OBSTACLES);
-		length = length * BlockSize;
-
-		baseSide = rand() % 4;
-
-		switch (baseSide) {
-			case UP:
-				x = MyMod(RegionStartX, RegionEndX, roundBlockSize(rand() % (RegionEndX - BlockSize))); 
-				y = RegionStartY;
-				xLength = BlockSize;
-				yLength = length;
-				break;
-			case DOWN:
-				x = MyMod(RegionStartX, RegionEndX, roundBlockSize(rand() % (RegionEndX - BlockSize))); 
-				y = RegionEndY-length;
-				xLength = BlockSize;
-				yLength = length;
-				break;
-			case LEFT:
-				x = RegionStartX;
-				y = MyMod(RegionStartY, RegionEndY, roundBlockSize(rand() % (RegionEndY - BlockSize)));
-				xLength = length;
-				yLength = BlockSize;
-				break;
-			case RIGHT:
-				x = RegionEndX-length;
-				y = MyMod(RegionStartY, RegionEndY, roundBlockSize(rand() % (RegionEndY - BlockSize)));
-				xLength = length;
-				yLength = BlockSize;
-				break;
+	/* Method to check if the layer has to be rendered again for this key, creates the layer the first time */
+	bool isStale(Renderer &r, unsigned long newKey) {
+		if (layer < 0) {
+			layer = r.createLayer();
+		} else if (newKey == key) {
+			return false;
 		}
+		key = newKey;
+		return true;
 	}
 
-	int getX() {
-		return x;
-	}
-
-	int getY() {
-		return y;
+	/* Methods to paint into the layer instead of the frame, and back */
+	void begin(Renderer &r) {
+		r.beginLayer(layer);
 	}
 
-	int getXLength() {
-		return xLength;
+	void end(Renderer &r) {
+		r.endLayer();
 	}
 
-	int getYLength() {
-		return yLength;
+	/* Method to copy part of the layer to the same place in the frame */
+	void copy(Renderer &r, int x, int y, int w, int h) {
+		r.copyLayer(layer, x, y, w, h);
 	}
 
 private:
-	unsigned int baseSide; // UP, DOWN, LEFT, RIGHT
-	unsigned int x;
-	unsigned int y;
-	unsigned int xLength;
-	unsigned int yLength;
+	int layer;
+	unsigned long key;
 };
 
 /*
- * Class to create, manage, and display a list of Obstables
+ * Class for a text with a number in it, formatted into a buffer of its own and only when the number changes,
+ *	so drawing it allocates nothing
  */
-class Obstacles : public Displayable {
+class HudText {
 public:
-	virtual void paint(XInfo &xinfo) {
-		for (unsigned i = 0; i < numOfObs; i++) {
-			obs[i].paint(xinfo);
-		}
+	/* the format has one %ld for the value, or none for a text that never changes */
+	HudText(const char *format) {
+		this->format = format;
+		value = 0;
+		length = -1;
 	}
 
-	/* Method to generate a list of random obstables */
-	void generateObstacles() {
-		delete [] obs;
-
-		numOfObs = rand() % MAX_OBSTACLES;
-		numOfObs = (numOfObs >= MIN_OBSTACLES) ? numOfObs : (numOfObs + MIN_OBSTACLES);
+	/* Method to format the text for a value, returns true if it is not the value formatted last */
+	bool set(long newValue) {
+		if (length >= 0 && newValue == value) return false;
+		value = newValue;
+		length = min(snprintf(text, HUD_TEXT_SIZE, format, value), HUD_TEXT_SIZE - 1);
+		return true;
+	}
 
-		obs = new Obstacle[numOfObs];
-		for (unsigned i = 0; i < numOfObs; i++) {
-			obs[i] = Obstacle();
-		}
+	void draw(Renderer &r, int font, int x, int y, uint32_t color) {
+		r.drawText(font, x, y, text, length, color);
 	}
 
-	Obstacles() {
-		stage = PLAY_STG;
-		numOfObs = 0;
-		generateObstacles();
+private:
+	const char *format;
+	long value;
+	char text[HUD_TEXT_SIZE];
+	int length;	// -1 until the first value is formatted
+};
+
+/*
+ * Class for a field of the HUD: an area of the bar above the play region, pre-rendered into the HUD layer for
+ *	the value it shows and rendered again only when that value changes
+ */
+class HudField {
+public:
+	HudField() {
+		value = 0;
+		rendered = false;
 	}
 
-	~Obstacles() {
-		delete [] obs;
+	void setBox(int x, int y, int w, int h) {
+		box.x = x;
+		box.y = y;
+		box.width = w;
+		box.height = h;
 	}
 
-	int getNumOfObs() {
-		return numOfObs;
+	/* Method to check if the field has to be rendered again for a value, it is taken as rendered after that */
+	bool isStale(long newValue) {
+		if (rendered && newValue == value) return false;
+		value = newValue;
+		rendered = true;
+		return true;
 	}
 
-	Obstacle* getObs() {
-		return obs;
+	const RenderRect &getBox() const {
+		return box;
 	}
 
 private:
-	Obstacle *obs;
-	unsigned int numOfObs;
+	RenderRect box;
+	long value;
+	bool rendered;
 };
 
 /*
- * Class for the display to generate the fruits and display it in the window
+ * Function to draw a whole C string
  */
-class Fruit : public Displayable {
+void drawString(Renderer &r, int font, int x, int y, const char *text, uint32_t color) {
+	r.drawText(font, x, y, text, strlen(text), color);
+}
+
+/*
+ * Class for the display of the obstacles
+ */
+class ObstaclesDisplay : public Displayable {
 public:
-	virtual void paint(XInfo &xinfo) {
-		if (attribute == NORMAL_FRT) {
-			XFillArc(xinfo.display, xinfo.window, xinfo.gc[BLUE_GC], x, y, BlockSize, BlockSize, 0, 360*64);
-		} else {
-			unsigned long turquoise = 0x40E0D0;
-			unsigned long dodgerblue = 0x1E90FF;
-			XSetForeground(xinfo.display, xinfo.gc[BLUE_GC], turquoise);
-			XDrawArc(xinfo.display, xinfo.window, xinfo.gc[BLUE_GC], x, y, BlockSize-4, BlockSize-4, 0, 360*64);
-			XSetForeground(xinfo.display, xinfo.gc[BLUE_GC], dodgerblue);
+	/*
+	 * The obstacles in view only change when they are generated again or the camera moves,
+	 *	the play region is one copy from the layer
+	 */
+	virtual void paint(Renderer &r) {
+		unsigned long key = shownObstacles().getGeneration() * BoardWidth * BoardHeight + cellIndex(camera.getX(), camera.getY());
+		if (layer.isStale(r, key)) {
+			layer.begin(r);
+			render(r);
+			layer.end(r);
 		}
+		layer.copy(r, RegionStartX, RegionStartY, RegionEndX - RegionStartX, RegionEndY - RegionStartY);
 	}
 
-	Fruit() {
-		// generate the x and y value for the fruit
-		x = 540;
-		y = 300;
-		attribute = NORMAL_FRT;
+	virtual void paintCell(Renderer &r, int x, int y) {
+		if (shownObstacles().onObstacles(x, y)) {
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize, BlockSize, DARKKHAKI_COLOR);
+		}
+	}
 
+	ObstaclesDisplay() {
 		stage = PLAY_STG;
-
-		srand(time(0)); // random number seed
+		name = "obstacles";
 	}
 
-	int getX() {
-		return x;
+private:
+	/* Method to paint the play region background and the obstacle cells in view */
+	void render(Renderer &r) {
+		r.fillRect(RegionStartX, RegionStartY, RegionEndX - RegionStartX, RegionEndY - RegionStartY, BACKGROUND_COLOR);
+
+		const Obstacles &obstacles = shownObstacles();
+		forEachCellInView(camera, obstacles.getCovered(), obstacles.getTiles(), [&](int x, int y) {
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize, BlockSize, DARKKHAKI_COLOR);
+		});
 	}
 
-	int getY() {
-		return y;
-	}
+	CachedLayer layer;
+};
 
-	int getAttribute() {
-		return attribute;
+/*
+ * Class for the display of the fruit
+ */
+class FruitDisplay : public Displayable {
+public:
+	virtual void paint(Renderer &r) {
+		const Fruit &fruit = game.getFruit();
+		if (!camera.inView(fruit.getX(), fruit.getY())) return;
+		int x = cellToPixelX(fruit.getX());
+		int y = cellToPixelY(fruit.getY());
+		if (fruit.getAttribute() == NORMAL_FRT) {
+			r.fillArc(x, y, BlockSize, BlockSize, BLUE_COLOR);
+		} else {
+			/* inset so the 3 pixel stroke, centred on the box edge, stays inside the cell a damage repaint clears */
+			r.drawArc(x + 2, y + 2, BlockSize-4, BlockSize-4, 3, TURQUOISE_COLOR);
+		}
 	}
 
-	/* Method to randomly generate a random kind of fruit */
-	void generateNewFruit(int &new_x, int &new_y) {
-		new_x = roundBlockSize(rand() % (width - BlockSize));
-		new_y = roundBlockSize(rand() % (height - BlockSize));
-		x = new_x;
-		y = new_y;
-
-		int chance = rand() % 10;
-		if (chance > 8) { // 1/10 chance evil fruit
-			attribute = EVIL_FRT;
-		} else if (chance > 6) { // 2/10 chance heart fruit
-			attribute = HEART_FRT;
-		} else { // 7/10 chance normal fruit
-			attribute = NORMAL_FRT;
+	virtual void paintCell(Renderer &r, int x, int y) {
+		const Fruit &fruit = game.getFruit();
+		if (fruit.getX() == x && fruit.getY() == y) {
+			paint(r);
 		}
 	}
 
-private:
-	int x;
-	int y;
-	int attribute; // 0 - normal fruit, 1 - heart fruit (increse lives by 1), 2 - evil fruit (decrease by 1)
+	FruitDisplay() {
+		stage = PLAY_STG;
+		name = "fruit";
+	}
 };
 
 /*
- * Class for the display to show the current score, number of lives left, snake moving speed, and FPS
+ * Class for the display to show the current score, number of lives left, snake moving speed, and FPS.
+ *	The score, lives and key hints are HUD fields copied from a layer, the speed and FPS are drawn over
+ *	the play region.
  */
 class ScoreDisplay : public Displayable {
 public:
-	virtual void paint(XInfo &xinfo) {
-		XDrawLine(xinfo.display, xinfo.window, xinfo.gc[GENERAL_GC], 0, RegionStartY-1, width, RegionStartY-1);
+	virtual void paint(Renderer &r) {
+		r.drawLine(0, RegionStartY-1, width, RegionStartY-1, WHITE_COLOR);
+		for (int i = 0; i < NUM_HUD_FIELDS; i++) {
+			update(r, i);
+			const RenderRect &box = fields[i].getBox();
+			r.copyLayer(layer, box.x, box.y, box.width, box.height);
+		}
+		paintBottom(r);
+	}
 
-		setFont(xinfo, TOMATO_GC, NEW_CENT_FT);
-		string scoreStr = "Score : " + to_string(score);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 20, 29, scoreStr.c_str(), scoreStr.length());
+	/* The speed and FPS text sit on top of the play region, redraw the part inside a changed cell */
+	virtual void paintCell(Renderer &r, int x, int y) {
+		RenderRect cell = { cellToPixelX(x), cellToPixelY(y), BlockSize, BlockSize };
+		if (cell.x + cell.width <= bottomBox.x || cell.y + cell.height <= bottomBox.y) return;
 
+		r.setClip(cell.x, cell.y, cell.width, cell.height);
+		paintBottom(r);
+		r.clearClip();
+	}
 
-		unsigned i = numOfLives-1;
-		for (unsigned j = 0; j < numOfLives && j < MAX_LIVES; j++) {
-			short k = j * 35; // because XPoint has type short
-			XPoint points[10] = {{(short)(250+k), 20}, {(short)(255+k), 15}, {(short)(260+k), 15}, {(short)(263+k), 18}, {(short)(263+k), 22},
-								 {(short)(250+k), 35}, {(short)(237+k), 22}, {(short)(237+k), 18}, {(short)(240+k), 15}, {(short)(245+k), 15}};
-			XFillPolygon(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], points, 10, Nonconvex, CoordModeOrigin);			
+	/*
+	 * Method to repaint the HUD fields whose values changed since the last paint, returns how many there were
+	 *	and puts the areas they cover in rects
+	 */
+	int paintChanged(Renderer &r, RenderRect rects[]) {
+		int numRects = 0;
+		for (int i = 0; i < NUM_HUD_FIELDS; i++) {
+			if (!update(r, i)) continue;
+			const RenderRect &box = fields[i].getBox();
+			r.copyLayer(layer, box.x, box.y, box.width, box.height);
+			rects[numRects++] = box;
 		}
+		return numRects;
+	}
 
-		setFont(xinfo, GRAY_GC, TIMES_FT);
+	ScoreDisplay() : scoreText("Score : %ld"), speedText("Speed: %ld"), FPSText("FPS: %ld") {
+		stage = PLAY_STG;
+		name = "score";
+		layer = -1;
+		fields[SCORE_HUD].setBox(0, 0, 230, RegionStartY-1);
+		fields[LIVES_HUD].setBox(230, 0, 270, RegionStartY-1);
+		fields[KEYS_HUD].setBox(500, 0, width - 500, RegionStartY-1);
+		bottomBox.x = 700;
+		bottomBox.y = 550;
+		bottomBox.width = width - 700;
+		bottomBox.height = height - 550;
+	}
 
-		string text = "Press  p - pause,  r - restart,  q - quit";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[GRAY_GC], 520, 29, text.c_str(), text.length());
-	
-		string speedStr = "Speed: " + to_string(speed);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[GRAY_GC], 710, 570, speedStr.c_str(), speedStr.length());
+private:
+	/* Method to get the value a HUD field shows */
+	long fieldValue(int field) {
+		switch (field) {
+			case SCORE_HUD:
+				return shownScore();
+			case LIVES_HUD:
+				return shownLives();
+			default:
+				return 0; // the key hints never change
+		}
+	}
 
-		string FPSStr = "FPS: " + to_string(FPS);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[GRAY_GC], 710, 595, FPSStr.c_str(), FPSStr.length());
+	/* Method to render a HUD field into the layer again if its value changed, returns true if it did */
+	bool update(Renderer &r, int field) {
+		if (layer < 0) layer = r.createLayer();
+		long value = fieldValue(field);
+		if (!fields[field].isStale(value)) return false;
+
+		const RenderRect &box = fields[field].getBox();
+		r.beginLayer(layer);
+		r.fillRect(box.x, box.y, box.width, box.height, BACKGROUND_COLOR);
+		if (field == SCORE_HUD) {
+			scoreText.set(value);
+			scoreText.draw(r, NEW_CENT_FT, 20, 29, TOMATO_COLOR);
+		} else if (field == LIVES_HUD) {
+			for (long j = 0; j < value && j < MAX_LIVES; j++) {
+				int k = j * 35;
+				RasterPoint points[10] = {{250+k, 20}, {255+k, 15}, {260+k, 15}, {263+k, 18}, {263+k, 22},
+										  {250+k, 35}, {237+k, 22}, {237+k, 18}, {240+k, 15}, {245+k, 15}};
+				r.fillPolygon(points, 10, false, TOMATO_COLOR);
+			}
+		} else {
+			drawString(r, TIMES_FT, 520, 29, "Press  p - pause,  r - restart,  q - quit", GRAY_COLOR);
+		}
+		r.endLayer();
+		return true;
 	}
 
-	ScoreDisplay() {
-		x = 20;
-		y = 29;
-		stage = PLAY_STG;
+	/* Method to paint the speed and FPS in the bottom right corner */
+	void paintBottom(Renderer &r) {
+		speedText.set(speed);
+		speedText.draw(r, TIMES_FT, 710, 570, GRAY_COLOR);
+
+		FPSText.set(FPS);
+		FPSText.draw(r, TIMES_FT, 710, 595, GRAY_COLOR);
 	}
 
-private:
-	int x;
-	int y;
+	int layer;	// the HUD layer, the fields are rendered into their areas of it
+	HudField fields[NUM_HUD_FIELDS];
+	HudText scoreText;
+	HudText speedText;
+	HudText FPSText;
+	RenderRect bottomBox; // area the speed and FPS text can cover
 };
 
 /*
@@ -472,85 +741,79 @@ private:
  */
 class PauseDisplay : public Displayable {
 public:
-	virtual void paint(XInfo &xinfo) {
-		setFont(xinfo, TOMATO_GC, NEW_CENT_FT);
-		XPoint points[6] = { {400,200}, {320,240}, {320,320}, {400,430}, {480,320}, {480,240} };
-		XFillPolygon(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], points, 6, Convex, CoordModeOrigin);
-
-		string pauseStr = "Resume [y]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 350, 270, pauseStr.c_str(), pauseStr.length());
-
-		string restartStr = "Restart [r]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 350, 310, restartStr.c_str(), restartStr.length());
+	virtual void paint(Renderer &r) {
+		RasterPoint points[6] = { {400,200}, {320,240}, {320,320}, {400,430}, {480,320}, {480,240} };
+		r.fillPolygon(points, 6, true, DIMGRAY_COLOR);
 
-		string quitStr = "Quit [q]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 365, 350, quitStr.c_str(), quitStr.length());
+		drawString(r, NEW_CENT_FT, 350, 270, "Resume [y]", TOMATO_COLOR);
+		drawString(r, NEW_CENT_FT, 350, 310, "Restart [r]", TOMATO_COLOR);
+		drawString(r, NEW_CENT_FT, 365, 350, "Quit [q]", TOMATO_COLOR);
 	}
 
 	PauseDisplay() {
 		stage = PAUSE_STG;
+		name = "pause";
 	}
 
 };
 
-/* 
+/*
  * Class for the display before the game starts (first page to show)
  */
 class StartDisplay : public Displayable {
 public:
-	virtual void paint(XInfo &xinfo) {
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GENERAL_GC], 0, 0, width, height);
-
-		string name = "Snake";
-		setFont(xinfo, DIMGRAY_GC, UTOPIA_FT);
-		XSetLineAttributes(xinfo.display, xinfo.gc[GREEN_GC], 4, LineSolid, CapButt, JoinRound);	
-		XDrawRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], 339, 135, 115, 38);
-		XSetLineAttributes(xinfo.display, xinfo.gc[GREEN_GC], 1, LineSolid, CapButt, JoinRound);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 350, 166, name.c_str(), name.length());
-
-		unsigned long gold = 0xFFD700;
-		unsigned long green = 0x008000;
-		int x = 530;
-		int y = 150;
-		XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], gold);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x, y, BlockSize-2, BlockSize-2);
-		XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], green);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+1*BlockSize, y, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+2*BlockSize, y, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+3*BlockSize, y, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+4*BlockSize, y, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+4*BlockSize, y+1*BlockSize, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+5*BlockSize, y+1*BlockSize, BlockSize-2, BlockSize-2);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], x+6*BlockSize, y+1*BlockSize, BlockSize-2, BlockSize-2);
-
-		string text1 = "Move the snake, Eat the fruit, Grow the length";
-		string text2 = "Eat special fruit may +/- a life";
-		string text3 = "Hit the snake body or any obstacles - a life";
-		string text4 = "The snake can go through each side";
-		string text5 = "Click the Snake above to start, press [q] to quit";
-		setFont(xinfo, DIMGRAY_GC, UTOPIA_S_FT);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 50, 290, text1.c_str(), text1.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 50, 340, text2.c_str(), text2.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 50, 390, text3.c_str(), text3.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 50, 440, text4.c_str(), text4.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 50, 490, text5.c_str(), text5.length());
-
-		string key = "Controls:";
-		string key1 = "Up          [w]/[UP]";
-		string key2 = "Down    [s]/[DOWN]";
-		string key3 = "Left         [a]/[LEFT]";
-		string key4 = "Right      [d]/[RIGHT]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 530, 290, key.c_str(), key.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 560, 340, key1.c_str(), key1.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 560, 390, key2.c_str(), key2.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 560, 440, key3.c_str(), key3.length());
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 560, 490, key4.c_str(), key4.length());
+	/* The start page never changes, it is rendered once and copied after that */
+	virtual void paint(Renderer &r) {
+		if (layer.isStale(r, 1)) {
+			layer.begin(r);
+			render(r);
+			layer.end(r);
+		}
+		layer.copy(r, 0, 0, width, height);
+	}
 
+	virtual bool coversFrame() {
+		return true;
 	}
 
 	StartDisplay() {
 		stage = START_STG;
+		name = "start";
 	}
+
+private:
+	void render(Renderer &r) {
+		r.fillRect(0, 0, width, height, WHITE_COLOR);
+
+		r.drawRect(339, 135, 115, 38, 4, GREEN_COLOR);
+		drawString(r, UTOPIA_FT, 350, 166, "Snake", DIMGRAY_COLOR);
+
+		int x = 530;
+		int y = 150;
+		r.fillRect(x, y, DefaultBlockSize-2, DefaultBlockSize-2, GOLD_COLOR);
+		r.fillRect(x+1*DefaultBlockSize, y, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+2*DefaultBlockSize, y, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+3*DefaultBlockSize, y, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+4*DefaultBlockSize, y, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+4*DefaultBlockSize, y+1*DefaultBlockSize, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+5*DefaultBlockSize, y+1*DefaultBlockSize, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+		r.fillRect(x+6*DefaultBlockSize, y+1*DefaultBlockSize, DefaultBlockSize-2, DefaultBlockSize-2, GREEN_COLOR);
+
+		drawString(r, UTOPIA_S_FT, 50, 290, "Move the snake, Eat the fruit, Grow the length", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 50, 340, "Eat special fruit may +/- a life", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 50, 390, "Hit the snake body or any obstacles - a life", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 50, 440, "The snake can go through each side", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 50, 490, "Click the Snake above to start, press [q] to quit", DIMGRAY_COLOR);
+
+		drawString(r, UTOPIA_S_FT, 530, 290, "Controls:", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 560, 340, "Up          [w]/[UP]", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 560, 390, "Down    [s]/[DOWN]", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 560, 440, "Left         [a]/[LEFT]", DIMGRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 560, 490, "Right      [d]/[RIGHT]", DIMGRAY_COLOR);
+
+	}
+
+	CachedLayer layer;
 };
 
 /*
@@ -558,314 +821,759 @@ public:
  */
 class GameOverDisplay : public Displayable {
 public:
-	virtual void paint(XInfo &xinfo) {
-		unsigned long almond = 0xFFEBCD;
-		unsigned long green = 0x008000;
-		XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], almond);
-		XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], 0, 0, width, height);
-		XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], green);
+	/* The page only changes with the final score and whether the game was won */
+	virtual void paint(Renderer &r) {
+		bool won = !arena && game.isGameWon();
+		if (layer.isStale(r, shownScore() * 2 + (won ? 1 : 0))) {
+			layer.begin(r);
+			render(r);
+			layer.end(r);
+		}
+		layer.copy(r, 0, 0, width, height);
+	}
+
+	virtual bool coversFrame() {
+		return true;
+	}
 
-		setFont(xinfo, DIMGRAY_GC, UTOPIA_FT);
-		string gameover = "GAME OVER";
-		XSetLineAttributes(xinfo.display, xinfo.gc[DIMGRAY_GC], 10, LineSolid, CapButt, JoinRound);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[DIMGRAY_GC], 300, 260, gameover.c_str(), gameover.length());
+	GameOverDisplay() : scoreText("Your score is :  %ld") {
+		stage = GAMEOVER_STG;
+		name = "gameover";
+	}
 
-		setFont(xinfo, TOMATO_GC, NEW_CENT_FT);
-		string scoreStr = "Your score is :  " + to_string(score);
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 320, 300, scoreStr.c_str(), scoreStr.length());
+private:
+	void render(Renderer &r) {
+		r.fillRect(0, 0, width, height, ALMOND_COLOR);
 
-		setFont(xinfo, GRAY_GC, UTOPIA_S_FT);
-		string restartStr = "Restart [r]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[GRAY_GC], 310, 340, restartStr.c_str(), restartStr.length());
+		drawString(r, UTOPIA_FT, 300, 260, (!arena && game.isGameWon()) ? "YOU  WIN" : "GAME OVER", DIMGRAY_COLOR);
 
-		string quitStr = "Quit [q]";
-		XDrawString(xinfo.display, xinfo.window, xinfo.gc[GRAY_GC], 413, 340, quitStr.c_str(), quitStr.length());
-	}
+		scoreText.set(shownScore());
+		scoreText.draw(r, NEW_CENT_FT, 320, 300, TOMATO_COLOR);
 
-	GameOverDisplay() {
-		stage = GAMEOVER_STG;
+		drawString(r, UTOPIA_S_FT, 310, 340, "Restart [r]", GRAY_COLOR);
+		drawString(r, UTOPIA_S_FT, 413, 340, "Quit [q]", GRAY_COLOR);
 	}
+
+	CachedLayer layer;
+	HudText scoreText;
 };
 
 
-Fruit fruit;
-Obstacles obstacles;
+/*
+ * Class for the display of the snake head and the snake body
+ */
+class SnakeDisplay : public Displayable {
+public:
+	virtual void paint(Renderer &r) {
+		if (smooth && lastTickMoved && tickProgress < 1.0) {
+			paintInterpolated(r, tickProgress);
+			return;
+		}
+
+		const Snake &snake = game.getSnake();
+		/* only the body cells in view, not every block, then the head on top when hitting itself or obstacles */
+		forEachCellInView(camera, snake.getOccupied(), snake.getTiles(), [&](int x, int y) {
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, GREEN_COLOR);
+		});
+		if (camera.inView(snake.getHeadX(), snake.getHeadY())) {
+			r.fillRect(cellToPixelX(snake.getHeadX()), cellToPixelY(snake.getHeadY()), BlockSize-2, BlockSize-2, GOLD_COLOR);
+		}
+	}
 
+	virtual void paintCell(Renderer &r, int x, int y) {
+		const Snake &snake = game.getSnake();
+		if (snake.getHeadX() == x && snake.getHeadY() == y) {
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, GOLD_COLOR);
+		} else if (snake.onSnakeBody(x, y)) {
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, GREEN_COLOR);
+		}
+	}
+
+	SnakeDisplay() {
+		stage = PLAY_STG;
+		name = "snake";
+	}
+
+private:
+	/*
+	 * Method to paint the snake between the last two ticks, alpha 0 is where it was and 1 where it is now.
+	 * Only the head and the tail end slide, every block in between stays on a cell that is covered either way.
+	 */
+	void paintInterpolated(Renderer &r, double alpha) {
+		const Snake &snake = game.getSnake();
+
+		/* keep the sliding blocks out of the score bar */
+		r.setClip(RegionStartX, RegionStartY, RegionEndX - RegionStartX, RegionEndY - RegionStartY);
+
+		paintSliding(r, prevTail, snake.getBlock(snake.getLength()-1), alpha, GREEN_COLOR);
+		forEachCellInView(camera, snake.getOccupied(), snake.getTiles(), [&](int x, int y) {
+			if (x == snake.getHeadX() && y == snake.getHeadY() && !snake.onSnakeBody(x, y)) return; // the head slides
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, GREEN_COLOR);
+		});
+		paintSliding(r, snake.getBlock(1), snake.getBlock(0), alpha, GOLD_COLOR);
+
+		r.clearClip();
+	}
+
+	/*
+	 * Method to paint a block alpha of the way from one cell to a neighbouring one, the short way round the edges;
+	 *	measured from whichever of the two is in view, nothing when neither is
+	 */
+	void paintSliding(Renderer &r, const Block &from, const Block &to, double alpha, uint32_t color) {
+		int dx = to.getX() - from.getX();
+		int dy = to.getY() - from.getY();
+		if (dx > 1) dx -= BoardWidth;
+		if (dx < -1) dx += BoardWidth;
+		if (dy > 1) dy -= BoardHeight;
+		if (dy < -1) dy += BoardHeight;
+
+		int x, y;
+		if (camera.inView(from.getX(), from.getY())) {
+			x = cellToPixelX(from.getX()) + (int)(dx * alpha * BlockSize);
+			y = cellToPixelY(from.getY()) + (int)(dy * alpha * BlockSize);
+		} else if (camera.inView(to.getX(), to.getY())) {
+			x = cellToPixelX(to.getX()) - (int)(dx * (1.0 - alpha) * BlockSize);
+			y = cellToPixelY(to.getY()) - (int)(dy * (1.0 - alpha) * BlockSize);
+		} else {
+			return;
+		}
+		r.fillRect(x, y, BlockSize-2, BlockSize-2, color);
+	}
+};
 
 /*
- * Class for each snake block, increase one instance every time the snake eats a normal fruit
+ * Class for the display of the arena: the fruits and every snake in view, the player's snake in the
+ *	colours of the one game and the AI snakes in gray with tomato heads
  */
-class Block {
-private:
-	int x;
-	int y;
+class ArenaDisplay : public Displayable {
 public:
-	Block(int x, int y) : x(x), y(y) { }
-
-	int getX() {
-		return x;
+	virtual void paint(Renderer &r) {
+		forEachCellInView(camera, arena->getFruits(), arena->getFruitTiles(), [&](int x, int y) {
+			r.fillArc(cellToPixelX(x), cellToPixelY(y), BlockSize, BlockSize, BLUE_COLOR);
+		});
+		forEachCellInView(camera, arena->getOccupied(), arena->getTiles(), [&](int x, int y) {
+			uint32_t color = (arena->getCellContent(x, y) == PLAYER_SNAKE) ? GREEN_COLOR : GRAY_COLOR;
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, color);
+		});
+
+		/* the heads on top, a look at every snake but only the ones in view are drawn */
+		for (int i = 0; i < arena->getNumSnakes(); i++) {
+			const ArenaSnake &snake = arena->getSnake(i);
+			if (!snake.isAlive()) continue;
+			int x = snake.getHeadCell() % BoardWidth;
+			int y = snake.getHeadCell() / BoardWidth;
+			if (!camera.inView(x, y)) continue;
+			uint32_t color = (i == PLAYER_SNAKE) ? GOLD_COLOR : TOMATO_COLOR;
+			r.fillRect(cellToPixelX(x), cellToPixelY(y), BlockSize-2, BlockSize-2, color);
+		}
 	}
 
-	int getY() {
-		return y;
+	ArenaDisplay() {
+		stage = PLAY_STG;
+		name = "arena";
 	}
 };
 
+
+list<Displayable *> dList;           // list of Displayables
+SnakeDisplay snakeDisplay;
+FruitDisplay fruitDisplay;
+ObstaclesDisplay obstaclesDisplay;
+ScoreDisplay scoreDisplay;
+StartDisplay startDisplay;
+PauseDisplay pauseDisplay;
+GameOverDisplay gameoverDisplay;
+ArenaDisplay arenaDisplay;
+
+
 /*
- * Class that handle all snake length growing, hitting obstables (include snake itself), movement
+ * Function to check if the server can double buffer the window with XDBE
  */
-class Snake : public Displayable {
-	public:
-		Snake(int x, int y): headX(x), headY(y) {
-			stage = PLAY_STG;
-			x_speed = BlockSize;
-			y_speed = 0;
-			stillInObstacles = false;
-			lastTimeSpecialFruit = now();
-
-			Block blk1(headX, headY);
-			Block blk2(headX-1*BlockSize, headY);
-			Block blk3(headX-2*BlockSize, headY);
-			Block blk4(headX-3*BlockSize, headY);
-			Block blk5(headX-4*BlockSize, headY);
-			snakeBody.push_back(blk1);
-			snakeBody.push_back(blk2);
-			snakeBody.push_back(blk3);
-			snakeBody.push_back(blk4);
-			snakeBody.push_back(blk5);
+bool haveDbe(XInfo &xinfo) {
+	int major, minor;
+	if (!XdbeQueryExtension(xinfo.display, &major, &minor)) return false;
+
+	Drawable root = DefaultRootWindow(xinfo.display);
+	int numScreens = 1;
+	XdbeScreenVisualInfo *info = XdbeGetVisualInfo(xinfo.display, &root, &numScreens);
+	if (!info) return false;
+
+	VisualID visual = XVisualIDFromVisual(DefaultVisual(xinfo.display, xinfo.screen));
+	bool found = false;
+	for (int i = 0; i < info->count; i++) {
+		if (info->visinfo[i].visual == visual) found = true;
+	}
+	XdbeFreeVisualInfo(info);
+	return found;
+}
+
+/*
+ * Class for the backend that turns the drawing into Xlib requests on a buffer: an XDBE back buffer, a pixmap
+ *	copied to the window, or the window itself. There is one GC, Xlib leaves out the requests that would set
+ *	its colour, line width or font to what it already is.
+ *
+ * The filled rectangles and ellipses are queued in batches of one colour and sent as one XFillRectangles or
+ *	XFillArcs per batch, so a frame takes about as many requests however long the snake is. A fill joins the
+ *	last batch of its colour unless it overlaps something queued after that batch, which would then end up
+ *	on top of it; the batches go out in the order they were started, before anything else is drawn. The
+ *	overlaps are found on a grid of cell sized tiles lined up with the board, each holding the latest batch
+ *	drawing on it, so a cell's fill is checked with one lookup however many fills are queued.
+ */
+class X11Renderer : public Renderer {
+public:
+	X11Renderer(XInfo &xinfo, int mode) : xinfo(xinfo), mode(mode) {
+		numBatches = 0;
+		firstSerial = 1; // 0 on a tile is no batch
+		tileSize = 0;
+		switch (mode) {
+			case DBE_BUF:
+				/* copied when only the damage is drawn over the last frame */
+				swapAction = damageMode ? XdbeCopied : XdbeUndefined;
+				backBuffer = XdbeAllocateBackBufferName(xinfo.display, xinfo.window, swapAction);
+				buffer = backBuffer;
+				break;
+			case PIXMAP_BUF:
+				buffer = XCreatePixmap(xinfo.display, xinfo.window, width, height, DefaultDepth(xinfo.display, xinfo.screen));
+				break;
+			default:
+				buffer = xinfo.window;
+				break;
 		}
+		target = buffer;
 
-		/* Method to paint the snake head and the snake body */
-		virtual void paint(XInfo &xinfo) {
-			/* Draw snake head with different color */
-			/* from size()-1 to 0 to display snake head always on top when hitting itself or obstacles */
-		    for (int i = snakeBody.size()-1; i >= 0; i--) {
-		        int blkX = snakeBody[i].getX();
-		        int blkY = snakeBody[i].getY();
-		        if (i == 0) {
-		        	unsigned long gold = 0xFFD700;
-		        	unsigned long green = 0x008000;
-		        	XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], gold);
-		        	XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], blkX, blkY, BlockSize-2, BlockSize-2);
-		        	XSetForeground(xinfo.display, xinfo.gc[GREEN_GC], green);
-		        } else {
-		        	XFillRectangle(xinfo.display, xinfo.window, xinfo.gc[GREEN_GC], blkX, blkY, BlockSize-2, BlockSize-2);
-		        }
-		    }
+		gc = XCreateGC(xinfo.display, xinfo.window, 0, 0);
+		XSetBackground(xinfo.display, gc, BlackPixel(xinfo.display, xinfo.screen));
+		XSetFillStyle(xinfo.display, gc, FillSolid);
+		XSetLineAttributes(xinfo.display, gc, 1, LineSolid, CapButt, JoinRound);
+	}
+
+	virtual const char *getName() {
+		return (mode == DBE_BUF) ? "dbe" : (mode == PIXMAP_BUF) ? "pixmap" : "direct";
+	}
+
+	/* the window is cleared every frame in the direct mode */
+	virtual bool keepsFrame() {
+		return mode != DIRECT_BUF;
+	}
+
+	virtual void clear() {
+		if (mode == DIRECT_BUF) {
+			sendBatches();
+			XClearWindow(xinfo.display, xinfo.window);
+		} else {
+			fillRect(0, 0, width, height, BACKGROUND_COLOR);
 		}
+	}
+
+	virtual void fillRect(int x, int y, int w, int h, uint32_t color) {
+		queueFill(false, x, y, w, h, color);
+	}
+
+	virtual void drawRect(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+		sendBatches();
+		XSetForeground(xinfo.display, gc, color);
+		setLineWidth(lineWidth);
+		XDrawRectangle(xinfo.display, target, gc, x, y, w, h);
+	}
+
+	virtual void drawLine(int x0, int y0, int x1, int y1, uint32_t color) {
+		sendBatches();
+		XSetForeground(xinfo.display, gc, color);
+		setLineWidth(1);
+		XDrawLine(xinfo.display, target, gc, x0, y0, x1, y1);
+	}
 
-		/* Helper method to check if the sanke is on its body */
-		bool onSnakeBody(int x, int y) {
-        		for (int i = 1; i < snakeBody.size(); i++) {
-        	    		if (x == snakeBody[i].getX() && y == snakeBody[i].getY()) {
-        	        		return true;
-        	    		}
-        		}
-        		return false;			
+	virtual void fillArc(int x, int y, int w, int h, uint32_t color) {
+		queueFill(true, x, y, w, h, color);
+	}
+
+	virtual void drawArc(int x, int y, int w, int h, int lineWidth, uint32_t color) {
+		sendBatches();
+		XSetForeground(xinfo.display, gc, color);
+		setLineWidth(lineWidth);
+		XDrawArc(xinfo.display, target, gc, x, y, w, h, 0, 360*64);
+	}
+
+	virtual void fillPolygon(const RasterPoint points[], int numPoints, bool convex, uint32_t color) {
+		XPoint corners[MAX_POLYGON_POINTS];
+		numPoints = min(numPoints, MAX_POLYGON_POINTS);
+		for (int i = 0; i < numPoints; i++) {
+			corners[i].x = points[i].x;
+			corners[i].y = points[i].y;
 		}
+		sendBatches();
+		XSetForeground(xinfo.display, gc, color);
+		XFillPolygon(xinfo.display, target, gc, corners, numPoints, convex ? Convex : Complex, CoordModeOrigin);
+	}
+
+	virtual void drawText(int font, int x, int y, const char *text, int length, uint32_t color) {
+		sendBatches();
+		XSetForeground(xinfo.display, gc, color);
+		XSetFont(xinfo.display, gc, xinfo.font[font]->fid);
+		XDrawString(xinfo.display, target, gc, x, y, text, length);
+	}
+
+	virtual void setClip(int x, int y, int w, int h) {
+		sendBatches();
+		XRectangle rect = { (short)x, (short)y, (unsigned short)w, (unsigned short)h };
+		XSetClipRectangles(xinfo.display, gc, 0, 0, &rect, 1, Unsorted);
+	}
+
+	virtual void clearClip() {
+		sendBatches();
+		XSetClipMask(xinfo.display, gc, None);
+	}
+
+	/* The layers are server-side pixmaps */
+	virtual int createLayer() {
+		layers.push_back(XCreatePixmap(xinfo.display, xinfo.window, width, height, DefaultDepth(xinfo.display, xinfo.screen)));
+		return layers.size() - 1;
+	}
+
+	virtual void beginLayer(int layer) {
+		sendBatches();
+		target = layers[layer];
+	}
 
-		/* Helper method to check if the snake is on the obstables  */
-		bool onObstacles(int x, int y) {
-			unsigned int numOfObs = obstacles.getNumOfObs();
-			Obstacle *obs = obstacles.getObs();
+	virtual void endLayer() {
+		sendBatches();
+		target = buffer;
+	}
 
-			for (unsigned i = 0; i < numOfObs; i++) {
-				if ((x >= obs[i].getX()) && (x < obs[i].getX()+obs[i].getXLength()) &&
-					(y >= obs[i].getY()) && (y < obs[i].getY()+obs[i].getYLength())) {
-					return true;
+	virtual void copyLayer(int layer, int x, int y, int w, int h) {
+		sendBatches();
+		XCopyArea(xinfo.display, layers[layer], target, gc, x, y, w, h, x, y);
+	}
+
+	/* Method to swap the back buffer, or copy the damaged areas of the pixmap to the window */
+	virtual void present(const RenderRect rects[], int numRects) {
+		sendBatches();
+		if (numRects == 0) return; // nothing changed
+
+		if (mode == DBE_BUF) {
+			XdbeSwapInfo swapInfo;
+			swapInfo.swap_window = xinfo.window;
+			swapInfo.swap_action = swapAction;
+			XdbeSwapBuffers(xinfo.display, &swapInfo, 1);
+		} else if (mode == PIXMAP_BUF) {
+			if (numRects == FULL_FRAME) {
+				XCopyArea(xinfo.display, buffer, xinfo.window, gc, 0, 0, width, height, 0, 0);
+			} else {
+				for (int i = 0; i < numRects; i++) {
+					XCopyArea(xinfo.display, buffer, xinfo.window, gc,
+							  rects[i].x, rects[i].y, rects[i].width, rects[i].height, rects[i].x, rects[i].y);
 				}
 			}
-			return false;
 		}
+	}
 
-	/* Method to check if the snake hit itself */
-        bool didHitSnakeitself() {
-        	if (onSnakeBody(headX, headY)) {
-        		if (verbose) cout << "Hit snake itself!" << endl;
-        		return true;
-        	}
-        	return false;
-        }
-
-	/* Method to regenerate the fruit and make sure the new generated fruit is not on the snake or obstacles */
-        void regenerateFruit(Fruit &frt) {
-			/* regenerate another fruit */
-			int new_x, new_y;
-			for (;;) {
-				frt.generateNewFruit(new_x, new_y); // new fruit position
-				// make sure new fruit is not overlapping with the snake body, obstacles, and fruit is in proper region
-				if ((!onSnakeBody(new_x, new_y)) && (headX != new_x) && (headY != new_y) &&
-					(!onObstacles(new_x, new_y)) && (new_y >= RegionStartY)) {
-					if (verbose) cout << "X: " << new_x << " Y: " << new_y << endl;
-					if (frt.getAttribute() == HEART_FRT || frt.getAttribute() == EVIL_FRT) {
-						lastTimeSpecialFruit = now();
-					}
-					break;
-				}
+	virtual void flush(bool wait) {
+		sendBatches();
+		if (wait) {
+			XSync(xinfo.display, False);
+		} else {
+			XFlush(xinfo.display);
+		}
+	}
+
+	/* the fills still queued are sent first, so they count */
+	virtual unsigned long getRequests() {
+		sendBatches();
+		return NextRequest(xinfo.display);
+	}
+
+private:
+	/*
+	 * The fills of one colour for one XFillRectangles, or XFillArcs with arcs set; the batches are kept from
+	 *	frame to frame with their room, so queueing allocates nothing once the frames are as busy as they get
+	 */
+	struct FillBatch {
+		bool arcs;
+		uint32_t color;
+		vector<XRectangle> rects;
+		vector<XArc> ellipses;
+	};
+
+	void setLineWidth(int lineWidth) {
+		XSetLineAttributes(xinfo.display, gc, lineWidth, LineSolid, CapButt, JoinRound);
+	}
+
+	/* Method to size the tile grid for the current cell size, the queued fills are sent first */
+	void resizeTiles() {
+		sendBatches();
+		tileSize = BlockSize;
+		tileOriginX = RegionStartX % tileSize - tileSize;
+		tileOriginY = RegionStartY % tileSize - tileSize;
+		tileCols = (width - tileOriginX + tileSize - 1) / tileSize;
+		tileRows = (height - tileOriginY + tileSize - 1) / tileSize;
+		tileBatches.assign(tileCols * tileRows, 0);
+	}
+
+	/* Method to queue a filled rectangle or ellipse in the batch it can join, or a new one */
+	void queueFill(bool arcs, int x, int y, int w, int h, uint32_t color) {
+		if (w <= 0 || h <= 0) return; // draws nothing
+		if (tileSize != BlockSize) resizeTiles();
+
+		/* the tiles its box covers in the window, none when it is all outside */
+		int col0 = (max(x, 0) - tileOriginX) / tileSize;
+		int row0 = (max(y, 0) - tileOriginY) / tileSize;
+		int col1 = (min(x + w, width) - 1 - tileOriginX) / tileSize;
+		int row1 = (min(y + h, height) - 1 - tileOriginY) / tileSize;
+		if (x >= width || y >= height || x + w <= 0 || y + h <= 0) {
+			col1 = col0 - 1;
+		}
+
+		/* the latest batch drawing on those tiles, the fill has to go out after it */
+		unsigned long latest = 0;
+		for (int row = row0; row <= row1; row++) {
+			for (int col = col0; col <= col1; col++) {
+				latest = max(latest, tileBatches[row * tileCols + col]);
 			}
-        }
-
-		/* Method to check if the snake eats the fruit, and distinguish which kind of the fruit to perform
-		differently */
-		bool didEatFruit(Fruit &frt, int &attribute) {
-			if (frt.getX() == headX && frt.getY() == headY) {
-				if (frt.getAttribute() == NORMAL_FRT) {
-					score++;
-					if (verbose) cout << "Eat Scoring Fruit!" << endl;
-					attribute = NORMAL_FRT;
-				} else if (frt.getAttribute() == HEART_FRT) {
-					if (numOfLives < 5) {
-						numOfLives++;
-						if (verbose) cout << "Eat Heart Fruit, incresed lives by 1" << endl;
-					} else {
-						if (verbose) cout << "Hit Max Lives" << endl;
-					}
-					attribute = HEART_FRT;
-				} else { // evil fruit
-					numOfLives--;
-					if (verbose) cout << "Eat Evil Fruit, decreased lives by 1" << endl;
-					attribute = EVIL_FRT;
-					if (numOfLives == 0) {
-						curStage = GAMEOVER_STG;
-						return true;
-					}
-				}
+		}
 
-				regenerateFruit(frt);
-				return true;
+		int k = 0;
+		while (k < (int)lastBatches.size() && (batches[lastBatches[k]].arcs != arcs || batches[lastBatches[k]].color != color)) k++;
+		int i = (k < (int)lastBatches.size()) ? lastBatches[k] : -1;
+
+		if (i < 0 || firstSerial + i < latest) {
+			if (numBatches == (int)batches.size()) batches.push_back(FillBatch());
+			i = numBatches++;
+			FillBatch &batch = batches[i];
+			batch.arcs = arcs;
+			batch.color = color;
+			batch.rects.clear();
+			batch.ellipses.clear();
+			if (k < (int)lastBatches.size()) {
+				lastBatches[k] = i;
 			} else {
-				if ((frt.getAttribute() == HEART_FRT || frt.getAttribute() == EVIL_FRT) &&
-					((now() - lastTimeSpecialFruit) > 35000000/speed)) { // regenerate after some time if special fruits
-					regenerateFruit(frt);
-				}
-				return false;
+				lastBatches.push_back(i);
 			}
-        }
-/*
-	// The snake can go through the wall (edge), so disabled the HitWall check
-        bool didHittheWall() {
-        	if (headX < RegionStartX || headX > RegionEndX || headY < RegionStartY || headY > RegionStartY) {
-        		cout << "Hit the wall!" << endl;
-        		return true;
-        	}
-        	return false;
-        }
-*/		/* Method to check if the sanke hit the obstables */
-		bool didHitObstacle() {
-			if (onObstacles(headX, headY)) {
-				if (verbose) cout << "Hit the obstables" << endl;
-				return true;
+		}
+
+		FillBatch &batch = batches[i];
+		if (arcs) {
+			XArc arc = { (short)x, (short)y, (unsigned short)w, (unsigned short)h, 0, 360*64 };
+			batch.ellipses.push_back(arc);
+		} else {
+			XRectangle rect = { (short)x, (short)y, (unsigned short)w, (unsigned short)h };
+			batch.rects.push_back(rect);
+		}
+
+		/* no later batch draws on these tiles, so this one is now the latest on all of them */
+		for (int row = row0; row <= row1; row++) {
+			for (int col = col0; col <= col1; col++) {
+				tileBatches[row * tileCols + col] = firstSerial + i;
 			}
-			return false;
-        }
-
-	/* Method to check if the snake is dead, it also manage the lives related work */
-        void didDead() {
-		    if (didHitSnakeitself() || didHitObstacle()) {
-		    	if (!stillInObstacles) {
-		    		stillInObstacles = true;
-		    		numOfLives--;
-		    	}
-		    	if (numOfLives == 0) {
-		    		curStage = GAMEOVER_STG;
-		    		if (verbose) cout << "Game Over!" << endl;
-		    	}
-		    } else {
-		    	stillInObstacles = false;
-		    }
-        }
-
-		/* Method to move the snake at speed BlockSize */
-		void move(XInfo &xinfo) {
-			if (curStage != PLAY_STG) return;
-
-			headX = MyMod(RegionStartX, RegionEndX, headX + x_speed);
-			headY = MyMod(RegionStartY, RegionEndY, headY + y_speed);
-
-			didDead();
-
-			int attribute;
-			if (!didEatFruit(fruit, attribute) || !(attribute == NORMAL_FRT)) {
-				snakeBody.pop_back();
+		}
+	}
+
+	/* Method to send the queued fills, one request per batch (Xlib splits one that is too big for a request) */
+	void sendBatches() {
+		for (int i = 0; i < numBatches; i++) {
+			FillBatch &batch = batches[i];
+			XSetForeground(xinfo.display, gc, batch.color);
+			if (batch.arcs) {
+				XFillArcs(xinfo.display, target, gc, batch.ellipses.data(), batch.ellipses.size());
+			} else {
+				XFillRectangles(xinfo.display, target, gc, batch.rects.data(), batch.rects.size());
 			}
-			Block blk(headX, headY);
-			snakeBody.push_front(blk);
 		}
+		firstSerial += numBatches; // the tiles of the sent batches now count as no batch
+		numBatches = 0;
+		lastBatches.clear();
+	}
 
-		/* Method to change the direction of the snake */
-		void changeDirection(int direction) {
-			if (curStage != PLAY_STG) return;
+	XInfo &xinfo;
+	int mode;					// DBE_BUF, PIXMAP_BUF or DIRECT_BUF
+	Drawable buffer;			// where the frames are composed
+	Drawable target;			// the buffer or the layer being drawn
+	XdbeBackBuffer backBuffer;
+	XdbeSwapAction swapAction;
+	GC gc;
+	vector<Pixmap> layers;
+	vector<FillBatch> batches;	// the first numBatches are queued, in the order they go out
+	int numBatches;
+	vector<int> lastBatches;	// the last queued batch of each colour and kind
+	unsigned long firstSerial;	// the serial of batch 0, the batches sent before have lower ones
+	vector<unsigned long> tileBatches;	// the serial of the latest batch drawing on each tile
+	int tileSize;				// the cell size the grid was made for, 0 before the first fill
+	int tileOriginX;			// the corner of tile 0, left of and above the window
+	int tileOriginY;
+	int tileCols;
+	int tileRows;
+};
 
-			// snake starts with length of 5, so safe to access first 2 block for direction verification
-			int blk1X = snakeBody[0].getX();
-			int blk2X = snakeBody[1].getX();
+/*
+ * Function to get the byte order of this machine in the terms of XImage
+ */
+int hostByteOrder() {
+	const uint16_t probe = 1;
+	return (*(const uint8_t *)&probe == 1) ? LSBFirst : MSBFirst;
+}
 
-			/* if using original x_speed or y_speed to check if it's movable, would go down directly by pressing
-					LEFT and DOWN quickly from going up originally  */
-			bool movingAlongYcoord = (blk1X == blk2X); // if x coords are the same, so moving along y direction
+/*
+ * Function to get the glyphs of a font as masks for the framebuffer: the printable characters are drawn side
+ *	by side into a one bit pixmap and read back with one XGetImage
+ */
+GlyphFont *makeGlyphFont(XInfo &xinfo, XFontStruct *font) {
+	const int numGlyphs = LAST_GLYPH - FIRST_GLYPH + 1;
+	XCharStruct chars[numGlyphs];
+	int cellWidth = 1;
+	for (int i = 0; i < numGlyphs; i++) {
+		unsigned int c = FIRST_GLYPH + i;
+		if (font->per_char && c >= font->min_char_or_byte2 && c <= font->max_char_or_byte2) {
+			chars[i] = font->per_char[c - font->min_char_or_byte2];
+		} else {
+			chars[i] = font->max_bounds;
+		}
+		cellWidth = max(cellWidth, chars[i].rbearing - chars[i].lbearing);
+	}
+	int ascent = font->max_bounds.ascent;
+	int cellHeight = max(1, font->max_bounds.ascent + font->max_bounds.descent);
+
+	Pixmap bitmap = XCreatePixmap(xinfo.display, xinfo.window, cellWidth * numGlyphs, cellHeight, 1);
+	GC gc = XCreateGC(xinfo.display, bitmap, 0, NULL);
+	XSetForeground(xinfo.display, gc, 0);
+	XFillRectangle(xinfo.display, bitmap, gc, 0, 0, cellWidth * numGlyphs, cellHeight);
+	XSetForeground(xinfo.display, gc, 1);
+	XSetFont(xinfo.display, gc, font->fid);
+	for (int i = 0; i < numGlyphs; i++) {
+		char c = FIRST_GLYPH + i;
+		XDrawString(xinfo.display, bitmap, gc, i * cellWidth - chars[i].lbearing, ascent, &c, 1);
+	}
+	XImage *image = XGetImage(xinfo.display, bitmap, 0, 0, cellWidth * numGlyphs, cellHeight, 1, XYPixmap);
+
+	GlyphFont *glyphs = new GlyphFont();
+	vector<uint8_t> mask(cellWidth * cellHeight);
+	for (int i = 0; i < numGlyphs; i++) {
+		const XCharStruct &cs = chars[i];
+		int w = cs.rbearing - cs.lbearing;
+		int top = max(0, ascent - cs.ascent);
+		int h = min(cellHeight - top, cs.ascent + cs.descent);
+		if (w <= 0 || h <= 0) w = h = 0; // nothing to draw, e.g. the space
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				mask[y * w + x] = (image && XGetPixel(image, i * cellWidth + x, top + y)) ? 0xFF : 0;
+			}
+		}
+		glyphs->setGlyph(FIRST_GLYPH + i, cs.lbearing, top - ascent, w, h, cs.width, mask.data());
+	}
 
-			switch (direction) { // only can change to directions that are perpendicular to the original direction
-				case UP:
-					if (!movingAlongYcoord) {
-						y_speed = -BlockSize;
-						x_speed = 0;
-					}
-					break;
-				case DOWN:
-					if (!movingAlongYcoord) {
-						y_speed = BlockSize;
-						x_speed = 0;
-					}
-					break;
-				case RIGHT:
-					if (movingAlongYcoord) {
-						x_speed = BlockSize;
-						y_speed = 0;
-					}
-					break;
-				case LEFT:
-					if (movingAlongYcoord) {
-						x_speed = -BlockSize;
-						y_speed = 0;
-					}
-					break;
+	if (image) XDestroyImage(image);
+	XFreeGC(xinfo.display, gc);
+	XFreePixmap(xinfo.display, bitmap);
+	return glyphs;
+}
+
+/* Set by catchShmError when the server refused to attach the shared memory */
+bool shmFailed = false;
+
+int catchShmError(Display *display, XErrorEvent *event) {
+	shmFailed = true;
+	return 0;
+}
+
+/*
+ * Function to make an image in memory shared with the server, returns NULL when the server has no MIT-SHM or
+ *	cannot attach, e.g. over the network
+ */
+XImage *createShmImage(XInfo &xinfo, Visual *visual, int depth, XShmSegmentInfo *shmInfo) {
+	if (!XShmQueryExtension(xinfo.display) || ImageByteOrder(xinfo.display) != hostByteOrder()) return NULL;
+
+	XImage *image = XShmCreateImage(xinfo.display, visual, depth, ZPixmap, NULL, shmInfo, width, height);
+	if (!image) return NULL;
+	if (image->bits_per_pixel != 32) {
+		XDestroyImage(image);
+		return NULL;
+	}
+
+	shmInfo->shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT | 0600);
+	if (shmInfo->shmid < 0) {
+		XDestroyImage(image);
+		return NULL;
+	}
+	shmInfo->shmaddr = image->data = (char *)shmat(shmInfo->shmid, NULL, 0);
+	shmInfo->readOnly = False;
+
+	/* a refusal comes back as an error, which only shows up after a round trip */
+	bool attached = false;
+	if (shmInfo->shmaddr != (char *)-1) {
+		shmFailed = false;
+		XErrorHandler oldHandler = XSetErrorHandler(catchShmError);
+		attached = XShmAttach(xinfo.display, shmInfo);
+		XSync(xinfo.display, False);
+		XSetErrorHandler(oldHandler);
+		attached = attached && !shmFailed;
+	}
+	shmctl(shmInfo->shmid, IPC_RMID, NULL); // goes away once both sides have detached
+
+	if (!attached) {
+		if (shmInfo->shmaddr != (char *)-1) shmdt(shmInfo->shmaddr);
+		image->data = NULL;
+		XDestroyImage(image);
+		return NULL;
+	}
+	return image;
+}
+
+/*
+ * Class for the backend that draws on the CPU (raster.h) into an image and puts it on the window, with
+ *	XShmPutImage when the server has MIT-SHM and XPutImage otherwise
+ */
+class ShmRenderer : public FramebufferRenderer {
+public:
+	/*
+	 * Function to set the backend up, returns NULL when the screen is not 24 bit TrueColor, the only pixel
+	 *	layout the rasteriser writes
+	 */
+	static ShmRenderer *create(XInfo &xinfo) {
+		Visual *visual = DefaultVisual(xinfo.display, xinfo.screen);
+		int depth = DefaultDepth(xinfo.display, xinfo.screen);
+		if (visual->c_class != TrueColor || (depth != 24 && depth != 32) || visual->red_mask != 0xFF0000 ||
+			visual->green_mask != 0x00FF00 || visual->blue_mask != 0x0000FF) {
+			return NULL;
+		}
+
+		/* the image points at the segment info, it has to stay where it is */
+		XShmSegmentInfo *shmInfo = new XShmSegmentInfo();
+		XImage *image = createShmImage(xinfo, visual, depth, shmInfo);
+		if (!image) {
+			delete shmInfo;
+			shmInfo = NULL;
+			if (verbose) cout << "No MIT-SHM, putting the framebuffer with XPutImage" << endl;
+			char *data = (char *)malloc(width * height * 4);
+			image = XCreateImage(xinfo.display, visual, depth, ZPixmap, 0, data, width, height, 32, width * 4);
+			if (!image) {
+				free(data);
+				return NULL;
+			}
+			if (image->bits_per_pixel != 32) {
+				XDestroyImage(image);
+				return NULL;
 			}
+			image->byte_order = hostByteOrder(); // Xlib swaps the bytes on the way out if the server wants that
 		}
+		return new ShmRenderer(xinfo, image, shmInfo);
+	}
 
-		int getXspeed() {
-			return x_speed;
+	virtual ~ShmRenderer() {
+		for (int i = 0; i < NUM_FONTS; i++) {
+			delete fonts[i];
 		}
+		delete frame;
+	}
+
+	virtual const char *getName() {
+		return shmInfo ? "framebuffer shm" : "framebuffer putimage";
+	}
+
+	/* Method to wait until the server has read the image the last frame put, so this one cannot show up half done */
+	virtual void beginFrame() {
+		if (!putPending) return;
+		XEvent event;
+		XIfEvent(xinfo.display, &event, isPutDone, (XPointer)this);
+		putPending = false;
+	}
 
-		int getYspeed() {
-			return y_speed;
+	/*
+	 * Method to put the frame, or the damaged part of it, on the window: one XShmPutImage of the box around
+	 *	the damage, or without MIT-SHM one XPutImage per damaged area so only those pixels go over the connection
+	 */
+	virtual void present(const RenderRect rects[], int numRects) {
+		RenderRect whole = { 0, 0, width, height };
+		if (numRects == FULL_FRAME) {
+			rects = &whole;
+			numRects = 1;
 		}
 
-		void setXspeed(int value) {
-			x_speed = value;
+		if (shmInfo) {
+			int x0 = width, y0 = height, x1 = 0, y1 = 0;
+			for (int i = 0; i < numRects; i++) {
+				x0 = min(x0, rects[i].x);
+				y0 = min(y0, rects[i].y);
+				x1 = max(x1, rects[i].x + rects[i].width);
+				y1 = max(y1, rects[i].y + rects[i].height);
+			}
+			x0 = max(x0, 0);
+			y0 = max(y0, 0);
+			x1 = min(x1, width); // the cells at the edge of the view can stick out of the window
+			y1 = min(y1, height);
+			if (x0 >= x1 || y0 >= y1) return;
+			XShmPutImage(xinfo.display, xinfo.window, gc, image, x0, y0, x0, y0, x1 - x0, y1 - y0, True);
+			putPending = true;
+			return;
 		}
 
-		void setYspeed(int value) {
-			y_speed = value;
+		for (int i = 0; i < numRects; i++) {
+			int x = max(rects[i].x, 0);
+			int y = max(rects[i].y, 0);
+			int w = min(rects[i].x + rects[i].width, width) - x;
+			int h = min(rects[i].y + rects[i].height, height) - y;
+			if (w > 0 && h > 0) XPutImage(xinfo.display, xinfo.window, gc, image, x, y, x, y, w, h);
 		}
+	}
 
-	private:
-		int headX;
-		int headY;
-		int x_speed;
-		int y_speed;
-		bool stillInObstacles; // flag to indicate if the snake head is still in the obstacle when collides
-        	deque<Block> snakeBody;
+	virtual void flush(bool wait) {
+		if (wait) {
+			XSync(xinfo.display, False);
+		} else {
+			XFlush(xinfo.display);
+		}
+	}
 
-};
+	virtual unsigned long getRequests() {
+		return NextRequest(xinfo.display);
+	}
 
+	/* Method to take the event that says the server is done with a put, returns true if it was that */
+	bool handleEvent(XEvent &event) {
+		if (!shmInfo || event.type != shmCompletion) return false;
+		putPending = false;
+		return true;
+	}
 
-list<Displayable *> dList;           // list of Displayables
-Snake snake(340, 300);
-ScoreDisplay scoreDisplay;
-StartDisplay startDisplay;
-PauseDisplay pauseDisplay;
-GameOverDisplay gameoverDisplay;
+private:
+	ShmRenderer(XInfo &xinfo, XImage *image, XShmSegmentInfo *shmInfo)
+		: FramebufferRenderer(new Framebuffer((uint32_t *)image->data, width, height, image->bytes_per_line / 4), NULL),
+		  xinfo(xinfo), image(image), shmInfo(shmInfo) {
+		shmCompletion = shmInfo ? XShmGetEventBase(xinfo.display) + ShmCompletion : -1;
+		putPending = false;
+		gc = XCreateGC(xinfo.display, xinfo.window, 0, 0);
+		for (int i = 0; i < NUM_FONTS; i++) {
+			fonts[i] = makeGlyphFont(xinfo, xinfo.font[i]);
+		}
+	}
+
+	/* Function to check for the event that says the server is done reading the shared image */
+	static Bool isPutDone(Display *display, XEvent *event, XPointer arg) {
+		return event->type == ((ShmRenderer *)arg)->shmCompletion;
+	}
 
+	XInfo &xinfo;
+	XImage *image;
+	XShmSegmentInfo *shmInfo;	// NULL when the image is put with XPutImage
+	int shmCompletion;			// the type of the event that says the server is done with a put, -1 without shm
+	bool putPending;			// the server may still be reading image
+	GC gc;
+};
+
+/*
+ * Function to make the renderer for bufferMode, falling back to XDBE and then a pixmap when the server cannot
+ *	do what was asked
+ */
+Renderer *createRenderer(XInfo &xinfo) {
+	if (bufferMode == FRAMEBUFFER_BUF) {
+		shmRenderer = ShmRenderer::create(xinfo);
+		if (shmRenderer) return shmRenderer;
+		if (verbose) cout << "No 24 bit TrueColor screen, using XDBE or a pixmap back buffer" << endl;
+		bufferMode = DBE_BUF;
+	}
+	if (bufferMode == DBE_BUF && !haveDbe(xinfo)) {
+		if (verbose) cout << "No XDBE, using a pixmap back buffer" << endl;
+		bufferMode = PIXMAP_BUF;
+	}
+	return new X11Renderer(xinfo, bufferMode);
+}
 
 /*
  * Initialize X and create a window
@@ -915,77 +1623,13 @@ void initX(int argc, char *argv[], XInfo &xInfo) {
 		argv, argc,			// applications command line args
 		&hints );			// size hints for the window
 
-	/* 
-	 * Create Graphics Contexts
-	 */
-	int i = 0;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], WhitePixel(xInfo.display, xInfo.screen));
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillSolid);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);
-
-	i = 1;
-	unsigned long green = 0x008000;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], green);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillSolid);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);
-
-	i = 2;
-	unsigned long dodgerblue = 0x1E90FF;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], dodgerblue);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillSolid);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     3, LineSolid, CapButt, JoinRound);
-
-	i = 3;
-	unsigned long tomato = 0xFF6347;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], tomato);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillSolid);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);
-
-	i = 4;
-	unsigned long gray = 0x808080;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], gray);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillSolid);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);
-
-	i = 5;
-	unsigned long dimgray = 0x696969;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], dimgray);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillOpaqueStippled);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);	
-
-	i = 6;
-	unsigned long darkkhaki = 0xBDB76B;
-	xInfo.gc[i] = XCreateGC(xInfo.display, xInfo.window, 0, 0);
-	XSetForeground(xInfo.display, xInfo.gc[i], darkkhaki);
-	XSetBackground(xInfo.display, xInfo.gc[i], BlackPixel(xInfo.display, xInfo.screen));
-	XSetFillStyle(xInfo.display, xInfo.gc[i], FillOpaqueStippled);
-	XSetLineAttributes(xInfo.display, xInfo.gc[i],
-	                     1, LineSolid, CapButt, JoinRound);
-
 	loadFonts(xInfo);
 
 	XSelectInput(xInfo.display, xInfo.window, 
 		ButtonPressMask | KeyPressMask | 
 		PointerMotionMask | 
 		EnterWindowMask | LeaveWindowMask |
+		ExposureMask |
 		StructureNotifyMask);  // for resize events
 
 	/*
@@ -996,47 +1640,345 @@ void initX(int argc, char *argv[], XInfo &xInfo) {
 }
 
 /*
- * Function to repaint a display list
+ * Function to print the average frame time and X requests per frame once a second
+ */
+void reportFrame(unsigned long frameTime, unsigned long requests, unsigned long windowRequests) {
+	static unsigned long frames = 0;
+	static unsigned long totalTime = 0;
+	static unsigned long totalRequests = 0;
+	static unsigned long totalWindowRequests = 0;
+	static unsigned long lastReport = now();
+
+	frames++;
+	totalTime += frameTime;
+	totalRequests += requests;
+	totalWindowRequests += windowRequests;
+
+	if (now() - lastReport >= 1000000) {
+		cerr << "frames: " << frames << "  frame time: " << totalTime / frames << " us" <<
+		"  requests/frame: " << (double)totalRequests / frames <<
+		"  to the window: " << (double)totalWindowRequests / frames << endl;
+		frames = totalTime = totalRequests = totalWindowRequests = 0;
+		lastReport = now();
+	}
+}
+
+/*
+ * Function to paint every displayable of the current stage
  */
-void repaint( XInfo &xinfo) {
+void paintAll( Renderer &r) {
 	list<Displayable *>::const_iterator begin = dList.begin();
 	list<Displayable *>::const_iterator end = dList.end();
 
-	XClearWindow( xinfo.display, xinfo.window );
-    
+	/* no need to clear when a displayable of this stage covers everything anyway */
+	bool covered = false;
+	for (list<Displayable *>::const_iterator it = begin; it != end; it++) {
+		if ((curStage & (*it)->getStage()) && (*it)->coversFrame()) covered = true;
+	}
+	if (!covered) r.clear();
+
 	// draw display list
 	while( begin != end ) {
 		Displayable *d = *begin;
 		if (curStage & d->getStage()) {
-			d->paint(xinfo);
+			ScopedTimer timer(d->paintTime);
+			d->paint(r);
 		}
 		begin++;
 	}
-	XFlush( xinfo.display );
+}
+
+/*
+ * Function to repaint only the cells the game reported as changed, and the score bar if it changed.
+ * Returns the number of damaged areas put in rects.
+ */
+int paintDamage( Renderer &r, RenderRect rects[]) {
+	int numRects = 0;
+	if (curStage != PLAY_STG) return numRects; // the other stages are static until the stage changes
+
+	for (int i = 0; i < game.getNumChangedCells(); i++) {
+		int x = game.getChangedCell(i) % BoardWidth;
+		int y = game.getChangedCell(i) / BoardWidth;
+		if (!camera.inView(x, y)) continue;
+
+		RenderRect &rect = rects[numRects++];
+		rect.x = cellToPixelX(x);
+		rect.y = cellToPixelY(y);
+		rect.width = BlockSize;
+		rect.height = BlockSize;
+		r.fillRect(rect.x, rect.y, rect.width, rect.height, BACKGROUND_COLOR);
+
+		for (list<Displayable *>::const_iterator it = dList.begin(); it != dList.end(); it++) {
+			if (curStage & (*it)->getStage()) {
+				ScopedTimer timer((*it)->paintTime);
+				(*it)->paintCell(r, x, y);
+			}
+		}
+	}
+
+	numRects += scoreDisplay.paintChanged(r, rects + numRects);
+	return numRects;
+}
+
+/*
+ * Function to print the event loop wakeups per second and how late the tick and render deadlines were handled,
+ *	an overshoot of -1 means that deadline was not due at this wakeup
+ */
+void reportWakeup(long tickOvershoot, long renderOvershoot) {
+	static unsigned long wakeups = 0;
+	static unsigned long ticks = 0, tickTotal = 0, tickMax = 0;
+	static unsigned long renders = 0, renderTotal = 0, renderMax = 0;
+	static unsigned long lastReport = now();
+
+	wakeups++;
+	if (tickOvershoot >= 0) {
+		ticks++;
+		tickTotal += tickOvershoot;
+		if ((unsigned long)tickOvershoot > tickMax) tickMax = tickOvershoot;
+	}
+	if (renderOvershoot >= 0) {
+		renders++;
+		renderTotal += renderOvershoot;
+		if ((unsigned long)renderOvershoot > renderMax) renderMax = renderOvershoot;
+	}
+
+	unsigned long elapsed = now() - lastReport;
+	if (elapsed >= 1000000) {
+		cerr << "wakeups/s: " << wakeups * 1000000 / elapsed <<
+		"  tick overshoot avg/max: " << (ticks ? tickTotal / ticks : 0) << "/" << tickMax << " us" <<
+		"  render overshoot avg/max: " << (renders ? renderTotal / renders : 0) << "/" << renderMax << " us" << endl;
+		wakeups = ticks = tickTotal = tickMax = renders = renderTotal = renderMax = 0;
+		lastReport = now();
+	}
+}
+
+/*
+ * Function to repaint a display list, only the damaged areas when damageMode is on
+ */
+void repaint( Renderer &r) {
+	ScopedTimer frameTimer(frameTime);
+	RenderRect rects[MAX_CHANGED_CELLS + NUM_HUD_FIELDS];
+	int numRects = FULL_FRAME;
+
+	unsigned long frameStart = now();
+	unsigned long firstRequest = r.getRequests();
+	r.beginFrame();
+
+	/* a move of the camera changes every cell in view; in the arena it stays put while the player is dead */
+	if (arena) {
+		const ArenaSnake &player = arena->getSnake(PLAYER_SNAKE);
+		if ((curStage & PLAY_STG) && player.isAlive()) {
+			camera.follow(player.getHeadCell() % BoardWidth, player.getHeadCell() / BoardWidth);
+		}
+	} else if ((curStage & PLAY_STG) && camera.follow(game.getSnake().getHeadX(), game.getSnake().getHeadY())) {
+		needFullRepaint = true;
+	}
+
+	if (!damageMode || needFullRepaint || curStage != lastStage || game.allCellsChanged()) {
+		paintAll(r);
+	} else {
+		numRects = paintDamage(r, rects);
+	}
+	game.clearChanges();
+	needFullRepaint = false;
+	lastStage = curStage;
+	if (frameCount) (*frameCount)++;
+
+	ScopedTimer flushTimer(flushTime);
+	unsigned long presentRequest = r.getRequests();
+	r.present(rects, numRects);
+	unsigned long lastRequest = r.getRequests();
+
+	if (reportFrames) {
+		r.flush(true); // include the server time in the frame time
+		unsigned long requests = lastRequest - firstRequest;
+		unsigned long windowRequests = r.keepsFrame() ? lastRequest - presentRequest : requests;
+		reportFrame(now() - frameStart, requests, windowRequests);
+	} else {
+		r.flush(false);
+	}
+}
+
+/*
+ * Function to look up where the --stats timings go
+ */
+void initStats() {
+	eventTime = stats.histogram("events");
+	moveTime = stats.histogram("move");
+	autopilotTime = stats.histogram("autopilot");
+	tickTime = stats.histogram("tick");
+	frameTime = stats.histogram("frame");
+	flushTime = stats.histogram("present+flush");
+	tickOvershootTime = stats.histogram("tick_overshoot");
+	renderOvershootTime = stats.histogram("render_overshoot");
+
+	for (list<Displayable *>::const_iterator it = dList.begin(); it != dList.end(); it++) {
+		string histName = string("paint:") + (*it)->getName();
+		(*it)->paintTime = stats.histogram(histName.c_str());
+	}
+
+	frameCount = stats.counter("frames");
+	tickCount = stats.counter("ticks");
+	tickMisses = stats.counter("tick_deadline_misses");
+	renderMisses = stats.counter("render_deadline_misses");
+	droppedTicks = stats.counter("dropped_ticks");
+}
+
+/*
+ * Function to write the --stats file, runs at exit
+ */
+void writeStats() {
+	if (!statsPath) return;
+	if (stats.writeJson(statsPath)) {
+		cerr << "Wrote timing statistics to " << statsPath << endl;
+	} else {
+		cerr << "Cannot write " << statsPath << endl;
+	}
 }
 
 /* 
- * Function to set up variables when pausing
+ * Function to pause the game, the engine is simply not stepped while paused
  */
-void pause(Snake &snk) {
+void pauseGame() {
 	if (curStage != PLAY_STG) return; // can only pause during PLAY stage
-	SpecialFruitTimeUsed = now() - lastTimeSpecialFruit;
+	if (net) return; // the server does not wait
 	curStage = PLAY_STG | PAUSE_STG;
-	curXspeed = snk.getXspeed();
-	curYspeed = snk.getYspeed();
-	snk.setXspeed(0);
-	snk.setYspeed(0);
 }
 
 /* 
- *Function to set up resume related variables
+ * Function to resume the game
  */
-void resume(Snake &snk) {
+void resumeGame() {
 	if (curStage != (PLAY_STG | PAUSE_STG)) return; // can only resume during PAUSE stage
 	curStage = PLAY_STG;
-	snk.setXspeed(curXspeed);
-	snk.setYspeed(curYspeed);
-	lastTimeSpecialFruit = now() - SpecialFruitTimeUsed;
+}
+
+/*
+ * Function to write the --record file, runs at exit
+ */
+void writeRecording() {
+	recording.finish(sessionTick);
+	if (recording.save(recordPath)) {
+		cerr << "Wrote " << recording.getNumInputs() << " inputs over " << sessionTick << " ticks to " << recordPath << endl;
+	} else {
+		cerr << "Cannot write " << recordPath << endl;
+	}
+}
+
+/*
+ * Function to tell the server the player is gone, runs at exit
+ */
+void leaveServer() {
+	net->leave();
+}
+
+/*
+ * Function to give an input to the engine, recording it with --record; ignored while replaying
+ */
+void applyInput(int command) {
+	if (replay) return; // the recording drives the game
+	if (net) {
+		net->input(command); // applied to the predicted game at once
+		return;
+	}
+	if (recordPath) recording.add(sessionTick, command);
+	applyCommand(game, command);
+}
+
+/*
+ * Function to change the direction of the snake, only while playing
+ */
+void changeDirection(int direction) {
+	if (curStage != PLAY_STG) return;
+	if (arena) {
+		arena->changeDirection(direction);
+		return;
+	}
+	applyInput(direction);
+}
+
+/*
+ * Function to show the stage of the predicted game with --connect, a correction from the server can end a game or bring it back
+ */
+void followNetGame() {
+	if (game.isGameOver()) {
+		curStage = GAMEOVER_STG;
+	} else if (curStage == GAMEOVER_STG) {
+		curStage = PLAY_STG;
+	}
+}
+
+/*
+ * Function to move the snake one cell and report what happened
+ */
+void move() {
+	lastTickMoved = false;
+	if (net) {
+		/* the server's clock runs on whatever the stage, and so does the prediction */
+		prevTail = game.getSnake().getBlock(game.getSnake().getLength() - 1);
+		lastTickMoved = true;
+		int events;
+		{
+			ScopedTimer timer(moveTime);
+			events = net->tick();
+		}
+		sessionTick++;
+		if (verbose && (events & EV_LOST_LIFE)) cout << "Lost a life" << endl;
+		followNetGame();
+		return;
+	}
+	if (arena) {
+		if (curStage != PLAY_STG) return;
+		int events;
+		{
+			ScopedTimer timer(moveTime);
+			events = arena->step();
+		}
+		sessionTick++;
+		if (verbose && (events & EV_LOST_LIFE)) cout << "Crashed in the arena" << endl;
+		if (arena->isGameOver()) curStage = GAMEOVER_STG;
+		return;
+	}
+	if (replay && !replayDone) {
+		if (replay->applyInputs(game) && curStage == GAMEOVER_STG) curStage = PLAY_STG; // a reset or revive
+		if (replay->finished()) {
+			replayDone = true;
+			printf("Replay finished after %lu ticks, score %u, state hash %016llx\n", sessionTick, game.getScore(),
+				   (unsigned long long)stateHash(game));
+		}
+	}
+	if (replayDone || curStage != PLAY_STG) return;
+
+	if (autopilotMode && !replay) {
+		int direction;
+		{
+			ScopedTimer timer(autopilotTime);
+			direction = autopilot.decide(game);
+		}
+		if (direction != NO_INPUT && direction != game.getSnake().getDirection()) applyInput(direction);
+	}
+
+	prevTail = game.getSnake().getBlock(game.getSnake().getLength() - 1);
+	lastTickMoved = true;
+	int events;
+	{
+		ScopedTimer timer(moveTime);
+		events = game.step(NO_INPUT);
+	}
+	sessionTick++;
+	if (replay) replay->moved();
+	if (verbose) {
+		if (events & EV_HIT_BODY) cout << "Hit snake itself!" << endl;
+		if (events & EV_HIT_OBSTACLE) cout << "Hit the obstables" << endl;
+		if (events & EV_ATE_NORMAL) cout << "Eat Scoring Fruit!" << endl;
+		if (events & EV_ATE_HEART) cout << "Eat Heart Fruit" << endl;
+		if (events & EV_ATE_EVIL) cout << "Eat Evil Fruit, decreased lives by 1" << endl;
+		if (events & EV_GAMEWON) cout << "No room left for a fruit, you win!" << endl;
+		if (events & EV_GAMEOVER) cout << "Game Over!" << endl;
+	}
+	if (game.isGameOver()) {
+		curStage = GAMEOVER_STG;
+	}
 }
 
 void handleKeyPress(XInfo &xinfo, XEvent &event) {
@@ -1062,37 +2004,38 @@ void handleKeyPress(XInfo &xinfo, XEvent &event) {
 				error("Terminating normally."); // can quit at any stage
 			case 'r':
 			case 'R':
-				if (curStage == START_STG) break; // cannot restart at the start stage
+				if (curStage == START_STG || replay) break; // cannot restart at the start stage or in a replay
 				curStage = PLAY_STG;
-				numOfLives = 3;
-				snake = Snake(340, 300);
-				fruit = Fruit();
-				obstacles.generateObstacles();
-				score = 0;
+				if (arena) {
+					arena->reset();
+					needFullRepaint = true;
+				} else {
+					applyInput(CMD_RESET);
+				}
 				break;
 			case 'p':
 			case 'P':
-				pause(snake);
+				pauseGame();
 				break;
 			case 'y':
 			case 'Y':
-				resume(snake);
+				resumeGame();
 				break;
 			case 'w':
 			case 'W':
-				snake.changeDirection(UP);
+				changeDirection(UP);
 				break;
 			case 'a':
 			case 'A':
-				snake.changeDirection(LEFT);
+				changeDirection(LEFT);
 				break;
 			case 's':
 			case 'S':
-				snake.changeDirection(DOWN);
+				changeDirection(DOWN);
 				break;
 			case 'd':
 			case 'D':
-				snake.changeDirection(RIGHT);
+				changeDirection(RIGHT);
 				break;
 		}
 	}
@@ -1100,16 +2043,16 @@ void handleKeyPress(XInfo &xinfo, XEvent &event) {
 	if (key) {
 		switch (key) {
 			case XK_Left:
-				snake.changeDirection(LEFT);
+				changeDirection(LEFT);
 				break;
 			case XK_Right:
-				snake.changeDirection(RIGHT);
+				changeDirection(RIGHT);
 				break;
 			case XK_Up:
-				snake.changeDirection(UP);
+				changeDirection(UP);
 				break;
 			case XK_Down:
-				snake.changeDirection(DOWN);
+				changeDirection(DOWN);
 				break;
 		}
 	}
@@ -1126,8 +2069,12 @@ void handleButtonPress(XInfo &xinfo, XEvent &event) {
 
 	//XDrawRectangle(xinfo.display, xinfo.window, xinfo.gc[TOMATO_GC], 405, 235, 22, 24);
 	/* Back Door to REBORN when dead: click the 'O' in GAME OVER around pixel (405,235) width 22, height 24 */
-	if ((curStage == GAMEOVER_STG) && (x >= 405) && (x <= (405+22)) && (y >= 235) && (y <= (235+24))) {
-		numOfLives++;
+	if (!replay && (curStage == GAMEOVER_STG) && (x >= 405) && (x <= (405+22)) && (y >= 235) && (y <= (235+24))) {
+		if (arena) {
+			arena->revive();
+		} else {
+			applyInput(CMD_REVIVE);
+		}
 		curStage = PLAY_STG;
 	}
 
@@ -1136,9 +2083,9 @@ void handleButtonPress(XInfo &xinfo, XEvent &event) {
 void handleAnimation(XInfo &xinfo, int inside) {
 	/* Move the cursor out of the game window can pause the game, and move back in to resume */
 	if (inside == 1 && lastEnterLeaveNotify == 0) { // EnterNotify
-		resume(snake);
+		resumeGame();
 	} else if (inside == 0 && lastEnterLeaveNotify == 1) { // LeaveNotify
-		pause(snake);
+		pauseGame();
 	}
 
 	if (inside != lastEnterLeaveNotify) {
@@ -1146,31 +2093,95 @@ void handleAnimation(XInfo &xinfo, int inside) {
 	}
 }
 
-void eventLoop(XInfo &xinfo) {
-	// Add stuff to paint to the display list
+/*
+ * Function to add stuff to paint to the display list
+ */
+void initDisplayList() {
 	dList.push_front(&pauseDisplay);
-	dList.push_front(&snake);
-    	dList.push_front(&fruit);
+	if (arena) {
+		dList.push_front(&arenaDisplay);
+	} else {
+		dList.push_front(&snakeDisplay);
+		dList.push_front(&fruitDisplay);
+	}
     	dList.push_front(&scoreDisplay);
-    	dList.push_front(&obstacles);
+    	dList.push_front(&obstaclesDisplay);
     	dList.push_front(&startDisplay);
 	dList.push_front(&gameoverDisplay);
+}
+
+/*
+ * Function for --bench-frames: step and repaint the given number of frames back to back in the PLAY stage,
+ *	with a snake half the board long following a cycle so it never dies, and print the time and requests
+ *	per frame as a line in the same JSON shape as snake-bench
+ */
+void benchFrames(Renderer &r, int frames) {
+	initDisplayList();
+
+	CyclePolicy policy;
+	int length = BoardWidth * BoardHeight / 2;
+	if (!arena) game.resetWithSnake(policy.snakeOnCycle(length));
+	curStage = PLAY_STG;
+	r.flush(true);
+
+	unsigned long firstRequest = r.getRequests();
+	unsigned long start = nowNs();
+	for (int i = 0; i < frames; i++) {
+		if (arena) {
+			arena->step();
+			if (arena->isGameOver()) arena->revive();
+		} else {
+			game.step(policy.direction(game));
+			if (game.isGameOver()) game.resetWithSnake(policy.snakeOnCycle(length)); // board filled up
+		}
+		repaint(r);
+		r.flush(true); // include the server time
+	}
+	unsigned long elapsed = nowNs() - start;
+	unsigned long requests = r.getRequests() - firstRequest;
+
+	printf("{\"name\": \"repaint\", \"param\": \"%s %s%s\", \"ops\": %d, \"ns_per_op\": %.3f, "
+		   "\"requests_per_op\": %.3f}\n", (damageMode ? "damage" : "full-repaint"), r.getName(), (arena ? " arena" : ""), frames,
+		   (double)elapsed / frames, (double)requests / frames);
+}
+
+void eventLoop(XInfo &xinfo) {
+	initDisplayList();
 
 	XEvent event;
-	unsigned long lastRepaint = now();
-	unsigned long lastMove = now();
 	int inside = 0;
 
-	curStage = START_STG;
+	curStage = (replay || net) ? PLAY_STG : START_STG;
 
-	unsigned long frameStart = now();
-	unsigned long frameEnd = frameStart;
+	if (statsPath) {
+		initStats();
+		atexit(writeStats);
+	}
 
-	while( true ) {
+	/* the loop sleeps in poll() until there is X input or the tick or render deadline is due */
+	DeadlineTimer tickTimer;
+	DeadlineTimer renderTimer;
+	unsigned long tickInterval = net ? net->getTickInterval() : 750000 / (speed * replaySpeed);
+	tickTimer.start(tickInterval > 0 ? tickInterval : 1);
+	renderTimer.start(1000000/FPS);
+
+	pollfd fds[4];
+	fds[0].fd = ConnectionNumber(xinfo.display);
+	fds[1].fd = tickTimer.getFd();
+	fds[2].fd = renderTimer.getFd();
+	int numFds = 3;
+	if (net) fds[numFds++].fd = net->getFd(); // the snapshots from the server
+	for (int i = 0; i < numFds; i++) {
+		fds[i].events = POLLIN;
+	}
 
-		if (XPending(xinfo.display) > 0) {
+	while( true ) {
+		/* handle every queued event, XPending also flushes the output buffer */
+		while (XPending(xinfo.display) > 0) {
+			ScopedTimer timer(eventTime);
 			XNextEvent( xinfo.display, &event );
 			if (verbose) cout << "event.type=" << event.type << "\n";
+			if (shmRenderer) shmRenderer->handleEvent(event);
 			switch( event.type ) {
 				case KeyPress:
 					handleKeyPress(xinfo, event);
@@ -1184,32 +2195,63 @@ void eventLoop(XInfo &xinfo) {
 				case ButtonPress:
 					handleButtonPress(xinfo, event);
 					break;
+				case Expose:
+					needFullRepaint = true;
+					break;
 			}
 		}
 
-		unsigned long repaintEnd = now(); // time in microseconds
-		if (repaintEnd - lastRepaint > 1000000/FPS) {
-			handleAnimation(xinfo, inside);
-			repaint(xinfo);
-			lastRepaint = now();
+		if (poll(fds, numFds, -1) < 0) {
+			if (errno == EINTR) continue;
+			error("poll failed.");
 		}
 
-		unsigned long moveEnd = now(); // time in microseconds
-		if (moveEnd - lastMove > 750000/speed) {
-			snake.move(xinfo);
-			lastMove = now();
+		long tickOvershoot = -1;
+		long renderOvershoot = -1;
+
+		if (net && (fds[3].revents & POLLIN)) {
+			if (net->receive()) needFullRepaint = true; // the predicted game was replaced
+			followNetGame();
 		}
 
-		frameEnd = now();
-		if (XPending(xinfo.display) == 0) {
-			// cout << 1000000/FPS - (frameEnd - frameStart) << endl;
-			if ((frameEnd - frameStart) < 1000000/FPS) usleep(1000000/FPS - (frameEnd - frameStart));
-			frameStart = now();
-		} else {
-			while (frameEnd > (frameStart + 1000000/FPS)) {
-				frameStart += 1000000/FPS;
+		/*
+		 * Fixed timestep: run one move for every tick deadline that has passed, however late the wakeup,
+		 *	so the simulation never depends on the frame rate
+		 */
+		if (fds[1].revents & POLLIN) {
+			ScopedTimer timer(tickTime);
+			unsigned long due = tickTimer.expire();
+			if (due > 0) {
+				tickOvershoot = tickTimer.getOvershoot();
+				if (statsPath) {
+					*tickCount += due;
+					*tickMisses += due - 1; // deadlines that passed without a wakeup of their own
+					tickOvershootTime->record(tickOvershoot * 1000);
+				}
+			}
+			if (due > MAX_CATCHUP_TICKS) {
+				if (verbose) cout << "Dropped " << due - MAX_CATCHUP_TICKS << " ticks" << endl;
+				if (statsPath) *droppedTicks += due - MAX_CATCHUP_TICKS;
+				due = MAX_CATCHUP_TICKS;
+			}
+			for (unsigned long i = 0; i < due; i++) {
+				move();
 			}
 		}
+
+		unsigned long frames = 0;
+		if ((fds[2].revents & POLLIN) && (frames = renderTimer.expire()) > 0) {
+			renderOvershoot = renderTimer.getOvershoot();
+			if (statsPath) {
+				*renderMisses += frames - 1;
+				renderOvershootTime->record(renderOvershoot * 1000);
+			}
+			handleAnimation(xinfo, inside);
+			tickProgress = (curStage == PLAY_STG) ? tickTimer.progress() : 1.0;
+			repaint(*renderer);
+		}
+
+		if (reportFrames) reportWakeup(tickOvershoot, renderOvershoot);
 	}
 }
 
@@ -1220,11 +2262,69 @@ void eventLoop(XInfo &xinfo) {
  *	 Exit forcing window manager to clean up - cheesy, but easy.
  */
 int main ( int argc, char *argv[] ) {
-	enum {	MAX_FPS = 100,
+	enum {	MAX_FPS = 360,
 			MIN_FPS = 1,
 			MAX_SPEED = 10,
 			MIN_SPEED = 1 };
 
+	/* Handle the --options first, the rest are the frame rate and speed */
+	int numArgs = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--direct") == 0) {
+			bufferMode = DIRECT_BUF;
+		} else if (strcmp(argv[i], "--no-dbe") == 0) {
+			bufferMode = PIXMAP_BUF;
+		} else if (strcmp(argv[i], "--framebuffer") == 0) {
+			bufferMode = FRAMEBUFFER_BUF;
+		} else if (strcmp(argv[i], "--null-renderer") == 0) {
+			nullRenderer = 1;
+		} else if (strncmp(argv[i], "--ppm=", 6) == 0) {
+			ppmPath = argv[i] + 6;
+		} else if (strcmp(argv[i], "--full-repaint") == 0) {
+			damageMode = 0;
+		} else if (strcmp(argv[i], "--smooth") == 0) {
+			smooth = 1;
+			damageMode = 0; // every frame moves the head and tail a little
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			statsPath = "snake-stats.json";
+		} else if (strncmp(argv[i], "--stats=", 8) == 0) {
+			statsPath = argv[i] + 8;
+		} else if (strncmp(argv[i], "--bench-frames=", 15) == 0) {
+			benchFrameCount = atoi(argv[i] + 15);
+			if (benchFrameCount <= 0) usage(argv);
+		} else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			seed = strtoull(argv[i] + 7, NULL, 10);
+			haveSeed = true;
+		} else if (strncmp(argv[i], "--record=", 9) == 0) {
+			recordPath = argv[i] + 9;
+		} else if (strncmp(argv[i], "--replay=", 9) == 0) {
+			replayPath = argv[i] + 9;
+		} else if (strncmp(argv[i], "--replay-speed=", 15) == 0) {
+			replaySpeed = atof(argv[i] + 15);
+			if (replaySpeed <= 0) usage(argv);
+		} else if (strcmp(argv[i], "--autopilot") == 0) {
+			autopilotMode = 1;
+		} else if (strncmp(argv[i], "--arena=", 8) == 0) {
+			arenaSnakes = atoi(argv[i] + 8);
+			if (arenaSnakes <= 0 || arenaSnakes >= MAX_ARENA_SNAKES) usage(argv);
+		} else if (strncmp(argv[i], "--connect=", 10) == 0) {
+			connectAddress = argv[i] + 10;
+		} else if (strncmp(argv[i], "--room=", 7) == 0) {
+			connectRoom = atoi(argv[i] + 7);
+			if (connectRoom < 0) usage(argv);
+		} else if (strncmp(argv[i], "--board=", 8) == 0) {
+			if (!parseBoardSize(argv[i] + 8)) usage(argv);
+			boardSet = true;
+		} else if (strcmp(argv[i], "--report") == 0) {
+			reportFrames = 1;
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			usage(argv);
+		} else {
+			argv[numArgs++] = argv[i];
+		}
+	}
+	argc = numArgs;
+
 	/* Handle command line argument */
     switch (argc) {
     	case 3:
@@ -1245,9 +2345,65 @@ int main ( int argc, char *argv[] ) {
         	usage(argv);
     } // switch
 
+	if (recordPath && replayPath) usage(argv);
+	if ((nullRenderer || ppmPath) && !benchFrameCount) usage(argv); // there is no window to play in
+	if (boardSet && replayPath) usage(argv); // the board comes from the recording
+	if (arenaSnakes && (recordPath || replayPath || autopilotMode || smooth)) usage(argv); // only for the one game
+	/* the server has the board and seed, and plays on whatever the client does */
+	if (connectAddress && (recordPath || replayPath || arenaSnakes || autopilotMode || smooth || boardSet || haveSeed ||
+						   benchFrameCount)) {
+		usage(argv);
+	}
+
+	if (arenaSnakes) {
+		if (!boardSet) setBoardSize(ArenaBoardSize, ArenaBoardSize);
+		if (!haveSeed) seed = time(0);
+		arena = new Arena(arenaSnakes, seed, max(1u, thread::hardware_concurrency()));
+		damageMode = 0; // hundreds of snakes change cells all over the view every tick
+	}
+
+	if (connectAddress) {
+		net = new NetClient(game);
+		string reason;
+		if (!net->join(connectAddress, connectRoom, 2000, reason)) error(reason);
+		if (!net->isPlayer()) error("Someone already plays in that room.");
+		atexit(leaveServer);
+	} else if (replayPath) {
+		if (!recording.load(replayPath)) error(string("Cannot read the recording ") + replayPath);
+		speed = recording.getSpeed();
+		replay = new Replay(recording);
+		replay->restart(game);
+	} else {
+		if (!haveSeed) seed = time(0); // random number seed
+		game.reset(seed);
+		if (recordPath) {
+			recording.start(seed, speed);
+			atexit(writeRecording);
+		}
+	}
+
+	initBoardLayout();
+
+	/* the backends without a display only draw the benchmark frames */
+	if (nullRenderer || ppmPath) {
+		OffscreenRenderer *offscreen = ppmPath ? new OffscreenRenderer(width, height) : NULL;
+		renderer = offscreen ? (Renderer *)offscreen : new NullRenderer();
+		benchFrames(*renderer, benchFrameCount);
+		if (offscreen && !offscreen->writePpm(ppmPath)) error(string("Cannot write ") + ppmPath);
+		delete renderer;
+		return 0;
+	}
+
 	XInfo xInfo;
 
 	initX(argc, argv, xInfo);
-	eventLoop(xInfo);
+	renderer = createRenderer(xInfo);
+	if (!renderer->keepsFrame()) damageMode = 0;
+	if (benchFrameCount) {
+		benchFrames(*renderer, benchFrameCount);
+	} else {
+		eventLoop(xInfo);
+	}
+	delete renderer;
 	XCloseDisplay(xInfo.display);
 }
@@ -0,0 +1,114 @@
+/*
+ * Timing statistics, see stats.h
+ */
+
+#include <cstring>
+
+#include "stats.h"
+
+
+void Histogram::reset() {
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	sum = 0;
+	max = 0;
+}
+
+int Histogram::bucketOf(unsigned long value) {
+	if (value < HIST_SUB_BUCKETS) return value;
+
+	int exponent = 63 - __builtin_clzl(value); // at least 4
+	int sub = (value >> (exponent - 4)) & (HIST_SUB_BUCKETS - 1);
+	return HIST_SUB_BUCKETS + (exponent - 4) * HIST_SUB_BUCKETS + sub;
+}
+
+unsigned long Histogram::bucketValue(int bucket) {
+	if (bucket < HIST_SUB_BUCKETS) return bucket;
+
+	int exponent = (bucket - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS + 4;
+	int sub = (bucket - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+	unsigned long low = (unsigned long)(HIST_SUB_BUCKETS + sub) << (exponent - 4);
+	unsigned long width = 1UL << (exponent - 4);
+	return low + width / 2; // middle of the bucket
+}
+
+void Histogram::record(unsigned long ns) {
+	buckets[bucketOf(ns)]++;
+	count++;
+	sum += ns;
+	if (ns > max) max = ns;
+}
+
+void Histogram::merge(const Histogram &other) {
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		buckets[i] += other.buckets[i];
+	}
+	count += other.count;
+	sum += other.sum;
+	if (other.max > max) max = other.max;
+}
+
+unsigned long Histogram::percentile(double p) const {
+	if (count == 0) return 0;
+
+	unsigned long target = (unsigned long)(p * count);
+	if (target == 0) target = 1;
+
+	unsigned long seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen >= target) {
+			unsigned long value = bucketValue(i);
+			return (value > max) ? max : value;
+		}
+	}
+	return max;
+}
+
+void Histogram::writeJson(FILE *out) const {
+	fprintf(out, "{\"count\": %lu, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+			count, getMean() / 1000.0, percentile(0.50) / 1000.0, percentile(0.95) / 1000.0,
+			percentile(0.99) / 1000.0, max / 1000.0);
+}
+
+
+Histogram *Stats::histogram(const char *name) {
+	for (int i = 0; i < numHistograms; i++) {
+		if (strcmp(histogramNames[i], name) == 0) return &histograms[i];
+	}
+	if (numHistograms == MAX_HISTOGRAMS) return NULL; // ScopedTimer ignores it
+
+	strncpy(histogramNames[numHistograms], name, MAX_STAT_NAME - 1);
+	histogramNames[numHistograms][MAX_STAT_NAME - 1] = '\0';
+	histograms[numHistograms].reset();
+	return &histograms[numHistograms++];
+}
+
+unsigned long *Stats::counter(const char *name) {
+	for (int i = 0; i < numCounters; i++) {
+		if (strcmp(counterNames[i], name) == 0) return &counters[i];
+	}
+	if (numCounters == MAX_COUNTERS) return NULL;
+
+	strncpy(counterNames[numCounters], name, MAX_STAT_NAME - 1);
+	counterNames[numCounters][MAX_STAT_NAME - 1] = '\0';
+	counters[numCounters] = 0;
+	return &counters[numCounters++];
+}
+
+bool Stats::writeJson(const char *path) const {
+	FILE *out = fopen(path, "w");
+	if (!out) return false;
+
+	fprintf(out, "{\n  \"counters\": {");
+	for (int i = 0; i < numCounters; i++) {
+		fprintf(out, "%s\n    \"%s\": %lu", (i ? "," : ""), counterNames[i], counters[i]);
+	}
+	fprintf(out, "\n  },\n  \"timings_us\": {");
+	for (int i = 0; i < numHistograms; i++) {
+		fprintf(out, "%s\n    \"%s\": ", (i ? "," : ""), histogramNames[i]);
+		histograms[i].writeJson(out);
+	}
+	fprintf(out, "\n  }\n}\n");
+	return fclose(out) == 0;
+}
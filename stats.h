@@ -0,0 +1,128 @@
+/*
+ * Timing statistics: histograms of durations and counters, written out as JSON.
+ *
+ * Recording is a few arithmetic operations on fixed arrays, it never allocates, so it can stay on
+ * in the event loop and in the benchmarks.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+
+/*
+ * Macros for the histogram buckets: values below 16 get a bucket each, above that every power of two
+ * is split into 16 buckets, so a percentile is off by at most about 6%
+ */
+#define HIST_SUB_BUCKETS 16
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + 60 * HIST_SUB_BUCKETS)
+
+/*
+ * Macros for the size of a Stats set
+ */
+#define MAX_HISTOGRAMS 32
+#define MAX_COUNTERS 16
+#define MAX_STAT_NAME 48
+
+/*
+ * Function to get the nanoseconds from the monotonic clock
+ */
+inline unsigned long nowNs() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Class for a histogram of durations in nanoseconds
+ */
+class Histogram {
+public:
+	Histogram() {
+		reset();
+	}
+
+	void reset();
+
+	void record(unsigned long ns);
+
+	/* Method to add the values recorded in another histogram, e.g. one a thread kept to itself */
+	void merge(const Histogram &other);
+
+	/* Method to get the value below which a fraction p (0 to 1) of the recorded values fall */
+	unsigned long percentile(double p) const;
+
+	unsigned long getCount() const {
+		return count;
+	}
+
+	unsigned long getMax() const {
+		return max;
+	}
+
+	double getMean() const {
+		return count ? (double)sum / count : 0.0;
+	}
+
+	/* Method to write count, mean, p50, p95, p99 and max in microseconds as a JSON object */
+	void writeJson(FILE *out) const;
+
+private:
+	static int bucketOf(unsigned long value);
+	static unsigned long bucketValue(int bucket);
+
+	unsigned long buckets[HIST_BUCKETS];
+	unsigned long count;
+	unsigned long sum;
+	unsigned long max;
+};
+
+/*
+ * Class for a set of named histograms and counters that are written out together
+ */
+class Stats {
+public:
+	Stats() {
+		numHistograms = 0;
+		numCounters = 0;
+	}
+
+	/* Method to find a histogram by name, adding it the first time; look it up once and keep the pointer */
+	Histogram *histogram(const char *name);
+
+	/* Method to find a counter by name, adding it the first time */
+	unsigned long *counter(const char *name);
+
+	/* Method to write everything to a JSON file, returns false if the file cannot be written */
+	bool writeJson(const char *path) const;
+
+private:
+	Histogram histograms[MAX_HISTOGRAMS];
+	char histogramNames[MAX_HISTOGRAMS][MAX_STAT_NAME];
+	int numHistograms;
+	unsigned long counters[MAX_COUNTERS];
+	char counterNames[MAX_COUNTERS][MAX_STAT_NAME];
+	int numCounters;
+};
+
+/*
+ * Class to time a scope into a histogram, does nothing when the histogram is NULL
+ */
+class ScopedTimer {
+public:
+	ScopedTimer(Histogram *hist) : hist(hist) {
+		start = hist ? nowNs() : 0;
+	}
+
+	~ScopedTimer() {
+		if (hist) hist->record(nowNs() - start);
+	}
+
+private:
+	Histogram *hist;
+	unsigned long start;
+};
+
+#endif